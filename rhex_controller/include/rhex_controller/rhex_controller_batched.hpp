@@ -0,0 +1,289 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_BATCHED_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_BATCHED_HPP
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_buehler.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+#include <rhex_controller/rhex_controller_simple.hpp>
+
+// Population versions of the Buehler and Simple controllers.
+// Every parameter is stored structure-of-arrays, leg-major: value[leg * size() + n]
+// holds the value of genome n for that leg, so the inner loops run over contiguous
+// memory across the whole population and the compiler can vectorize them.
+// pos_batch() writes an N x 6 row-major matrix: out[n * 6 + leg].
+// Genomes can be evaluated on damaged robots, each with its own broken legs: the
+// Buehler controller then stores and computes the live legs only (see
+// BatchedLegIndex), and the targets (and gains) of broken legs are 0.
+
+namespace rhex_controller {
+
+    class BatchedBuehlerController {
+    public:
+        static constexpr size_t legs = RhexControllerBuehler::legs;
+
+        BatchedBuehlerController() : _size(0) {}
+
+        // broken_legs[n] lists the broken legs of genome n, or is empty when none is
+        BatchedBuehlerController(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            set_parameters(ctrls, broken_legs);
+        }
+
+        void set_parameters(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            _size = ctrls.size();
+            _index.assign(_size, broken_legs);
+
+            size_t slots = _index.slots();
+            _period.assign(slots, 0);
+            _duty_time.assign(slots, 0);
+            _stance_angle.assign(slots, 0);
+            _stance_offset.assign(slots, 0);
+            _phase_offset.assign(slots, 0);
+
+            for (size_t n = 0; n < _size; ++n)
+                set_parameters(n, ctrls[n]);
+        }
+
+        // replace a single genome, mirrors RhexControllerBuehler::set_parameters
+        void set_parameters(size_t n, const std::vector<double>& ctrl)
+        {
+            assert(ctrl.size() == RhexControllerBuehler::ctrl_size);
+            assert(n < _size);
+
+            double period = 1 - ctrl[0] * (1 - RhexControllerBuehler::min_period);
+
+            for (size_t i = 0; i < legs; ++i)
+            {
+                int k = _index.slot(i, n);
+                if (k < 0)
+                    continue;
+
+                _period[k] = period;
+                _duty_time[k] = ctrl[i + 1] * period;
+                _stance_angle[k] = ctrl[i + 1 + legs] * pi;
+                _stance_offset[k] = (ctrl[i + 1 + 2 * legs] - 0.5) * RhexControllerBuehler::max_offset;
+                // leg 0 is the reference leg
+                _phase_offset[k] = (i == 0) ? 0 : ctrl[3 * legs + i] * period / 2;
+            }
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        const BatchedLegIndex<legs>& leg_index() const
+        {
+            return _index;
+        }
+
+        void pos_batch(double t, std::vector<double>& out)
+        {
+            if (out.size() != legs * _size)
+                out.resize(legs * _size);
+            pos_batch(t, out.data());
+        }
+
+        // out must hold size() * 6 values, broken legs get 0. As RhexControllerBuehler, the
+        // targets are a function of t, so pos_batch can be called at any time.
+        void pos_batch(double t, double* out)
+        {
+            // only the live legs are stored, each leg over a contiguous range of slots
+            for (size_t i = 0; i < legs; ++i)
+            {
+                size_t first = _index.offset(i);
+                size_t count = _index.count(i);
+                const double* phase_offset = &_phase_offset[first];
+                const double* period = &_period[first];
+                const double* duty_time = &_duty_time[first];
+                const double* stance_angle = &_stance_angle[first];
+                const double* stance_offset = &_stance_offset[first];
+
+                // with no genome missing the leg, slot n is genome n and the
+                // stores keep their stride
+                if (count == _size)
+                {
+                    for (size_t n = 0; n < count; ++n)
+                        out[n * legs + i] = step(t, phase_offset[n], period[n], duty_time[n], stance_angle[n], stance_offset[n]);
+                }
+                else
+                {
+                    const size_t* output = &_index.output()[first];
+                    for (size_t n = 0; n < count; ++n)
+                        out[output[n]] = step(t, phase_offset[n], period[n], duty_time[n], stance_angle[n], stance_offset[n]);
+                }
+            }
+
+            for (size_t b : _index.broken_output())
+                out[b] = 0;
+        }
+
+    protected:
+        // target of a leg at t, computed as RhexControllerBuehler::pos_at does: t is reduced
+        // to the cycle before the phase offset is added, and the whole cycles wound back
+        static double step(double t, double phase_offset, double period, double duty_time, double stance_angle, double stance_offset)
+        {
+            double cycles = floor(t / period);
+            double phase = phase_offset + (t - cycles * period);
+
+            double counter = floor(phase / period);
+            double tt = phase - counter * period;
+
+            // the single controller's leg_position adds the stance offset Legs times,
+            // as the baseline did, and the batched targets match it
+            return RhexControllerBuehler::leg_angle(tt, period, duty_time, stance_angle)
+                + (counter + cycles) * 2 * pi + legs * stance_offset;
+        }
+
+        size_t _size;
+        BatchedLegIndex<legs> _index;
+
+        // per live leg, indexed by the slots of _index
+        std::vector<double> _period;
+        std::vector<double> _duty_time;
+        std::vector<double> _stance_angle;
+        std::vector<double> _stance_offset;
+        std::vector<double> _phase_offset;
+    };
+
+    class BatchedSimpleController {
+    public:
+        static constexpr size_t legs = RhexControllerSimple::legs;
+
+        BatchedSimpleController() : _size(0) {}
+
+        // broken_legs[n] lists the broken legs of genome n, or is empty when none is
+        BatchedSimpleController(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            set_parameters(ctrls, broken_legs);
+        }
+
+        void set_parameters(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            _size = ctrls.size();
+            _index.assign(_size, broken_legs);
+            for (size_t p = 0; p < PARAMS; ++p)
+                _ctrl[p].assign(_size, 0);
+            _ratio.assign(_size, 0);
+            _other.assign(_size, 0);
+
+            for (size_t n = 0; n < _size; ++n)
+                set_parameters(n, ctrls[n]);
+        }
+
+        // replace a single genome, only the first 8 of the 48 values are used
+        void set_parameters(size_t n, const std::vector<double>& ctrl)
+        {
+            assert(ctrl.size() == 48);
+            assert(n < _size);
+
+            for (size_t p = 0; p < PARAMS; ++p)
+                _ctrl[p][n] = ctrl[p];
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        // Kd of genome n, it does not change during the cycle
+        double Kd(size_t n) const
+        {
+            return _ctrl[6][n];
+        }
+
+        const BatchedLegIndex<legs>& leg_index() const
+        {
+            return _index;
+        }
+
+        void pos_batch(double t, std::vector<double>& out)
+        {
+            if (out.size() != 6 * _size)
+                out.resize(6 * _size);
+            pos_batch(t, out.data());
+        }
+
+        // out must hold size() * 6 values, Kp (if given) receives the size() * 6
+        // leg gains that RhexControllerSimple writes at indices 6 to 11 of get_Kp().
+        // Both are 0 for broken legs.
+        void pos_batch(double t, double* out, double* Kp = nullptr)
+        {
+            double help = RhexControllerSimple::cycle_position(t);
+
+            const double* c0 = _ctrl[0].data();
+            const double* c1 = _ctrl[1].data();
+            const double* c2 = _ctrl[2].data();
+            const double* c3 = _ctrl[3].data();
+            const double* c4 = _ctrl[4].data();
+            const double* c5 = _ctrl[5].data();
+            const double* c7 = _ctrl[7].data();
+            double* ratio = _ratio.data();
+            double* other = _other.data();
+
+            // the math runs on contiguous arrays first, one tripod per loop so that
+            // each loop vectorizes, then both tripods are spread over the rows of out
+            for (size_t n = 0; n < _size; ++n)
+                ratio[n] = RhexControllerSimple::rotation_ratio(help, c0[n], c1[n]) * 2 * pi;
+
+            for (size_t n = 0; n < _size; ++n)
+            {
+                double temp = RhexControllerSimple::shifted_position(help, c4[n]);
+                other[n] = RhexControllerSimple::rotation_ratio(temp, c2[n], c3[n]) * 2 * pi;
+            }
+
+            for (size_t n = 0; n < _size; ++n)
+            {
+                double* row = out + n * 6;
+                row[0] = ratio[n]; row[2] = ratio[n]; row[4] = ratio[n];
+                row[1] = other[n]; row[3] = other[n]; row[5] = other[n];
+            }
+
+            for (size_t b : _index.broken_output())
+                out[b] = 0;
+
+            if (!Kp)
+                return;
+
+            for (size_t n = 0; n < _size; ++n)
+                ratio[n] = (help > c0[n]) ? c7[n] : c5[n];
+
+            for (size_t n = 0; n < _size; ++n)
+            {
+                double temp = RhexControllerSimple::shifted_position(help, c4[n]);
+                other[n] = (temp > c2[n]) ? c7[n] : c5[n];
+            }
+
+            for (size_t n = 0; n < _size; ++n)
+            {
+                double* row = Kp + n * 6;
+                row[0] = ratio[n]; row[2] = ratio[n]; row[4] = ratio[n];
+                row[1] = other[n]; row[3] = other[n]; row[5] = other[n];
+            }
+
+            for (size_t b : _index.broken_output())
+                Kp[b] = 0;
+        }
+
+    protected:
+        static const size_t PARAMS = 8;
+
+        size_t _size;
+        BatchedLegIndex<legs> _index;
+        std::vector<double> _ctrl[PARAMS];
+
+        // per genome scratch for the two tripods
+        std::vector<double> _ratio;
+        std::vector<double> _other;
+    };
+} // namespace rhex_controller
+
+#endif
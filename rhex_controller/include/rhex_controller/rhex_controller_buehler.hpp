@@ -2,109 +2,374 @@
 #define RHEX_CONTROLLER_RHEX_CONTROLLER_BUEHLER
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <type_traits>
 #include <vector>
 
-#define PI 3.14159265
-#define CTRL_SIZE 24
-#define DOF 6
-#define F 3
-#define OFFSET PI/2
-#define MIN_P 0.33 // min period is 0.33 or 3 cycles per second
+#include <rhex_controller/rhex_controller_command.hpp>
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+#include <rhex_controller/rhex_controller_trace.hpp>
 
 namespace rhex_controller {
 
-    class RhexControllerBuehler {
+    // Legs is the number of legs, Scalar the type the gait is computed in (float, or
+    // Q16_16 of rhex_controller_fixed.hpp, for small boards). The genome holds 4 values
+    // per leg: the period, then per leg the duty factor, stance angle and stance
+    // offset, then the phase offsets of all legs but the reference one.
+    //
+    // The gait time is reduced to the current cycle in double before it is converted
+    // to Scalar, so the phases stay within a few periods however long the gait runs,
+    // and the cycles are counted with the period of the genome rather than its
+    // rounding to Scalar. The whole cycles, a turn of every leg each, are added to the
+    // targets in double. A Q16_16 target would overflow after about 30 minutes, and a
+    // float one lose 0.05 rad within an hour, so in float and fixed point they are
+    // left out and given by cycles().
+    template <size_t Legs = default_legs, typename Scalar = double>
+    class BasicRhexControllerBuehler {
     public:
+        typedef Scalar scalar_t;
+        typedef std::array<Scalar, Legs> output_t;
+        typedef ControlCommand<Legs, Scalar> command_t;
+        typedef GainSchedule<Legs, Scalar> gain_schedule_t;
 
-        RhexControllerBuehler() {}
+        static constexpr size_t legs = Legs;
+        static constexpr size_t ctrl_size = 4 * Legs;
+        // whether the targets include the whole cycles (see cycles())
+        static constexpr bool winds = std::is_floating_point<Scalar>::value && sizeof(Scalar) >= sizeof(double);
 
-        RhexControllerBuehler(const std::vector<double>& ctrl)
+        static constexpr Scalar pi = Scalar(rhex_controller::pi);
+        // min period is 0.33 or 3 cycles per second
+        static constexpr Scalar min_period = Scalar(0.33);
+        static constexpr Scalar max_offset = Scalar(rhex_controller::pi / 2);
+
+        // Everything pos(t) changes, copied by snapshot() and restore() without
+        // touching the heap, to fork a rollout and rewind it (see
+        // rhex_controller_snapshot.hpp). It only makes sense with the parameters and
+        // broken legs it was taken with.
+        struct snapshot_t {
+            double last_time;
+            double dt;
+            std::array<Scalar, Legs> phase;
+            long cycles;
+            std::array<int, Legs> counter;
+            // the locomotion command and the stance angles it is bringing in
+            double speed;
+            double turn_rate;
+            double command_time;
+            double gait_time;
+            bool angle_pending;
+            std::array<Scalar, Legs> stance_angle;
+            std::array<Scalar, Legs> next_stance_angle;
+            std::array<int, Legs> stride;
+        };
+
+        BasicRhexControllerBuehler() : _speed(1), _turn_rate(0), _command_time(0), _gait_time(0), _angle_pending(false), _cycles(0)
+        {
+            _mask.weights(_live);
+        }
+
+        BasicRhexControllerBuehler(const std::vector<double>& ctrl, const std::vector<int>& broken_legs = std::vector<int>())
+            : _speed(1), _turn_rate(0), _command_time(0), _gait_time(0), _angle_pending(false), _cycles(0), _mask(broken_legs)
         {
+            _mask.weights(_live);
             set_parameters(ctrl);
         }
 
+        // broken legs get a target of 0. The leg loops are vectorized, so they are
+        // masked rather than skipped, which would cost more than computing them.
+        void set_broken(const std::vector<int>& broken_legs)
+        {
+            _mask.set_broken(broken_legs);
+            _mask.weights(_live);
+        }
+
+        std::vector<int> broken_legs() const
+        {
+            return _mask.broken_legs();
+        }
+
+        const LegMask<Legs>& leg_mask() const
+        {
+            return _mask;
+        }
+
+        // gains of command(), stance while a leg sweeps its stance angle
+        void set_gain_schedule(const gain_schedule_t& gains)
+        {
+            _gains = gains;
+        }
+
+        const gain_schedule_t& gain_schedule() const
+        {
+            return _gains;
+        }
+
         void set_parameters(const std::vector<double>& ctrl)
         {
-            assert(ctrl.size() == CTRL_SIZE);
+            assert(ctrl.size() == ctrl_size);
 
-            _ctrl.resize(CTRL_SIZE, 0);
-            for(size_t i = 0; i < CTRL_SIZE; ++i)
+            _ctrl.resize(ctrl_size, 0);
+            for(size_t i = 0; i < ctrl_size; ++i)
             {
                 _ctrl[i] = ctrl[i];
             }
 
             // take away some portion of 0.66 controlled by argument
             // giving us a cycle range between (0.33Hz - 1Hz)
-            _period = 1 - ctrl[0] * (1 - MIN_P);
-            _duty_factor.resize(DOF, 0);
-            _duty_time.resize(DOF, 0);
-            _stance_angle.resize(DOF, 0);
-            _stance_offset.resize(DOF, 0);
-
-            for (size_t i = 1; i <= DOF; ++i)
+            _cycle = 1 - ctrl[0] * (1 - 0.33);
+            _period = _cycle;
+            for (size_t i = 1; i <= Legs; ++i)
             {
                 _duty_factor[i-1] = ctrl[i];
                 _duty_time[i-1] = _duty_factor[i-1] * _period;
-                _stance_angle[i-1] = ctrl[i+6] * PI;
-                _stance_offset[i-1] = (ctrl[i+12] - 0.5) * OFFSET;
+                _genome_stance_angle[i-1] = ctrl[i+Legs] * pi;
+                _stance_offset[i-1] = (ctrl[i+2*Legs] - Scalar(0.5)) * max_offset;
             }
 
             // define phase offsets here.
             // this scheme does not bias gaits to belong to a particular style like tripod.
-            _phase_offset.resize(DOF, 0);
             _phase_offset[0] = 0;                           // this is the reference leg
-            _phase_offset[1] = ctrl[19] * _period / 2;
-            _phase_offset[2] = ctrl[20] * _period / 2;
-            _phase_offset[3] = ctrl[21] * _period / 2;
-            _phase_offset[4] = ctrl[22] * _period / 2;
-            _phase_offset[5] = ctrl[23] * _period / 2;
+            for (size_t i = 1; i < Legs; ++i)
+                _phase_offset[i] = ctrl[3*Legs+i] * _period / 2;
 
             _last_time = 0;
             _dt = 0.0;
+            _cycles = 0;
 
-            // offset according to respective phase offsets defined above, this will define the type of gait
-            _phase.resize(DOF, 0);
-            for(size_t i = 0; i < DOF; ++i)
-                _phase[i] += _phase_offset[i];
+            // the locomotion command is kept, applied from the start of the new gait
+            _command_time = 0;
+            _gait_time = 0;
+            commanded_stance_angles(_stance_angle);
+            _next_stance_angle = _stance_angle;
+            _angle_pending = false;
 
-            _counter.resize(DOF, 0);
+            // offset according to respective phase offsets defined above, this will define the type of gait
+            _phase = _phase_offset;
+            _counter.fill(0);
         }
 
         // calculate leg signal according to (Seipal and Holmes 2007)
         std::vector<double> pos(double t)
         {
+            output_t output;
+            pos(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
+
+        // same as pos(t) but writes into a caller-owned array, no heap allocation
+        void pos(double t, output_t& output)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, BUEHLER_POS);
             _dt = t - _last_time;
             _last_time = t;
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, _dt);
 
             update();
 
-            std::vector<double> output(DOF,0);
+            using std::floor;
+            for (size_t i = 0; i < Legs; ++i){
+                output[i] = leg_position(i, _phase[i], _cycles) * _live[i];
+                _counter[i] = int(floor(_phase[i] / _period)) + int(_cycles);
+            }
+        }
 
-            for (size_t i = 0; i < DOF; ++i){
-                double t = fmod(_phase[i], _period);
-                if (t <= _duty_time[i])
-                    output[i] = - _stance_angle[i] / 2 + (_stance_angle[i] / _duty_time[i]) * t;
+        // pos(t, command.angle) with the velocities and gains (see rhex_controller_command.hpp)
+        void command(double t, command_t& command)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, BUEHLER_POS);
+            _dt = t - _last_time;
+            _last_time = t;
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, _dt);
 
-                else if(t > _duty_time[i] && t <= _period)
-                    output[i] = _stance_angle[i] / 2 + ((2 * PI - _stance_angle[i]) / (_period - _duty_time[i])) * (t - _duty_time[i]);
+            update();
 
-                _counter[i] = floor(_phase[i] / _period);
-                output[i] += _counter[i] * 2 * PI;
+            using std::floor;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                leg_command(i, _phase[i], _cycles, command);
+                _counter[i] = int(floor(_phase[i] / _period)) + int(_cycles);
+            }
+        }
 
-                for (size_t j = 0; j < DOF; ++j)
-                    output[i] += _stance_offset[i];
+        // stance flags of the last tick, while each leg sweeps its stance angle (see
+        // rhex_controller_descriptor.hpp)
+        void stance(std::array<bool, Legs>& stance) const
+        {
+            using std::floor;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                Scalar t = _phase[i] - floor(_phase[i] / _period) * _period;
+                stance[i] = _mask.live(i) && t <= _duty_time[i];
             }
+        }
+
+        // closed form of command(t), as pos_at is of pos(t)
+        void command_at(double t, command_t& command) const
+        {
+            long cycles;
+            Scalar time = cycle_time(t, cycles);
+            for (size_t i = 0; i < Legs; ++i)
+                leg_command(i, _phase_offset[i] + time, cycles, command);
+        }
+
+        std::vector<double> pos_at(double t) const
+        {
+            output_t output;
+            pos_at(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
+
+        // closed form of pos(t): the targets are computed from t and the parameters only.
+        // It gives what pos(t) gives, and can be evaluated out of order or from several
+        // threads sharing one controller.
+        void pos_at(double t, output_t& output) const
+        {
+            long cycles;
+            Scalar time = cycle_time(t, cycles);
+            for (size_t i = 0; i < Legs; ++i)
+                output[i] = leg_position(i, _phase_offset[i] + time, cycles) * _live[i];
+        }
+
+        // target of leg i at the given (not wrapped) phase, after cycles whole cycles
+        // (see winds), written without fmod or branches so that the leg loops vectorize
+        Scalar leg_position(size_t i, Scalar phase, long cycles = 0) const
+        {
+            using std::floor;
+            Scalar counter = floor(phase / _period);
+            Scalar t = phase - counter * _period;
+
+            Scalar output = leg_angle(t, _period, _duty_time[i], _stance_angle[i]);
+            output += (counter + wound(cycles)) * 2 * pi;
+
+            for (size_t j = 0; j < Legs; ++j)
+                output += _stance_offset[i];
 
             return output;
         }
 
+        // leg i of command(): the target of leg_position, and the slope and gains of the
+        // part of the cycle leg_angle is in
+        void leg_command(size_t i, Scalar phase, long cycles, command_t& command) const
+        {
+            using std::floor;
+            Scalar t = phase - floor(phase / _period) * _period;
+            bool stance = t <= _duty_time[i];
+
+            Scalar stance_speed = _stance_angle[i] / _duty_time[i];
+            Scalar swing_speed = (2 * pi - _stance_angle[i]) / (_period - _duty_time[i]);
+
+            command.angle[i] = leg_position(i, phase, cycles) * _live[i];
+            command.velocity[i] = (stance ? stance_speed : swing_speed) * Scalar(_speed) * _live[i];
+            command.Kp[i] = _gains.Kp(i, stance) * _live[i];
+            command.Kd[i] = _gains.Kd(i, stance) * _live[i];
+        }
+
+        // angle of a leg at time t within its period, sweeping stance_angle slowly
+        // during the duty time and the rest of the rotation quickly afterwards
+        static Scalar leg_angle(Scalar t, Scalar period, Scalar duty_time, Scalar stance_angle)
+        {
+            Scalar stance = - stance_angle / 2 + (stance_angle / duty_time) * t;
+            Scalar swing = stance_angle / 2 + ((2 * pi - stance_angle) / (period - duty_time)) * (t - duty_time);
+
+            return (t <= duty_time) ? stance : swing;
+        }
+
+        // Locomotion command (see rhex_controller_command.hpp), from the last tick on.
+        // The gait runs on a time that advances speed times as fast as t, so the legs
+        // carry on from where they are. A new stance angle is taken by each leg at its
+        // next mid-stance, where the target does not depend on it. O(Legs), no allocation.
+        void set_command(double speed, double turn_rate)
+        {
+            assert(speed > 0);
+            _gait_time = gait_time(_last_time);
+            _command_time = _last_time;
+            _speed = speed;
+            _turn_rate = std::max(-1., std::min(turn_rate, 1.));
+
+            using std::floor;
+            commanded_stance_angles(_next_stance_angle);
+            for (size_t i = 0; i < Legs; ++i)
+                _stride[i] = int(floor((_phase[i] - _duty_time[i] / 2) / _period)) + int(_cycles);
+            _angle_pending = true;
+        }
+
+        double speed() const
+        {
+            return _speed;
+        }
+
+        double turn_rate() const
+        {
+            return _turn_rate;
+        }
+
+        // position of the last tick in the gait cycle, in [0, 1), 0 where the reference
+        // leg starts its stance
+        double gait_phase() const
+        {
+            double phase = gait_time(_last_time) / _cycle;
+            return phase - std::floor(phase);
+        }
+
+        // moves the gait to cycle position phase at the last tick (see gait_phase), the
+        // legs keeping their phase offsets and the command its speed, e.g. to carry on
+        // the phase of another gait (rhex_controller_hot_swap.hpp). Pending stance
+        // angles are taken at once.
+        void set_gait_phase(double phase)
+        {
+            _command_time = _last_time;
+            _gait_time = phase * _cycle;
+            _stance_angle = _next_stance_angle;
+            _angle_pending = false;
+            update();
+        }
+
+        // time of the gait at t: t until the first command
+        double gait_time(double t) const
+        {
+            return _gait_time + _speed * (t - _command_time);
+        }
+
+        // gait time at t within its cycle, from 0 to the period, and the whole cycles
+        // before it
+        Scalar cycle_time(double t, long& cycles) const
+        {
+            double time = gait_time(t);
+            double whole = std::floor(time / _cycle);
+            cycles = long(whole);
+            return Scalar(time - whole * _cycle);
+        }
+
+        // whole cycles of the gait at the last tick, which the targets leave out in
+        // float and fixed point: the target of a leg is 2 pi cycles() further on
+        long cycles() const
+        {
+            return _cycles;
+        }
+
+        // the phases are set from the (gait) time rather than accumulated from the time
+        // steps, whose roundings would add up to a drift in float or fixed point
         void update()
         {
-            for (size_t i = 0; i < DOF; ++i)
-                _phase[i] = _phase[i] + _dt;
+            Scalar time = cycle_time(_last_time, _cycles);
+            for (size_t i = 0; i < Legs; ++i)
+                _phase[i] = _phase_offset[i] + time;
+
+            if (_angle_pending)
+            {
+                using std::floor;
+                _angle_pending = false;
+                for (size_t i = 0; i < Legs; ++i)
+                {
+                    if (int(floor((_phase[i] - _duty_time[i] / 2) / _period)) + int(_cycles) != _stride[i])
+                        _stance_angle[i] = _next_stance_angle[i];
+                    _angle_pending = _angle_pending || _stance_angle[i] != _next_stance_angle[i];
+                }
+            }
         }
 
         const std::vector<double>& parameters() const
@@ -112,26 +377,120 @@ namespace rhex_controller {
             return _ctrl;
         }
 
+        void snapshot(snapshot_t& snapshot) const
+        {
+            snapshot.last_time = _last_time;
+            snapshot.dt = _dt;
+            snapshot.phase = _phase;
+            snapshot.cycles = _cycles;
+            snapshot.counter = _counter;
+            snapshot.speed = _speed;
+            snapshot.turn_rate = _turn_rate;
+            snapshot.command_time = _command_time;
+            snapshot.gait_time = _gait_time;
+            snapshot.angle_pending = _angle_pending;
+            snapshot.stance_angle = _stance_angle;
+            snapshot.next_stance_angle = _next_stance_angle;
+            snapshot.stride = _stride;
+        }
+
+        snapshot_t snapshot() const
+        {
+            snapshot_t s;
+            snapshot(s);
+            return s;
+        }
+
+        void restore(const snapshot_t& snapshot)
+        {
+            _last_time = snapshot.last_time;
+            _dt = snapshot.dt;
+            _phase = snapshot.phase;
+            _cycles = snapshot.cycles;
+            _counter = snapshot.counter;
+            _speed = snapshot.speed;
+            _turn_rate = snapshot.turn_rate;
+            _command_time = snapshot.command_time;
+            _gait_time = snapshot.gait_time;
+            _angle_pending = snapshot.angle_pending;
+            _stance_angle = snapshot.stance_angle;
+            _next_stance_angle = snapshot.next_stance_angle;
+            _stride = snapshot.stride;
+        }
+
+        // of the commanded gait
+        Scalar period() const
+        {
+            return _period / Scalar(_speed);
+        }
+
     protected:
-        double _f;
-        double _period;
-        double _time;
+        // cycles as a Scalar, 0 where they are left out of the targets
+        static Scalar wound(long cycles)
+        {
+            return winds ? Scalar(double(cycles)) : Scalar(0);
+        }
+
+        // stance angles of the genome, scaled by the turn rate
+        void commanded_stance_angles(std::array<Scalar, Legs>& angles) const
+        {
+            for (size_t i = 0; i < Legs; ++i)
+                angles[i] = _genome_stance_angle[i] * Scalar(1 + leg_side<Legs>(i) * _turn_rate);
+        }
+
+        // the period of the genome, and its rounding to Scalar
+        double _cycle;
+        Scalar _period;
         double _dt;
         double _last_time;
 
-        std::vector<double> _stance_angle;
-        std::vector<double> _duty_factor;
-        std::vector<double> _duty_time;
-        std::vector<double> _stance_offset;
-        std::vector<double> _phase_offset;
+        double _speed;
+        double _turn_rate;
+        // the gait time was _gait_time at _command_time
+        double _command_time;
+        double _gait_time;
+        // stance angles waiting for their leg's mid-stance, which is in the stride after _stride
+        bool _angle_pending;
+        std::array<Scalar, Legs> _next_stance_angle;
+        std::array<int, Legs> _stride;
 
-        std::vector<std::vector<double> > _phase_bias;
-        std::vector<std::vector<double> > _weights;
+        std::array<Scalar, Legs> _genome_stance_angle;
+        std::array<Scalar, Legs> _stance_angle;
+        std::array<Scalar, Legs> _duty_factor;
+        std::array<Scalar, Legs> _duty_time;
+        std::array<Scalar, Legs> _stance_offset;
+        std::array<Scalar, Legs> _phase_offset;
 
-        std::vector<int> _counter;
+        std::array<int, Legs> _counter;
         std::vector<double> _ctrl;
-        std::vector<double> _phase;
+        // offset plus cycle_time of each leg, and the whole cycles, at the last tick
+        std::array<Scalar, Legs> _phase;
+        long _cycles;
+        LegMask<Legs> _mask;
+        // 1 for live legs, 0 for broken ones
+        std::array<Scalar, Legs> _live;
+        gain_schedule_t _gains;
     };
+
+    template <size_t Legs, typename Scalar>
+    constexpr size_t BasicRhexControllerBuehler<Legs, Scalar>::legs;
+
+    template <size_t Legs, typename Scalar>
+    constexpr size_t BasicRhexControllerBuehler<Legs, Scalar>::ctrl_size;
+
+    template <size_t Legs, typename Scalar>
+    constexpr bool BasicRhexControllerBuehler<Legs, Scalar>::winds;
+
+    template <size_t Legs, typename Scalar>
+    constexpr Scalar BasicRhexControllerBuehler<Legs, Scalar>::pi;
+
+    template <size_t Legs, typename Scalar>
+    constexpr Scalar BasicRhexControllerBuehler<Legs, Scalar>::min_period;
+
+    template <size_t Legs, typename Scalar>
+    constexpr Scalar BasicRhexControllerBuehler<Legs, Scalar>::max_offset;
+
+    typedef BasicRhexControllerBuehler<> RhexControllerBuehler;
 }
 
 #endif // RHEX_CONTROLLER_BUEHLER
@@ -0,0 +1,98 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_COMMAND_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_COMMAND_HPP
+
+#include <array>
+#include <cstddef>
+
+// Output of command(t, command), which every controller has next to pos(t, output):
+// the targets of pos(t) with their time derivatives and the PD gains of each leg,
+// filled in the same pass over the legs, for a torque loop
+//
+//     tau = Kp (angle - q) + Kd (velocity - dq)
+//
+// The velocity is the analytic derivative of the target (rad/s), a feedforward that
+// lets the loop track with a lower Kp. It is that of the current part of the cycle:
+// the Buehler and Simple targets are piecewise linear, their velocity jumps at the
+// stance/swing switches. Broken legs get 0 everywhere.
+//
+// The gains follow a GainSchedule, one pair for the stance (slow) part of the
+// rotation of each leg and one for its swing (fast) part. RhexControllerSimple takes
+// its schedule from its genome, the other controllers from set_gain_schedule().
+//
+// RhexControllerBuehler and RhexControllerHopf also take a locomotion command,
+// set_command(speed, turn_rate), at any tick and without restarting the gait:
+// speed multiplies the gait frequency of the genome (1 by default) and turn_rate, in
+// [-1, 1], multiplies the stance angles of the legs of side s (leg_side) by
+// 1 + s turn_rate, longer strides on one side and shorter on the other.
+
+namespace rhex_controller {
+
+    // Side of leg i for set_command: 1 for the first half of the legs, -1 for the
+    // other half (legs 0 to 2 and 3 to 5 of the hexapod, paired 0-3, 1-4 and 2-5 as in
+    // HexapodCoupling). A positive turn_rate lengthens the strides of side 1, the
+    // robot turns towards side -1.
+    template <size_t Legs>
+    constexpr int leg_side(size_t i)
+    {
+        return (i < Legs / 2) ? 1 : -1;
+    }
+
+    // one array per field, so that the loops filling and reading them vectorize
+    template <size_t Legs, typename Scalar = double>
+    struct ControlCommand {
+        typedef std::array<Scalar, Legs> values_t;
+
+        values_t angle;
+        values_t velocity;
+        values_t Kp;
+        values_t Kd;
+    };
+
+    template <size_t Legs, typename Scalar = double>
+    struct GainSchedule {
+        typedef std::array<Scalar, Legs> values_t;
+
+        // the gains RhexControllerSimple::set_pd defaults to, for every leg and part
+        GainSchedule(double Kp = 5., double Kd = 0.1)
+        {
+            set(Kp, Kd);
+        }
+
+        GainSchedule(double stance_Kp, double stance_Kd, double swing_Kp, double swing_Kd)
+        {
+            set(stance_Kp, stance_Kd, swing_Kp, swing_Kd);
+        }
+
+        void set(double Kp, double Kd)
+        {
+            set(Kp, Kd, Kp, Kd);
+        }
+
+        void set(double stance_Kp, double stance_Kd, double swing_Kp, double swing_Kd)
+        {
+            this->stance_Kp.fill(Scalar(stance_Kp));
+            this->stance_Kd.fill(Scalar(stance_Kd));
+            this->swing_Kp.fill(Scalar(swing_Kp));
+            this->swing_Kd.fill(Scalar(swing_Kd));
+        }
+
+        // gains of leg i in stance or swing, written as selects so that the leg loops
+        // of the controllers vectorize
+        Scalar Kp(size_t i, bool stance) const
+        {
+            return stance ? stance_Kp[i] : swing_Kp[i];
+        }
+
+        Scalar Kd(size_t i, bool stance) const
+        {
+            return stance ? stance_Kd[i] : swing_Kd[i];
+        }
+
+        values_t stance_Kp;
+        values_t stance_Kd;
+        values_t swing_Kp;
+        values_t swing_Kd;
+    };
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_COMMON_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_COMMON_HPP
+
+#include <array>
+#include <cstddef>
+
+// Constants and helpers shared by all the controllers. The constants used to be
+// #defines in every header, with conflicting values, so no two controllers could be
+// included in the same translation unit.
+
+namespace rhex_controller {
+
+    // the controllers were tuned with this truncated value, kept so that gaits do not change
+    constexpr double pi = 3.14159265;
+
+    // number of legs of the robot models in rhex_models (RHex, RHex8)
+    constexpr size_t default_legs = 6;
+
+    // Leg gains of a controller. Those with get_Kp() and get_Kd() (RhexControllerSimple)
+    // keep gains for every degree of freedom of the robot, the legs from index 6:
+    // leg_gains copies them into Kp and Kd and returns true. It returns false for the
+    // others, whose gains come from elsewhere (set_gain_schedule), and leaves Kp and Kd.
+    template <typename Controller, size_t Legs>
+    auto leg_gains(const Controller& controller, std::array<double, Legs>& Kp, std::array<double, Legs>& Kd, int)
+        -> decltype(controller.get_Kp(), controller.get_Kd(), bool())
+    {
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            Kp[i] = double(controller.get_Kp()[6 + i]);
+            Kd[i] = double(controller.get_Kd()[6 + i]);
+        }
+        return true;
+    }
+
+    template <typename Controller, size_t Legs>
+    bool leg_gains(const Controller&, std::array<double, Legs>&, std::array<double, Legs>&, long)
+    {
+        return false;
+    }
+
+    template <typename Controller, size_t Legs>
+    bool leg_gains(const Controller& controller, std::array<double, Legs>& Kp, std::array<double, Legs>& Kd)
+    {
+        return leg_gains(controller, Kp, Kd, 0);
+    }
+} // namespace rhex_controller
+
+#endif
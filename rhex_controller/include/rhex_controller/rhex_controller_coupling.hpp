@@ -0,0 +1,187 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_COUPLING_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_COUPLING_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+
+// Coupling topologies of the oscillator based controllers (Hopf, CPG).
+// A topology fills the phase bias matrix, bias[i][j] being the phase oscillator i
+// keeps with oscillator j, and no_coupling where j does not pull on i. It may read
+// its own parameters from the controller's genome, parameters of them starting at
+// ctrl[first]:
+//
+//     static constexpr size_t parameters = ...;
+//     template <size_t Legs, typename Scalar>
+//     static void phase_bias(const std::vector<double>& ctrl, size_t first,
+//                            std::array<std::array<Scalar, Legs>, Legs>& bias);
+
+namespace rhex_controller {
+
+    // phase bias of the edges that are not coupled
+    constexpr double no_coupling = 1000;
+
+    // Every leg coupled to every other one with a fixed alternating tripod:
+    // in phase with the legs of its own parity, in antiphase with the others.
+    // [[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0],[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0],[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0]]
+    struct TripodCoupling {
+        static constexpr size_t parameters = 0;
+
+        template <size_t Legs, typename Scalar>
+        static void phase_bias(const std::vector<double>&, size_t, std::array<std::array<Scalar, Legs>, Legs>& bias)
+        {
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                for (size_t j = 0; j < Legs; ++j)
+                {
+                    if (i % 2 == 0)
+                        bias[i][j] = (j % 2 == 0) ? 0 : pi;
+                    else
+                        bias[i][j] = (j % 2 == 0) ? -pi : 0;
+                }
+            }
+        }
+    };
+
+    // Sparse network of the 6 legged robot with 5 evolved phases (14, 12, 13, 45, 46):
+    // legs 0 and 3 are coupled both ways, leg 0 drives legs 1 and 2, leg 3 drives
+    // legs 4 and 5, and the pairs 1-4 and 2-5 are coupled both ways with the phases
+    // implied by the others.
+    struct HexapodCoupling {
+        static constexpr size_t parameters = 5;
+
+        template <size_t Legs, typename Scalar>
+        static void phase_bias(const std::vector<double>& ctrl, size_t first, std::array<std::array<Scalar, Legs>, Legs>& bias)
+        {
+            static_assert(Legs == 6, "HexapodCoupling is defined for 6 legs");
+            assert(ctrl.size() >= first + parameters);
+
+            double phase14 = ctrl[first] * pi;
+            double phase12 = ctrl[first + 1] * pi;
+            double phase13 = ctrl[first + 2] * pi;
+            double phase45 = ctrl[first + 3] * pi;
+            double phase46 = ctrl[first + 4] * pi;
+
+            double phase52 = phase45 - phase14 - phase12;
+            double phase63 = phase46 - phase14 - phase13;
+
+            const double ignore = no_coupling;
+            bias = std::array<std::array<Scalar, Legs>, Legs> {{
+                {{Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(-phase14), Scalar(ignore), Scalar(ignore)}},
+                {{Scalar(-phase12), Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(phase52), Scalar(ignore)}},
+                {{Scalar(-phase13), Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(phase63)}},
+                {{Scalar(phase14), Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(ignore), Scalar(ignore)}},
+                {{Scalar(ignore), Scalar(-phase52), Scalar(ignore), Scalar(phase45), Scalar(ignore), Scalar(ignore)}},
+                {{Scalar(ignore), Scalar(ignore), Scalar(-phase63), Scalar(phase46), Scalar(ignore), Scalar(ignore)}}
+            }};
+        }
+    };
+
+    // Phases of the legs implied by a coupling network (weights 0 where j does not
+    // pull on i), bias[i][j] = phase_j - phase_i along each edge: the first leg of
+    // each connected group is at 0 and the others are placed along a spanning tree.
+    // Exact when the biases around every loop add up to whole turns.
+    template <size_t Legs, typename Scalar>
+    void implied_phases(const std::array<std::array<Scalar, Legs>, Legs>& bias,
+        const std::array<std::array<Scalar, Legs>, Legs>& weights, std::array<double, Legs>& phase)
+    {
+        std::array<bool, Legs> placed;
+        placed.fill(false);
+        phase.fill(0);
+        for (size_t root = 0; root < Legs; ++root)
+        {
+            if (placed[root])
+                continue;
+            placed[root] = true;
+
+            std::array<size_t, Legs> queue;
+            size_t head = 0, tail = 0;
+            queue[tail++] = root;
+            while (head < tail)
+            {
+                size_t i = queue[head++];
+                for (size_t j = 0; j < Legs; ++j)
+                {
+                    if (placed[j] || i == j)
+                        continue;
+                    if (weights[i][j] != 0)
+                        phase[j] = phase[i] + bias[i][j];
+                    else if (weights[j][i] != 0)
+                        phase[j] = phase[i] - bias[j][i];
+                    else
+                        continue;
+                    placed[j] = true;
+                    queue[tail++] = j;
+                }
+            }
+        }
+    }
+
+    // Phase-locked state of the network dphase_i/dt = omega + sum_j weights[i][j]
+    // sin(phase_j - phase_i - bias[i][j]), the first coupled leg at 0. The implied phases are relaxed
+    // along the relative phase dynamics, which moves them only where the biases of a
+    // loop do not add up to whole turns (HexapodCoupling with most genomes) and the
+    // locked gait is a compromise between the edges.
+    template <size_t Legs, typename Scalar>
+    void locked_phases(const std::array<std::array<Scalar, Legs>, Legs>& bias,
+        const std::array<std::array<Scalar, Legs>, Legs>& weights, std::array<double, Legs>& phase,
+        size_t iterations = 2000)
+    {
+        implied_phases(bias, weights, phase);
+
+        // explicit steps of the relative phases, stable below 1 / (largest incoming weight)
+        double incoming = 0;
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            double sum = 0;
+            for (size_t j = 0; j < Legs; ++j)
+                sum += std::abs(double(weights[i][j]));
+            incoming = std::max(incoming, sum);
+        }
+        if (incoming == 0)
+            return;
+        double h = 0.5 / incoming;
+
+        // legs without edges (broken ones) stay where they are, the first coupled leg is the reference
+        std::array<bool, Legs> coupled;
+        size_t reference = Legs;
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            coupled[i] = false;
+            for (size_t j = 0; j < Legs; ++j)
+                coupled[i] = coupled[i] || weights[i][j] != 0 || weights[j][i] != 0;
+            if (coupled[i] && reference == Legs)
+                reference = i;
+        }
+
+        std::array<double, Legs> pull;
+        for (size_t k = 0; k < iterations; ++k)
+        {
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                pull[i] = 0;
+                for (size_t j = 0; j < Legs; ++j)
+                    if (weights[i][j] != 0)
+                        pull[i] += weights[i][j] * std::sin(phase[j] - phase[i] - bias[i][j]);
+            }
+
+            double change = 0;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                if (!coupled[i])
+                    continue;
+                double step = h * (pull[i] - pull[reference]);
+                phase[i] += step;
+                change = std::max(change, std::abs(step));
+            }
+            if (change < 1e-12)
+                break;
+        }
+    }
+} // namespace rhex_controller
+
+#endif
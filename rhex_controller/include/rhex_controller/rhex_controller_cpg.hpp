@@ -5,165 +5,271 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <iostream>
 #include <vector>
-#define PI 3.14159265
-#define CTRL_SIZE 6
+
+#include <rhex_controller/rhex_controller_command.hpp>
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_coupling.hpp>
+#include <rhex_controller/rhex_controller_integrator.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+#include <rhex_controller/rhex_controller_math.hpp>
+#include <rhex_controller/rhex_controller_network.hpp>
+#include <rhex_controller/rhex_controller_trace.hpp>
 
 // this file is a work in progress
 
 namespace rhex_controller {
 
-    class RhexControllerCPG {
+    // One phase oscillator per leg, an OscillatorNetwork of KuramotoOscillator (see
+    // rhex_controller_network.hpp). Legs is the number of legs, Scalar the type the
+    // network is integrated in and Coupling the topology of the network (see
+    // rhex_controller_coupling.hpp). The genome holds one value per leg (not used
+    // yet), then the parameters of the coupling topology. Math gives the sin of the
+    // coupling (see rhex_controller_math.hpp).
+    template <size_t Legs = default_legs, typename Scalar = double, typename Coupling = TripodCoupling, typename Math = StdMath>
+    class BasicRhexControllerCPG {
     public:
+        typedef Scalar scalar_t;
+        typedef Coupling coupling_topology_t;
+        typedef Math math_t;
+        typedef std::array<Scalar, Legs> output_t;
+        typedef ControlCommand<Legs, Scalar> command_t;
+        typedef GainSchedule<Legs, Scalar> gain_schedule_t;
+        // oscillator phases
+        typedef std::array<Scalar, Legs> state_t;
+        typedef OscillatorNetwork<KuramotoOscillator, Legs, Scalar, Math> network_t;
+
+        // Everything pos(t) changes, copied by snapshot() and restore() without
+        // touching the heap, to fork a rollout and rewind it (see
+        // rhex_controller_snapshot.hpp). It only makes sense with the parameters,
+        // integrator and broken legs it was taken with.
+        struct snapshot_t {
+            double last_time;
+            double dt;
+            double h;
+            size_t evaluations;
+            state_t phase;
+        };
+
+        static constexpr size_t legs = Legs;
+        static constexpr size_t ctrl_size = Legs + Coupling::parameters;
+
+        static constexpr Scalar pi = Scalar(rhex_controller::pi);
+
+        BasicRhexControllerCPG()
+            : _integrator(Integrator::SEMI_IMPLICIT), _tolerance(1e-6), _h(0), _evaluations(0) {}
+
+        // the default semi-implicit sweep is the update this controller always used,
+        // tolerance is only used by the adaptive Integrator::RK45
+        BasicRhexControllerCPG(const std::vector<double>& ctrl, Integrator integrator = Integrator::SEMI_IMPLICIT, double tolerance = 1e-6)
+            : _integrator(integrator), _tolerance(tolerance), _h(0), _evaluations(0)
+        {
+            set_parameters(ctrl);
+        }
 
-        RhexControllerCPG() {}
+        void set_integrator(Integrator integrator, double tolerance = 1e-6)
+        {
+            _integrator = integrator;
+            _tolerance = tolerance;
+            _h = 0;
+        }
 
-        RhexControllerCPG(const std::vector<double>& ctrl)
+        Integrator integrator() const
         {
-            set_parameters(ctrl);
+            return _integrator;
+        }
+
+        // number of full derivative evaluations since set_parameters
+        size_t derivative_evaluations() const
+        {
+            return _evaluations;
+        }
+
+        // Broken legs: their phases are frozen at 0, left out of the network, whose
+        // coupling is re-derived for the live legs (see live_coupling), and their targets
+        // are 0.
+        void set_broken(const std::vector<int>& broken_legs)
+        {
+            _mask.set_broken(broken_legs);
+            for (size_t i = 0; i < Legs; ++i)
+                if (!_mask.live(i))
+                    _phase[i] = 0;
+            build_coupling();
+        }
+
+        std::vector<int> broken_legs() const
+        {
+            return _mask.broken_legs();
+        }
+
+        const LegMask<Legs>& leg_mask() const
+        {
+            return _mask;
+        }
+
+        // gains of command(). The legs turn at the oscillator speed all along their
+        // cycle, stance is the first duty ratio of each turn.
+        void set_gain_schedule(const gain_schedule_t& gains)
+        {
+            _gains = gains;
+        }
+
+        const gain_schedule_t& gain_schedule() const
+        {
+            return _gains;
         }
 
         void set_parameters(const std::vector<double>& ctrl)
         {
-            assert(ctrl.size() == CTRL_SIZE);
+            assert(ctrl.size() == ctrl_size);
 
             _freq = 0.2;
             _duty_ratio = 0.5;
-            _thetlg = -PI / 3;
-            _thettg = -2 * PI / 3;
-            _amp = PI;
+            _thetlg = -pi / 3;
+            _thettg = -2 * pi / 3;
+            _amp = pi;
             _last_time = 0;
             _dt = 0.0;
-
-            _phase = ctrl;
+            _h = 0;
+            _evaluations = 0;
 
             // set up phase vector to start at correct position.
             // the start position is between the start & end of stance period
             _start_phase = _thettg - _thetlg;
 
-            _phase = std::vector<double>(6,0); // reset in case of carry over.
-//            for(int i = 0; i < CTRL_SIZE; ++i)
+            _phase.fill(0); // reset in case of carry over.
+//            for(int i = 0; i < Legs; ++i)
 //                _phase[i] = _start_phase;
 
-            // set up weights between each of the legs, 1 for each except itself.
+            // set up phase bias, no_coupling where the topology has no edge
+            Coupling::template phase_bias<Legs, Scalar>(ctrl, Legs, _topology_bias);
+            build_coupling();
+
+            calc_vars();
+        }
+
+        // phase biases and weights of the live legs
+        void build_coupling()
+        {
+            _phase_bias = _topology_bias;
+
+            // set up weights between each of the coupled legs, 1 for each except itself.
             // [[0,1,1,1,1,1],[1,0,1,1,1,1],[1,1,0,1,1,1],[1,1,1,0,1,1],[1,1,1,1,0,1],[1,1,1,1,1,0]]
-            _weights.resize(6, std::vector<double>(6, 0));
-            for(size_t i = 0; i < CTRL_SIZE; ++i)
+            for(size_t i = 0; i < Legs; ++i)
             {
-                for(size_t j = 0; j < CTRL_SIZE; ++j)
+                for(size_t j = 0; j < Legs; ++j)
                 {
-                    if (i != j)
-                    {
-                        _weights[i][j] = 10;
-                    }
+                    _weights[i][j] = (i != j && _phase_bias[i][j] != Scalar(no_coupling)) ? 10 : 0;
                 }
             }
 
-            // set up phase bias.
-            // [[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0],[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0],[0,pi,0,pi,0,pi],[-pi,0,-pi,0,-pi,0]]
-            _phase_bias.resize(6, std::vector<double>(6,0));
-            for(size_t i = 0; i < CTRL_SIZE; ++i)
-            {
-                for(size_t j = 0; j < CTRL_SIZE; ++j)
-                {
-                    if (i == 0 || i % 2 == 0)
-                    {
-                        if (j == 0 || j % 2 == 0)
-                            _phase_bias[i][j] = 0;
-                        else
-                            _phase_bias[i][j] = PI;
-                    }
-                    else
-                    {
-                        if (j == 0 || j % 2 == 0)
-                            _phase_bias[i][j] = -PI;
-                        else
-                            _phase_bias[i][j] = 0;
-                    }
-                }
-            }
+            live_coupling(_mask, _phase_bias, _weights);
 
-            calc_vars();
+            // the broken legs get no edges and a zero frequency: their phases stay put
+            typename network_t::parameters_t& p = _network.parameters();
+            for (size_t i = 0; i < Legs; ++i)
+                p.omega[i] = _mask.live(i) ? 2 * pi * _freq : 0;
+            _network.set_coupling(_phase_bias, _weights, _amp);
         }
 
         // intermediate variables calculated based on start and end of stance phase
         void calc_vars()
         {
-            _Sf = (2 * PI - (_thetlg - _thettg)) / ((1 - _duty_ratio) * 2 * PI);
-            _Ss = transform((_thetlg - _thettg) / (_duty_ratio * 2 * PI));
-            _thettg_in = transform(_thettg - _duty_ratio * 2 * PI) + 2 * PI; // this value needs to be in the interval [-pi, pi], thus add 2pi
+            _Sf = (2 * pi - (_thetlg - _thettg)) / ((1 - _duty_ratio) * 2 * pi);
+            _Ss = transform((_thetlg - _thettg) / (_duty_ratio * 2 * pi));
+            _thettg_in = transform(_thettg - _duty_ratio * 2 * pi) + 2 * pi; // this value needs to be in the interval [-pi, pi], thus add 2pi
 
         }
 
         // transforms values in the range -pi to pi.
-        double transform(double x)
+        Scalar transform(Scalar x)
         {
-//            if (x > PI)
+//            if (x > pi)
 //            {
 //                double t = 0;
 
-//                if (fmod(floor(x / PI), 2) == 1)
-//                    t = fmod(x, (2 * PI)) - 2 * PI;
+//                if (fmod(floor(x / pi), 2) == 1)
+//                    t = fmod(x, (2 * pi)) - 2 * pi;
 //                else
-//                    t = fmod(x, (2 * PI));
+//                    t = fmod(x, (2 * pi));
 
 //                if (std::isnan(t)) {
 //                    std::cout << "ERROR: transform(double x): ";
 //                    std::cout << " x: " << x;
-//                    std::cout << " x/2PI : " << (x / (2*PI));
-//                    std::cout << " fmod1: " << fmod(x , (2 * PI));
+//                    std::cout << " x/2pi : " << (x / (2*pi));
+//                    std::cout << " fmod1: " << fmod(x , (2 * pi));
 //                }
 
 //                return t;
 //            }
 
-//            else if (x < -PI)
+//            else if (x < -pi)
 //            {
 
 //            }
-            double y = x;
-            if ( x < -PI ){
-                double z = floor((x+PI) / (2 * PI));
-                y = x + (-z*2*PI);
+            Scalar y = x;
+            if ( x < -pi ){
+                Scalar z = std::floor((x+pi) / (2 * pi));
+                y = x + (-z*2*pi);
             }
 
-            else if (x > PI){
-                double z = ceil((x-PI) / (2 * PI));
-                y = x - (z*2*PI);
+            else if (x > pi){
+                Scalar z = std::ceil((x-pi) / (2 * pi));
+                y = x - (z*2*pi);
             }
 
             return y;
         }
 
-        double dp(size_t idx){
-            double phasediff = 2 * PI * _freq;
+        Scalar dp(size_t idx){
+            return dp(_phase, idx);
+        }
 
-            for (size_t i = 0; i < _phase.size(); ++i)
-            {
-                if (i != idx)
-                    phasediff += _amp * _weights[idx][i] * sin(_phase[i] - _phase[idx] - _phase_bias[idx][i]);
-            }
-            return phasediff;
+        // 2 pi freq plus the pull of the edges on leg idx, amp * w * sin(phase_j - phase_idx - bias)
+        Scalar dp(const output_t& phase, size_t idx) const
+        {
+            return _network.rate(phase, idx);
         }
 
-        void update_values()
+        void derivative(const output_t& phase, output_t& dphase) const
         {
-            for ( size_t i = 0; i < _phase.size(); ++i){
-                //std::cout<<_phase[i]<<std::endl;
-            }
+            _network.derivative(phase, dphase);
+        }
 
-            for (size_t i = 0; i < _phase.size(); ++i){
-                //std::cout<<_phase.size()<<std::endl;
-                _phase[i] = _phase[i] + dp(i) * _dt;
-             }
+        // Gauss-Seidel sweep: each leg is advanced with the phases of the legs
+        // already advanced in this step
+        size_t semi_implicit_step(output_t& phase, double dt) const
+        {
+            for (size_t i = 0; i < phase.size(); ++i)
+                phase[i] = phase[i] + dp(phase, i) * dt;
 
+            return 1;
+        }
+
+        void update_values()
+        {
+            switch (_integrator)
+            {
+            case Integrator::EULER:
+                _evaluations += euler_step(*this, _phase, _dt);
+                break;
+            case Integrator::RK4:
+                _evaluations += rk4_step(*this, _phase, _dt);
+                break;
+            case Integrator::RK45:
+                _evaluations += rk45_step(*this, _phase, _dt, _h, _tolerance);
+                break;
+            default:
+                _evaluations += semi_implicit_step(_phase, _dt);
+            }
         }
 
         // transform a value into its respective swing or stance value.
-        double mono_transform(double x)
+        Scalar mono_transform(Scalar x)
         {
             // std::cout<< "mono transform received: " << x << std::endl;
-            double y = 0;
+            Scalar y = 0;
             if (transform(x) <= _thettg)
                 y = _thettg + (transform(x) - _thettg) * _Sf;
             else if (transform(x) <= _thettg_in)
@@ -183,53 +289,212 @@ namespace rhex_controller {
             }
 
             // std::cout << "Returning: " << transform(y) << std::endl;
-            return transform(y); //+ (PI/2);
+            return transform(y); //+ (pi/2);
         }
 
         // make const?
 
-        const std::vector<double>& get_phase() const
+        const output_t& get_phase() const
+        {
+            return _phase;
+        }
+
+        const output_t& parameters() const
         {
             return _phase;
         }
 
-        const std::vector<double>& parameters() const
+        const state_t& state() const
         {
             return _phase;
         }
 
+        // the oscillators of the live legs and their coupling graph
+        const network_t& network() const
+        {
+            return _network;
+        }
+
+        // Phases the coupling network locks into (locked_phases), leg 0 at 0 as
+        // set_parameters starts it. Close to the converged gait, whose phases the
+        // discrete sweep shifts by a few milliradians; WarmStartCache
+        // (rhex_controller_warm_start.hpp) gives the converged one.
+        state_t locked_state() const
+        {
+            std::array<double, Legs> phase;
+            locked_phases(_phase_bias, _weights, phase);
+
+            state_t state;
+            for (size_t i = 0; i < Legs; ++i)
+                state[i] = _mask.live(i) ? Scalar(phase[i]) : 0;
+            return state;
+        }
+
+        // Replaces the phases, e.g. by locked_state() or a converged state. As they
+        // are the targets, the whole turns of the first live leg are removed from all
+        // of them, so the legs start within half a turn of 0.
+        void set_state(const state_t& state)
+        {
+            size_t reference = _mask.live_count() ? _mask.leg(0) : 0;
+            Scalar turns = std::round(state[reference] / (2 * pi)) * 2 * pi;
+            for (size_t i = 0; i < Legs; ++i)
+                _phase[i] = _mask.live(i) ? state[i] - turns : 0;
+        }
+
+        // starts the oscillators on their limit cycle, after set_parameters
+        void warm_start()
+        {
+            set_state(locked_state());
+        }
+
+        // position of the last tick in the gait cycle, in [0, 1): the phase of the
+        // reference leg (the first live one) over 2 pi
+        double gait_phase() const
+        {
+            if (_mask.live_count() == 0)
+                return 0;
+            double phase = double(_phase[_mask.leg(0)]) / (2 * pi);
+            return phase - std::floor(phase);
+        }
+
+        // shifts all the phases by the angle that brings the reference leg to cycle
+        // position phase (see gait_phase), keeping the relative phases (those of
+        // warm_start() or of a WarmStartCache state, say), e.g. to carry on the phase of
+        // another gait (rhex_controller_hot_swap.hpp)
+        void set_gait_phase(double phase)
+        {
+            Scalar turn = Scalar(2 * pi * (phase - gait_phase()));
+            state_t state = _phase;
+            for (size_t i = 0; i < Legs; ++i)
+                state[i] += turn;
+            set_state(state);
+        }
+
+        void snapshot(snapshot_t& snapshot) const
+        {
+            snapshot.last_time = _last_time;
+            snapshot.dt = _dt;
+            snapshot.h = _h;
+            snapshot.evaluations = _evaluations;
+            snapshot.phase = _phase;
+        }
+
+        snapshot_t snapshot() const
+        {
+            snapshot_t s;
+            snapshot(s);
+            return s;
+        }
+
+        void restore(const snapshot_t& snapshot)
+        {
+            _last_time = snapshot.last_time;
+            _dt = snapshot.dt;
+            _h = snapshot.h;
+            _evaluations = snapshot.evaluations;
+            _phase = snapshot.phase;
+        }
+
+        // period of the uncoupled oscillators, which the locked gait keeps
+        Scalar period() const
+        {
+            return 1 / _freq;
+        }
+
         // use cpg to return values
         std::vector<double> pos(double t)
         {
+            output_t output;
+            pos(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
+
+        // same as pos(t) but writes into a caller-owned array, no heap allocation
+        void pos(double t, output_t& output)
+        {
 //            for ( size_t i = 0; i < _phase.size(); ++i){
 //                std::cout<<_phase[i]<<std::endl;
 //            }
-            assert(_phase.size() == CTRL_SIZE);
+            assert(_phase.size() == Legs);
 
             // t treated as current time.
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, CPG_POS);
             _dt = t - _last_time;
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, _dt);
             //std::cout << "CPG delta time: " << _dt << std::endl;
             update_values();
             _last_time = t;
-            return get_phase();
+            output = _phase;
+            for (size_t i = 0; i < Legs; ++i)
+                if (!_mask.live(i))
+                    output[i] = 0;
+        }
+
+        // pos(t, command.angle) with the velocities and gains (see rhex_controller_command.hpp).
+        // The velocity is the rate of the phases over the integration step, which the
+        // targets follow: the Gauss-Seidel sweep moves the locked legs at a common speed
+        // that dp, evaluated at the new phases, misses by up to a few tens of percent. It
+        // is dp when t did not advance.
+        void command(double t, command_t& command)
+        {
+            state_t previous = _phase;
+            pos(t, command.angle);
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                Scalar turn = _phase[i] - std::floor(_phase[i] / (2 * pi)) * 2 * pi;
+                bool stance = turn < _duty_ratio * 2 * pi;
+                Scalar live = _mask.live(i) ? 1 : 0;
+
+                command.velocity[i] = (_dt > 0) ? (_phase[i] - previous[i]) / Scalar(_dt) * live : dp(_phase, i);
+                command.Kp[i] = _gains.Kp(i, stance) * live;
+                command.Kd[i] = _gains.Kd(i, stance) * live;
+            }
+        }
+
+        // stance flags of the last tick, the first duty ratio of each turn as in
+        // command() (see rhex_controller_descriptor.hpp)
+        void stance(std::array<bool, Legs>& stance) const
+        {
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                Scalar turn = _phase[i] - std::floor(_phase[i] / (2 * pi)) * 2 * pi;
+                stance[i] = _mask.live(i) && turn < _duty_ratio * 2 * pi;
+            }
         }
 
     protected:
-        double _thetlg;
-        double _thettg;
-        double _thettg_in;
-        double _Sf;
-        double _Ss;
-        double _amp;
-        double _freq;
+        Scalar _thetlg;
+        Scalar _thettg;
+        Scalar _thettg_in;
+        Scalar _Sf;
+        Scalar _Ss;
+        Scalar _amp;
+        Scalar _freq;
         double _last_time;
         double _dt;
-        double _duty_ratio;
-        double _start_phase;
-        std::vector<std::vector<double> > _phase_bias;
-        std::vector<std::vector<double> > _weights;
-        std::vector<double> _phase;
+        Scalar _duty_ratio;
+        Scalar _start_phase;
+        Integrator _integrator;
+        double _tolerance;
+        double _h;
+        size_t _evaluations;
+        std::array<std::array<Scalar, Legs>, Legs> _topology_bias;
+        std::array<std::array<Scalar, Legs>, Legs> _phase_bias;
+        std::array<std::array<Scalar, Legs>, Legs> _weights;
+        output_t _phase;
+        network_t _network;
+        LegMask<Legs> _mask;
+        gain_schedule_t _gains;
     };
+
+    template <size_t Legs, typename Scalar, typename Coupling, typename Math>
+    constexpr size_t BasicRhexControllerCPG<Legs, Scalar, Coupling, Math>::legs;
+
+    template <size_t Legs, typename Scalar, typename Coupling, typename Math>
+    constexpr size_t BasicRhexControllerCPG<Legs, Scalar, Coupling, Math>::ctrl_size;
+
+    typedef BasicRhexControllerCPG<> RhexControllerCPG;
 } // namespace rhex_controller
 
 #endif // RHEX_CONTROLLER_CPG
@@ -0,0 +1,147 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_DART_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_DART_HPP
+
+#include <array>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dart/dart.hpp>
+#include <dart/utils/utils.hpp>
+
+// DART Simulation adapter for RolloutEngine (rhex_controller_rollout.hpp), only
+// usable in projects that build against DART 6.
+// It loads one of the rhex_models SKEL files on a flat floor and drives each leg
+// (joint body_joint_<leg>) with a PD loop towards the controller targets.
+// Parsed skeletons are cached per file for the whole process: building a
+// DartSimulation, and clone() for each worker, only copy the cached skeleton.
+
+namespace rhex_controller {
+
+    class DartSimulation {
+    public:
+        DartSimulation(const std::string& skel_file, size_t legs = 6, double time_step = 0.001, double Kp = 5., double Kd = 0.1)
+            : _Kp(Kp), _Kd(Kd), _tracking_error(0)
+        {
+            _world = std::make_shared<dart::simulation::World>();
+            _world->setTimeStep(time_step);
+            _world->addSkeleton(load_skeleton(skel_file)->clone());
+            _world->addSkeleton(floor());
+
+            _robot = _world->getSkeleton(0);
+            _initial_positions = _robot->getPositions();
+
+            for (size_t i = 0; i < legs; ++i)
+            {
+                dart::dynamics::Joint* joint = _robot->getJoint("body_joint_" + std::to_string(i));
+                if (!joint)
+                    throw std::runtime_error("DartSimulation: no body_joint_" + std::to_string(i) + " in " + skel_file);
+                _dofs.push_back(joint->getIndexInSkeleton(0));
+            }
+        }
+
+        DartSimulation clone() const
+        {
+            DartSimulation copy(*this);
+            copy._world = _world->clone();
+            copy._robot = copy._world->getSkeleton(0);
+            return copy;
+        }
+
+        void reset()
+        {
+            _world->reset();
+            _robot->setPositions(_initial_positions);
+            _robot->setVelocities(Eigen::VectorXd::Zero(_robot->getNumDofs()));
+            _robot->resetCommands();
+            _tracking_error = 0;
+        }
+
+        double time_step() const
+        {
+            return _world->getTimeStep();
+        }
+
+        void step(const double* targets, const double* Kp)
+        {
+            double error = 0;
+            for (size_t i = 0; i < _dofs.size(); ++i)
+            {
+                size_t dof = _dofs[i];
+                double angle_error = targets[i] - _robot->getPosition(dof);
+                double gain = Kp ? Kp[i] : _Kp;
+
+                _robot->setCommand(dof, gain * angle_error - _Kd * _robot->getVelocity(dof));
+                error += std::fabs(angle_error);
+            }
+            _tracking_error = error / _dofs.size();
+
+            _world->step();
+        }
+
+        std::array<double, 3> body_position() const
+        {
+            Eigen::Vector3d p = _robot->getRootBodyNode()->getWorldTransform().translation();
+            return std::array<double, 3> {{p(0), p(1), p(2)}};
+        }
+
+        double tracking_error() const
+        {
+            return _tracking_error;
+        }
+
+        dart::simulation::WorldPtr world() const
+        {
+            return _world;
+        }
+
+        // the parsed skeleton of a SKEL file, read once per process
+        static dart::dynamics::SkeletonPtr load_skeleton(const std::string& skel_file)
+        {
+            static std::mutex mutex;
+            static std::map<std::string, dart::dynamics::SkeletonPtr> cache;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = cache.find(skel_file);
+            if (found != cache.end())
+                return found->second;
+
+            dart::dynamics::SkeletonPtr skeleton = dart::utils::SkelParser::readSkeleton(skel_file);
+            if (!skeleton)
+                throw std::runtime_error("DartSimulation: cannot load " + skel_file);
+
+            cache[skel_file] = skeleton;
+            return skeleton;
+        }
+
+    protected:
+        static dart::dynamics::SkeletonPtr floor()
+        {
+            dart::dynamics::SkeletonPtr floor = dart::dynamics::Skeleton::create("floor");
+            dart::dynamics::BodyNode* body = floor->createJointAndBodyNodePair<dart::dynamics::WeldJoint>(nullptr).second;
+
+            auto box = std::make_shared<dart::dynamics::BoxShape>(Eigen::Vector3d(20, 20, 0.1));
+            body->createShapeNodeWith<dart::dynamics::VisualAspect, dart::dynamics::CollisionAspect, dart::dynamics::DynamicsAspect>(box);
+
+            Eigen::Isometry3d tf(Eigen::Isometry3d::Identity());
+            tf.translation() = Eigen::Vector3d(0, 0, -0.05);
+            body->getParentJoint()->setTransformFromParentBodyNode(tf);
+
+            return floor;
+        }
+
+        dart::simulation::WorldPtr _world;
+        dart::dynamics::SkeletonPtr _robot;
+        Eigen::VectorXd _initial_positions;
+        std::vector<size_t> _dofs;
+        double _Kp;
+        double _Kd;
+        double _tracking_error;
+    };
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_DESCRIPTOR_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_DESCRIPTOR_HPP
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+
+// Gait descriptors of a rollout, accumulated tick by tick: the stance flags of the
+// legs are read after each pos(t) (stance(), which every controller has: Buehler's
+// duty time, Simple's slow part of the rotation, Hopf's swing flags, the first duty
+// ratio of each CPG turn) and folded into a few sums per leg, so nothing grows with
+// the length of the rollout:
+//
+//     rhex_controller::GaitDescriptorAccumulator<6> accumulator;
+//     for (size_t k = 1; k <= ticks; ++k)
+//     {
+//         controller.pos(k * dt, output);
+//         accumulator.update(k * dt, controller);
+//     }
+//     rhex_controller::GaitDescriptor<6> d = accumulator.descriptor();
+//
+// A stance flag holds from its tick to the next one, so times are known to one tick.
+// A touchdown is a switch from swing to stance, a liftoff the opposite; the stride
+// of a leg is the time between its touchdowns. Broken legs are never in stance.
+
+namespace rhex_controller {
+
+    template <size_t Legs>
+    struct GaitDescriptor {
+        GaitDescriptor() : valid(false), frequency(0)
+        {
+            duty_factor.fill(0);
+            phase_lag.fill(0);
+            stance_duration.fill(0);
+            swing_duration.fill(0);
+        }
+
+        // false until the reference leg has completed a stride
+        bool valid;
+        // strides per second, averaged over the legs that completed one (Hz)
+        double frequency;
+        // fraction of the time each leg was in stance
+        std::array<double, Legs> duty_factor;
+        // circular mean of the delay between the touchdowns of the reference leg and
+        // those of each leg, in strides of the reference leg, in [0, 1)
+        std::array<double, Legs> phase_lag;
+        // mean duration of the completed stances and swings (s)
+        std::array<double, Legs> stance_duration;
+        std::array<double, Legs> swing_duration;
+
+        // the descriptor of GaitFitness (rhex_controller_gait_fitness.hpp): the mean
+        // duty factor and the stride frequency over max_frequency, capped at 1
+        std::vector<double> descriptor(double max_frequency = 3) const
+        {
+            double duty = 0;
+            for (size_t i = 0; i < Legs; ++i)
+                duty += duty_factor[i];
+            std::vector<double> d;
+            d.push_back(duty / Legs);
+            d.push_back(std::min(frequency / max_frequency, 1.));
+            return d;
+        }
+    };
+
+    template <size_t Legs>
+    class GaitDescriptorAccumulator {
+    public:
+        typedef std::array<bool, Legs> stance_t;
+
+        static constexpr size_t legs = Legs;
+
+        // phase lags are measured against leg reference
+        GaitDescriptorAccumulator(size_t reference = 0) : _reference(reference)
+        {
+            assert(reference < Legs);
+            reset();
+        }
+
+        // forgets the ticks so far, e.g. those of a warm-up
+        void reset()
+        {
+            _ticks = 0;
+            _first_time = _last_time = 0;
+            _stance.fill(false);
+            _stance_time.fill(0);
+            _touchdowns.fill(0);
+            _first_touchdown.fill(0);
+            _last_touchdown.fill(0);
+            _last_liftoff.fill(-1);
+            _stance_sum.fill(0);
+            _stance_count.fill(0);
+            _swing_sum.fill(0);
+            _swing_count.fill(0);
+            _lag_sin.fill(0);
+            _lag_cos.fill(0);
+            _reference_stride = 0;
+        }
+
+        // stance flags of the legs at time t, after those of an earlier tick
+        void update(double t, const stance_t& stance)
+        {
+            if (_ticks++ == 0)
+            {
+                _first_time = _last_time = t;
+                _stance = stance;
+                return;
+            }
+
+            double dt = t - _last_time;
+            _last_time = t;
+
+            // the reference leg first, so that legs touching down on the same tick
+            // are measured against this touchdown
+            touch(_reference, t, dt, stance[_reference]);
+            for (size_t i = 0; i < Legs; ++i)
+                if (i != _reference)
+                    touch(i, t, dt, stance[i]);
+        }
+
+        // update() with the stance flags of the controller's last tick
+        template <typename Controller>
+        void update(double t, const Controller& controller)
+        {
+            stance_t stance;
+            controller.stance(stance);
+            update(t, stance);
+        }
+
+        size_t ticks() const
+        {
+            return _ticks;
+        }
+
+        GaitDescriptor<Legs> descriptor() const
+        {
+            GaitDescriptor<Legs> d;
+            double total = _last_time - _first_time;
+
+            size_t striding = 0;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                d.duty_factor[i] = (total > 0) ? _stance_time[i] / total : 0;
+                d.stance_duration[i] = _stance_count[i] ? _stance_sum[i] / _stance_count[i] : 0;
+                d.swing_duration[i] = _swing_count[i] ? _swing_sum[i] / _swing_count[i] : 0;
+
+                if (_touchdowns[i] >= 2 && _last_touchdown[i] > _first_touchdown[i])
+                {
+                    d.frequency += (_touchdowns[i] - 1) / (_last_touchdown[i] - _first_touchdown[i]);
+                    ++striding;
+                }
+
+                if (_lag_sin[i] != 0 || _lag_cos[i] != 0)
+                {
+                    double lag = std::atan2(_lag_sin[i], _lag_cos[i]) / (2 * pi);
+                    lag -= std::floor(lag);
+                    // a lag just below 0 rounds to 1
+                    d.phase_lag[i] = (lag < 1) ? lag : 0;
+                }
+            }
+
+            d.frequency = striding ? d.frequency / striding : 0;
+            d.valid = _touchdowns[_reference] >= 2;
+            return d;
+        }
+
+    protected:
+        void touch(size_t i, double t, double dt, bool stance)
+        {
+            if (_stance[i])
+                _stance_time[i] += dt;
+
+            if (stance && !_stance[i])
+            {
+                if (_last_liftoff[i] >= 0)
+                {
+                    _swing_sum[i] += t - _last_liftoff[i];
+                    ++_swing_count[i];
+                }
+                if (i == _reference && _touchdowns[i] > 0)
+                    _reference_stride = t - _last_touchdown[i];
+                if (_touchdowns[i]++ == 0)
+                    _first_touchdown[i] = t;
+                _last_touchdown[i] = t;
+
+                if (i != _reference && _reference_stride > 0)
+                {
+                    double angle = 2 * pi * (t - _last_touchdown[_reference]) / _reference_stride;
+                    _lag_sin[i] += std::sin(angle);
+                    _lag_cos[i] += std::cos(angle);
+                }
+            }
+            else if (!stance && _stance[i])
+            {
+                if (_touchdowns[i] > 0)
+                {
+                    _stance_sum[i] += t - _last_touchdown[i];
+                    ++_stance_count[i];
+                }
+                _last_liftoff[i] = t;
+            }
+
+            _stance[i] = stance;
+        }
+
+        size_t _reference;
+        size_t _ticks;
+        double _first_time;
+        double _last_time;
+        // stride of the reference leg between its last two touchdowns
+        double _reference_stride;
+
+        stance_t _stance;
+        std::array<double, Legs> _stance_time;
+        std::array<size_t, Legs> _touchdowns;
+        std::array<double, Legs> _first_touchdown;
+        std::array<double, Legs> _last_touchdown;
+        // -1 before the first liftoff
+        std::array<double, Legs> _last_liftoff;
+        std::array<double, Legs> _stance_sum;
+        std::array<size_t, Legs> _stance_count;
+        std::array<double, Legs> _swing_sum;
+        std::array<size_t, Legs> _swing_count;
+        std::array<double, Legs> _lag_sin;
+        std::array<double, Legs> _lag_cos;
+    };
+
+    template <size_t Legs>
+    constexpr size_t GaitDescriptorAccumulator<Legs>::legs;
+} // namespace rhex_controller
+
+#endif
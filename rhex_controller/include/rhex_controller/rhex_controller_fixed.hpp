@@ -0,0 +1,126 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_FIXED_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_FIXED_HPP
+
+#include <cstdint>
+
+// Q-format fixed point numbers, a Scalar for BasicRhexControllerBuehler and
+// BasicRhexControllerSimple on boards without a floating point unit (motor driver
+// MCUs):
+//
+//     rhex_controller::BasicRhexControllerBuehler<6, rhex_controller::Q16_16> buehler(ctrl);
+//
+// Fixed<Fraction> holds x * 2^Fraction in a 32 bits integer, products and quotients
+// going through 64 bits and rounded to nearest. Doubles (the genome, the time) and
+// integers convert implicitly, so the controllers are written as for double; back to
+// double is explicit (double(x)), raw() gives the integer. Q16_16 resolves 1.5e-5
+// and holds magnitudes below 32768. Overflow is not checked, so the controllers keep
+// their values within a few turns however long they run: Buehler reduces its time to
+// the current cycle in double and leaves the whole cycles out of its targets
+// (cycles()), Simple only takes the position within its cycle.
+// ./waf bench checks the targets against the double controllers (see src/bench.cpp).
+
+namespace rhex_controller {
+
+    template <int Fraction, typename Storage = int32_t, typename Wide = int64_t>
+    class Fixed {
+    public:
+        static_assert(Fraction > 0 && Fraction < int(8 * sizeof(Storage)) - 1, "Fraction must leave an integer part");
+        static_assert(sizeof(Wide) >= 2 * sizeof(Storage), "Wide must hold the products");
+
+        typedef Storage storage_t;
+
+        static constexpr int fraction = Fraction;
+
+        constexpr Fixed() : _raw(0) {}
+
+        constexpr Fixed(double x) : _raw(Storage(x * double(Wide(1) << Fraction) + ((x < 0) ? -0.5 : 0.5))) {}
+
+        static Fixed from_raw(Storage raw)
+        {
+            Fixed x;
+            x._raw = raw;
+            return x;
+        }
+
+        constexpr Storage raw() const
+        {
+            return _raw;
+        }
+
+        explicit constexpr operator double() const
+        {
+            return double(_raw) / double(Wide(1) << Fraction);
+        }
+
+        explicit constexpr operator float() const
+        {
+            return float(double(*this));
+        }
+
+        // rounded towards minus infinity
+        explicit constexpr operator int() const
+        {
+            return int(_raw >> Fraction);
+        }
+
+        Fixed operator-() const
+        {
+            return from_raw(-_raw);
+        }
+
+        Fixed& operator+=(Fixed y)
+        {
+            _raw += y._raw;
+            return *this;
+        }
+
+        Fixed& operator-=(Fixed y)
+        {
+            _raw -= y._raw;
+            return *this;
+        }
+
+        Fixed& operator*=(Fixed y)
+        {
+            Wide product = Wide(_raw) * y._raw;
+            _raw = Storage((product + (Wide(1) << (Fraction - 1))) >> Fraction);
+            return *this;
+        }
+
+        Fixed& operator/=(Fixed y)
+        {
+            Wide numerator = Wide(_raw) * (Wide(1) << Fraction);
+            Wide half = y._raw / 2;
+            _raw = Storage(((numerator < 0) == (y._raw < 0) ? numerator + half : numerator - half) / y._raw);
+            return *this;
+        }
+
+        friend Fixed operator+(Fixed x, Fixed y) { return x += y; }
+        friend Fixed operator-(Fixed x, Fixed y) { return x -= y; }
+        friend Fixed operator*(Fixed x, Fixed y) { return x *= y; }
+        friend Fixed operator/(Fixed x, Fixed y) { return x /= y; }
+
+        friend bool operator==(Fixed x, Fixed y) { return x._raw == y._raw; }
+        friend bool operator!=(Fixed x, Fixed y) { return x._raw != y._raw; }
+        friend bool operator<(Fixed x, Fixed y) { return x._raw < y._raw; }
+        friend bool operator<=(Fixed x, Fixed y) { return x._raw <= y._raw; }
+        friend bool operator>(Fixed x, Fixed y) { return x._raw > y._raw; }
+        friend bool operator>=(Fixed x, Fixed y) { return x._raw >= y._raw; }
+
+        // found by argument dependent lookup, the controllers call floor after using std::floor
+        friend Fixed floor(Fixed x)
+        {
+            return from_raw(Storage(x._raw & ~((Storage(1) << Fraction) - 1)));
+        }
+
+    protected:
+        Storage _raw;
+    };
+
+    template <int Fraction, typename Storage, typename Wide>
+    constexpr int Fixed<Fraction, Storage, Wide>::fraction;
+
+    typedef Fixed<16> Q16_16;
+} // namespace rhex_controller
+
+#endif
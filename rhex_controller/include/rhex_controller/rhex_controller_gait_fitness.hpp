@@ -0,0 +1,194 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_GAIT_FITNESS_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_GAIT_FITNESS_HPP
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_search.hpp>
+
+// Analytic gait fitness, computed from the leg angles given by pos() alone, to run
+// and check the searches of rhex_controller_search.hpp without a simulator.
+//
+// The controller is sampled over a few cycles of controller.period() after an
+// optional warm-up, and three errors in [0, 1] are measured:
+// - regularity: how far each leg is, one period later, from its angle plus a whole
+//   number of turns (0 for a periodic gait)
+// - duty factor: distance between the target and the fraction of the samples in
+//   which each leg turns slower than its mean speed, its stance
+// - phase: 1 - cos of the angle of each leg relative to leg 0 minus its target,
+//   averaged over the samples and halved (a tripod by default: 0 for the even legs,
+//   pi for the odd ones)
+// The fitness is minus their weighted sum, 0 at best. The descriptor, for
+// MapElites, is the mean duty factor and the step frequency over max_frequency.
+
+namespace rhex_controller {
+
+    struct GaitTargets {
+        GaitTargets()
+            : duty_factor(0.5), regularity_weight(1), duty_weight(1), phase_weight(1),
+              cycles(3), samples(128), warmup(0), max_frequency(3) {}
+
+        double duty_factor;
+        // angle of each leg relative to leg 0, empty for the tripod
+        std::vector<double> relative_angle;
+
+        double regularity_weight;
+        double duty_weight;
+        double phase_weight;
+
+        // cycles measured, samples per cycle (enough for a leg to move less than pi
+        // between two of them) and seconds run first, for Hopf and CPG to lock
+        size_t cycles;
+        size_t samples;
+        double warmup;
+        // frequency (Hz) mapped to 1 in the descriptor
+        double max_frequency;
+    };
+
+    template <size_t Legs>
+    struct GaitMetrics {
+        GaitMetrics() : valid(false), frequency(0), regularity(0), duty_error(0), phase_error(0)
+        {
+            duty_factor.fill(0);
+            relative_angle.fill(0);
+        }
+
+        // false if the period or an angle is not finite
+        bool valid;
+        double frequency;
+        double regularity;
+        double duty_error;
+        double phase_error;
+        std::array<double, Legs> duty_factor;
+        // circular mean of the angle of each leg relative to leg 0, in [-pi, pi]
+        std::array<double, Legs> relative_angle;
+    };
+
+    template <typename Controller>
+    class GaitFitness {
+    public:
+        static constexpr size_t legs = Controller::legs;
+
+        GaitFitness(const GaitTargets& targets = GaitTargets()) : _targets(targets)
+        {
+            if (_targets.relative_angle.empty())
+            {
+                for (size_t i = 0; i < legs; ++i)
+                    _targets.relative_angle.push_back((i % 2) ? pi : 0.);
+            }
+            assert(_targets.relative_angle.size() == legs);
+            assert(_targets.cycles >= 2 && _targets.samples >= 2);
+        }
+
+        const GaitTargets& targets() const
+        {
+            return _targets;
+        }
+
+        Evaluation operator()(const std::vector<double>& genome) const
+        {
+            Evaluation evaluation;
+            GaitMetrics<legs> metrics = measure(genome);
+            if (!metrics.valid)
+                return evaluation;
+
+            evaluation.valid = true;
+            evaluation.fitness = -(_targets.regularity_weight * metrics.regularity
+                + _targets.duty_weight * metrics.duty_error
+                + _targets.phase_weight * metrics.phase_error);
+
+            double duty = 0;
+            for (size_t i = 0; i < legs; ++i)
+                duty += metrics.duty_factor[i];
+            evaluation.descriptor.push_back(duty / legs);
+            evaluation.descriptor.push_back(std::min(metrics.frequency / _targets.max_frequency, 1.));
+
+            return evaluation;
+        }
+
+        GaitMetrics<legs> measure(const std::vector<double>& genome) const
+        {
+            GaitMetrics<legs> metrics;
+            Controller controller(genome);
+
+            double period = controller.period();
+            if (!(period > 0) || !std::isfinite(period))
+                return metrics;
+
+            size_t S = _targets.samples;
+            size_t N = _targets.cycles * S;
+            double dt = period / S;
+
+            // stepped at the sampling rate from t = 0, as GaitTable does
+            typename Controller::output_t out;
+            size_t warm = std::ceil(_targets.warmup / dt);
+            for (size_t k = 0; k <= warm; ++k)
+                controller.pos(k * dt, out);
+
+            // angles[k * legs + i], unwrapped
+            std::vector<double> angles((N + 1) * legs);
+            for (size_t i = 0; i < legs; ++i)
+                angles[i] = out[i];
+            for (size_t k = 1; k <= N; ++k)
+            {
+                controller.pos((warm + k) * dt, out);
+                for (size_t i = 0; i < legs; ++i)
+                {
+                    double previous = angles[(k - 1) * legs + i];
+                    double step = out[i] - previous;
+                    angles[k * legs + i] = previous + step - 2 * pi * std::round(step / (2 * pi));
+                }
+            }
+
+            for (size_t k = 0; k <= N * legs; ++k)
+                if (!std::isfinite(angles[k]))
+                    return metrics;
+
+            double regularity = 0, duty_error = 0, phase_error = 0;
+            for (size_t i = 0; i < legs; ++i)
+            {
+                for (size_t k = 0; k + S <= N; ++k)
+                {
+                    double d = angles[(k + S) * legs + i] - angles[k * legs + i];
+                    regularity += std::abs(d - 2 * pi * std::round(d / (2 * pi))) / pi;
+                }
+
+                double mean_step = std::abs(angles[N * legs + i] - angles[i]) / N;
+                size_t stance = 0;
+                for (size_t k = 0; k < N; ++k)
+                    stance += (std::abs(angles[(k + 1) * legs + i] - angles[k * legs + i]) <= mean_step);
+                metrics.duty_factor[i] = double(stance) / N;
+                duty_error += std::abs(metrics.duty_factor[i] - _targets.duty_factor);
+
+                double s = 0, c = 0, error = 0;
+                for (size_t k = 0; k <= N; ++k)
+                {
+                    double relative = angles[k * legs + i] - angles[k * legs];
+                    s += std::sin(relative);
+                    c += std::cos(relative);
+                    error += (1 - std::cos(relative - _targets.relative_angle[i])) / 2;
+                }
+                metrics.relative_angle[i] = std::atan2(s, c);
+                phase_error += error / (N + 1);
+            }
+
+            metrics.valid = true;
+            metrics.frequency = 1 / period;
+            metrics.regularity = regularity / (legs * (N - S + 1));
+            metrics.duty_error = duty_error / legs;
+            metrics.phase_error = phase_error / legs;
+
+            return metrics;
+        }
+
+    protected:
+        GaitTargets _targets;
+    };
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_GAIT_TABLE_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_GAIT_TABLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+
+// Playback of a precomputed limit cycle.
+// Once its parameters are set every controller settles into a periodic signal,
+// the angle of each leg only gaining a whole number of turns per cycle. GaitTable
+// samples one cycle of any controller (after an optional warm-up for the
+// oscillator based ones) and plays it back with linear or cubic interpolation,
+// adding the wind-up of the elapsed cycles. A tick then costs a few loads and
+// multiply-adds whatever the controller. Jumps of the signal that are not whole
+// turns (the fast/slow switch of RhexControllerSimple) are smoothed over one sample.
+
+namespace rhex_controller {
+
+    enum class Interpolation {
+        LINEAR,
+        CUBIC // Catmull-Rom
+    };
+
+    // Legs is the number of legs of the sampled controllers
+    template <size_t Legs = default_legs>
+    class BasicGaitTable {
+    public:
+        typedef std::array<double, Legs> output_t;
+
+        BasicGaitTable() : _samples(0), _period(0), _start(0), _has_gains(false), _undersampled(false), _interpolation(Interpolation::CUBIC) {}
+
+        template <typename Controller>
+        BasicGaitTable(const Controller& controller, size_t samples = 256, double warmup = 0, double period = 0)
+            : _interpolation(Interpolation::CUBIC)
+        {
+            sample(controller, samples, warmup, period);
+        }
+
+        // Samples one cycle of a copy of the controller, so the given one is left untouched.
+        // The copy is first run for warmup seconds (for Hopf and CPG to reach their limit
+        // cycle), then the cycle starting there is recorded. period defaults to
+        // controller.period(), the period of the uncoupled oscillators for Hopf and CPG:
+        // pass the measured one if the coupling shifts the gait. The samples must be dense enough for a leg to move less than
+        // PI between two of them, which is how the 2 * PI wrap-arounds are told apart. A leg
+        // of a controller that winds its own output and moves faster than that is played
+        // back from its samples as they are, and undersampled() tells.
+        template <typename Controller>
+        void sample(Controller controller, size_t samples = 256, double warmup = 0, double period = 0)
+        {
+            assert(samples >= 2);
+
+            _samples = samples;
+            _period = (period > 0) ? period : controller.period();
+            _has_gains = false;
+            _undersampled = false;
+
+            double dt = _period / _samples;
+            typename Controller::output_t out;
+
+            // controllers are stepped at the table resolution from t = 0, as in use
+            size_t warm = std::ceil(warmup / dt);
+            double t = 0;
+            controller.pos(t, out);
+            for (size_t k = 0; k < warm; ++k)
+            {
+                t = (k + 1) * dt;
+                controller.pos(t, out);
+            }
+            _start = t;
+
+            // rows -1 to samples + 1, the extra rows let the cubic interpolation read
+            // its 4 points without wrapping the index
+            _angles.assign((_samples + 3) * Legs, 0);
+            _gains.assign((_samples + 1) * Legs, 0);
+
+            // controllers with leg gains (see leg_gains) have their Kp recorded too
+            std::vector<double> raw((_samples + 1) * Legs);
+            std::array<double, Legs> Kp, Kd;
+            for (size_t k = 0; k <= _samples; ++k)
+            {
+                if (k > 0)
+                    controller.pos(_start + k * dt, out);
+
+                for (size_t i = 0; i < Legs; ++i)
+                    raw[k * Legs + i] = out[i];
+                if (leg_gains(controller, Kp, Kd))
+                {
+                    _has_gains = true;
+                    std::copy(Kp.begin(), Kp.end(), _gains.begin() + k * Legs);
+                }
+            }
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                // unwrap so that the table is continuous within the cycle
+                double lowest = raw[i];
+                angle(0, i) = raw[i];
+                for (size_t k = 1; k <= _samples; ++k)
+                {
+                    double step = raw[k * Legs + i] - raw[(k - 1) * Legs + i];
+                    angle(k, i) = angle(k - 1, i) + step - 2 * pi * std::round(step / (2 * pi));
+                    lowest = std::min(lowest, raw[k * Legs + i]);
+                }
+
+                double turns = std::round((angle(_samples, i) - angle(0, i)) / (2 * pi));
+                double raw_turns = std::round((raw[_samples * Legs + i] - raw[i]) / (2 * pi));
+
+                // a controller that winds its own output gains raw_turns per cycle: other
+                // turns mean the leg moved more than pi between two samples (a fast
+                // swing), and the unwrap took a step for a wrap-around
+                if (raw_turns != 0 && turns != raw_turns)
+                {
+                    for (size_t k = 0; k <= _samples; ++k)
+                        angle(k, i) = raw[k * Legs + i];
+                    turns = raw_turns;
+                    _undersampled = true;
+                }
+                _winding[i] = turns * 2 * pi;
+
+                // a controller that wraps its own output back (like RhexControllerSimple)
+                // is played back wrapped the same way. Legs that jump by whole turns
+                // within the cycle otherwise (Hopf) are played back continuous.
+                _wrap[i] = (raw_turns == 0 && turns != 0);
+                _wrap_base[i] = 2 * pi * std::floor(lowest / (2 * pi));
+
+                // close the cycle exactly and extend it on both sides
+                angle(_samples, i) = angle(0, i) + _winding[i];
+                angle(-1, i) = angle(_samples - 1, i) - _winding[i];
+                angle(_samples + 1, i) = angle(1, i) + _winding[i];
+            }
+        }
+
+        void set_interpolation(Interpolation interpolation)
+        {
+            _interpolation = interpolation;
+        }
+
+        Interpolation interpolation() const
+        {
+            return _interpolation;
+        }
+
+        // same time base as the sampled controller, valid for any t
+        void pos(double t, output_t& out) const
+        {
+            assert(_samples > 0);
+
+            double cycles = std::floor((t - _start) / _period);
+            double x = (t - _start - cycles * _period) / _period * _samples;
+            long k = std::min(long(x), long(_samples) - 1);
+            double f = x - k;
+
+            const double* p0 = &_angles[(k) * Legs];       // row k - 1
+            const double* p1 = &_angles[(k + 1) * Legs];   // row k
+            const double* p2 = &_angles[(k + 2) * Legs];   // row k + 1
+            const double* p3 = &_angles[(k + 3) * Legs];   // row k + 2
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                double y;
+                if (_interpolation == Interpolation::LINEAR)
+                    y = p1[i] + f * (p2[i] - p1[i]);
+                else
+                    y = p1[i] + 0.5 * f * (p2[i] - p0[i]
+                        + f * (2 * p0[i] - 5 * p1[i] + 4 * p2[i] - p3[i]
+                        + f * (3 * (p1[i] - p2[i]) + p3[i] - p0[i])));
+
+                y += cycles * _winding[i];
+
+                if (_wrap[i])
+                    y -= 2 * pi * std::floor((y - _wrap_base[i]) / (2 * pi));
+
+                out[i] = y;
+            }
+        }
+
+        std::vector<double> pos(double t) const
+        {
+            output_t out;
+            pos(t, out);
+            return std::vector<double>(out.begin(), out.end());
+        }
+
+        // whether the sampled controller had PD gains (get_Kp()), as RhexControllerSimple
+        bool has_gains() const
+        {
+            return _has_gains;
+        }
+
+        // whether a leg of the sampled controller moved more than pi between two samples
+        // (see sample()). Its samples are played as the controller gave them, which only
+        // goes wrong if the leg also jumps by whole turns (Hopf): sample more densely then.
+        bool undersampled() const
+        {
+            return _undersampled;
+        }
+
+        // proportional gain of each leg at t, held from the previous sample
+        void Kp(double t, output_t& out) const
+        {
+            assert(_has_gains);
+
+            double cycles = std::floor((t - _start) / _period);
+            double x = (t - _start - cycles * _period) / _period * _samples;
+            size_t k = std::min(size_t(x), _samples - 1);
+
+            for (size_t i = 0; i < Legs; ++i)
+                out[i] = _gains[k * Legs + i];
+        }
+
+        size_t samples() const
+        {
+            return _samples;
+        }
+
+        double period() const
+        {
+            return _period;
+        }
+
+    protected:
+        double& angle(long k, size_t i)
+        {
+            return _angles[(k + 1) * Legs + i];
+        }
+
+        size_t _samples;
+        double _period;
+        double _start;
+        bool _has_gains;
+        bool _undersampled;
+        Interpolation _interpolation;
+
+        std::array<double, Legs> _winding;
+        std::array<double, Legs> _wrap_base;
+        std::array<bool, Legs> _wrap;
+
+        std::vector<double> _angles;
+        std::vector<double> _gains;
+    };
+
+    typedef BasicGaitTable<> GaitTable;
+} // namespace rhex_controller
+
+#endif
@@ -2,152 +2,229 @@
 #define RHEX_CONTROLLER_RHEX_CONTROLLER_HOPF_HPP
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
 #include <vector>
 
-#define PI 3.14159265
-#define CTRL_SIZE 10
-#define DOF 6
-#define AMP 1
-#define IGNORE 1000
-
-#define F 3
-#define K 40
-#define SIGMA 3
+#include <rhex_controller/rhex_controller_command.hpp>
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_coupling.hpp>
+#include <rhex_controller/rhex_controller_integrator.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+#include <rhex_controller/rhex_controller_math.hpp>
+#include <rhex_controller/rhex_controller_network.hpp>
+#include <rhex_controller/rhex_controller_trace.hpp>
 
 // this file is a work in progress
 
 namespace rhex_controller {
 
-    class RhexControllerHopf {
+    // One Hopf oscillator per leg, an OscillatorNetwork of HopfOscillator (see
+    // rhex_controller_network.hpp). Legs is the number of legs, Scalar the type the
+    // network is integrated in and Coupling the topology of the network (see
+    // rhex_controller_coupling.hpp). The genome holds the frequency, convergence,
+    // coupling strength, stance angle and stance offset, then the parameters of
+    // the coupling topology. Math gives the sin and cos of the phase biases (see
+    // rhex_controller_math.hpp).
+    template <size_t Legs = default_legs, typename Scalar = double, typename Coupling = HexapodCoupling, typename Math = StdMath>
+    class BasicRhexControllerHopf {
     public:
+        typedef Scalar scalar_t;
+        typedef Coupling coupling_topology_t;
+        typedef Math math_t;
+
+        static constexpr size_t legs = Legs;
+        // oscillators are stored padded to a multiple of 8, a full AVX-512 register of
+        // doubles (or two AVX2 ones)
+        static constexpr size_t lanes = (Legs + 7) / 8 * 8;
+        static constexpr size_t ctrl_size = 5 + Coupling::parameters;
+
+        static constexpr Scalar pi = Scalar(rhex_controller::pi);
+        static constexpr Scalar default_amplitude = 1;
+        static constexpr Scalar max_frequency = 3;
+        static constexpr Scalar max_convergence = 40;
+        static constexpr Scalar max_coupling = 3;
+
+        typedef std::array<Scalar, Legs> output_t;
+        typedef ControlCommand<Legs, Scalar> command_t;
+        typedef GainSchedule<Legs, Scalar> gain_schedule_t;
+        // packed oscillator state, u values in [0, lanes) then v values in [lanes, 2 * lanes)
+        typedef std::array<Scalar, 2 * lanes> state_t;
+        typedef OscillatorNetwork<HopfOscillator, lanes, Scalar, Math> network_t;
+
+        // Everything pos(t) changes, copied by snapshot() and restore() without
+        // touching the heap, to fork a rollout and rewind it (see
+        // rhex_controller_snapshot.hpp). It only makes sense with the parameters,
+        // integrator and broken legs it was taken with.
+        struct snapshot_t {
+            double time;
+            double last_time;
+            double dt;
+            double h;
+            size_t evaluations;
+            state_t state;
+            std::array<bool, Legs> swing;
+            std::array<int, Legs> counter;
+            std::array<Scalar, Legs> last_motor_input;
+            std::array<Scalar, Legs> motor_input;
+            // the locomotion command and the stance angles it is bringing in
+            double speed;
+            double turn_rate;
+            std::array<Scalar, Legs> stance_angle;
+            std::array<Scalar, Legs> next_stance_angle;
+        };
+
+        BasicRhexControllerHopf()
+            : _time(0), _speed(1), _turn_rate(0), _integrator(Integrator::EULER), _tolerance(1e-6), _h(0), _evaluations(0) {}
+
+        // tolerance is only used by the adaptive Integrator::RK45
+        BasicRhexControllerHopf(const std::vector<double>& ctrl, Integrator integrator = Integrator::EULER, double tolerance = 1e-6)
+            : _speed(1), _turn_rate(0), _integrator(integrator), _tolerance(tolerance), _h(0), _evaluations(0)
+        {
+            set_parameters(ctrl);
+        }
 
-        RhexControllerHopf() {}
+        void set_integrator(Integrator integrator, double tolerance = 1e-6)
+        {
+            _integrator = integrator;
+            _tolerance = tolerance;
+            _h = 0;
+        }
 
-        RhexControllerHopf(const std::vector<double>& ctrl)
+        Integrator integrator() const
         {
-            set_parameters(ctrl);
+            return _integrator;
+        }
+
+        // number of network derivative evaluations since set_parameters
+        size_t derivative_evaluations() const
+        {
+            return _evaluations;
+        }
+
+        // Broken legs: their oscillators are stopped and left out of the network, whose
+        // coupling is re-derived for the live legs (see live_coupling), and their targets
+        // are 0. Legs that come back restart from their initial state.
+        void set_broken(const std::vector<int>& broken_legs)
+        {
+            LegMask<Legs> previous = _mask;
+            _mask.set_broken(broken_legs);
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                if (_mask.live(i) != previous.live(i))
+                {
+                    reset_oscillator(i);
+                    _swing[i] = false;
+                    _counter[i] = 0;
+                    _motor_input[i] = _last_motor_input[i] = 0;
+                }
+            }
+
+            build_coupling();
+        }
+
+        std::vector<int> broken_legs() const
+        {
+            return _mask.broken_legs();
+        }
+
+        const LegMask<Legs>& leg_mask() const
+        {
+            return _mask;
+        }
+
+        // gains of command(), stance outside the swing that land_couple maps
+        void set_gain_schedule(const gain_schedule_t& gains)
+        {
+            _gains = gains;
+        }
+
+        const gain_schedule_t& gain_schedule() const
+        {
+            return _gains;
         }
 
         void set_parameters(const std::vector<double>& ctrl)
         {
-            assert(ctrl.size() == CTRL_SIZE);
+            assert(ctrl.size() == ctrl_size);
 
-            _A = AMP;
-            _f = ctrl[0] * F;
-            _k = ctrl[1] * K;
-            _sigma = ctrl[2] * SIGMA;
+            _A = default_amplitude;
+            _f = ctrl[0] * max_frequency;
+            _k = ctrl[1] * max_convergence;
+            _sigma = ctrl[2] * max_coupling;
             _stance_angle = ctrl[3];
             _stance_offset = ctrl[4];
+            // the locomotion command is kept
+            commanded_stance_angles(_leg_stance_angle);
+            _next_stance_angle = _leg_stance_angle;
+            _time = 0;
             _last_time = 0;
             _dt = 0.0;
+            _h = 0;
+            _evaluations = 0;
 
-            _fully_connected = false;
-
-            _swing.resize(DOF, false);
+            _swing.fill(false);
 
             // [[-1,-1],[-1,-1],[-1,-1],[-1,-1],[-1,-1],[-1,-1]] unstable initial state
-            // [[1,-1],[1,-1],[1,-1],[-1,1],[-1,1],[-1,1]] more stable
-            // _state.resize(DOF, std::vector<double>(2, -1));
-
-            _state = std::vector<std::vector<double> > {{1,-1},{1,-1},{1,-1},{-1,1},{-1,1},{-1,1}};
-
-            _k_weights = std::vector<double>(DOF, _k);
+            // [[1,-1],[1,-1],[1,-1],[-1,1],[-1,1],[-1,1]] more stable: the first half
+            // of the legs starts opposite to the second half
+            _state.fill(0);
+            for (size_t i = 0; i < Legs; ++i)
+                reset_oscillator(i);
 
             // set up weights between each of the legs, 1 for each except it_
             // [[0,1,1,1,1,1],[1,0,1,1,1,1],[1,1,0,1,1,1],[1,1,1,0,1,1],[1,1,1,1,0,1],[1,1,1,1,1,0]]
-            _sigma_weights.resize(DOF, std::vector<double>(DOF, 0));
-            for(size_t i = 0; i < DOF; ++i)
+            for(size_t i = 0; i < Legs; ++i)
             {
-                for(size_t j = 0; j < DOF; ++j)
+                for(size_t j = 0; j < Legs; ++j)
                 {
-                    if (i != j)
-                    {
-                        _sigma_weights[i][j] = _sigma;
-                    }
+                    _sigma_weights[i][j] = (i != j) ? _sigma : 0;
                 }
             }
 
-            // set up phase bias.
-            // [[0,PI,0,PI,0,PI],[-PI,0,-PI,0,-PI,0],[0,PI,0,PI,0,PI],[-PI,0,-PI,0,-PI,0],[0,PI,0,PI,0,PI],[-PI,0,-PI,0,-PI,0]]
-            // [[*,PI,0,PI,*,*], [-PI,*,*,*,PI,*], [0,*,*,*,*,PI], [-PI,*,*,*,PI,0], [*,-PI,*,-PI,*,*], [*,*,-PI,0,*,*]]
-
-            if (!_fully_connected){
-//                _phase_bias = std::vector<std::vector<double> > {
-//                    {IGNORE, PI, 0, PI, IGNORE, IGNORE},
-//                    {-PI, IGNORE, IGNORE, IGNORE, PI, IGNORE},
-//                    {0,IGNORE,IGNORE,IGNORE,IGNORE,PI},
-//                    {-PI,IGNORE,IGNORE,IGNORE,PI,0},
-//                    {IGNORE,-PI,IGNORE,-PI,IGNORE,IGNORE},
-//                    {IGNORE,IGNORE,-PI,0,IGNORE,IGNORE}
-//                };
-
-                double phase14 = ctrl[5] * PI;
-                double phase12 = ctrl[6] * PI;
-                double phase13 = ctrl[7] * PI;
-                double phase45 = ctrl[8] * PI;
-                double phase46 = ctrl[9] * PI;
-
-                double phase52 = phase45 - phase14 - phase12;
-                double phase63 = phase46 - phase14 - phase13;
-
-                _phase_bias = std::vector<std::vector<double> > {
-                    {IGNORE, IGNORE, IGNORE, -phase14, IGNORE, IGNORE},
-                    {-phase12, IGNORE, IGNORE, IGNORE, phase52, IGNORE},
-                    {-phase13, IGNORE, IGNORE, IGNORE, IGNORE, phase63},
-                    {phase14, IGNORE, IGNORE, IGNORE, IGNORE, IGNORE},
-                    {IGNORE, -phase52, IGNORE, phase45, IGNORE, IGNORE},
-                    {IGNORE, IGNORE, -phase63, phase46, IGNORE, IGNORE}
-                };
-            }
+            // set up phase bias, no_coupling where the topology has no edge
+            Coupling::template phase_bias<Legs, Scalar>(ctrl, 5, _phase_bias);
 
-            else {
-                _phase_bias.resize(DOF, std::vector<double>(DOF, 0));
-                for(size_t i = 0; i < DOF; ++i)
-                {
-                    for(size_t j = 0; j < DOF; ++j)
-                    {
-                        if (i == 0 || i % 2 == 0)
-                        {
-                            if (j == 0 || j % 2 == 0)
-                                _phase_bias[i][j] = 0;
-                            else
-                                _phase_bias[i][j] = PI;
-                        }
-                        else
-                        {
-                            if (j == 0 || j % 2 == 0)
-                                _phase_bias[i][j] = -PI;
-                            else
-                                _phase_bias[i][j] = 0;
-                        }
-                    }
-                }
-            }
+            build_coupling();
 
-            _counter.resize(DOF, 0);
-            _motor_input.resize(DOF, 0);
-            _last_motor_input.resize(DOF, 0);
+            _counter.fill(0);
+            _motor_input.fill(0);
+            _last_motor_input.fill(0);
         }
 
         std::vector<double> pos(double t)
         {
+            output_t output;
+            pos(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
 
+        // same as pos(t) but writes into a caller-owned array, no heap allocation
+        void pos(double t, output_t& output)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, HOPF_POS);
             _dt = t - _last_time;
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, _dt);
             amp_couple_update(_dt);
             _last_time = t;
 
             // convert the signal into a monotonous motor input
-            for (size_t i = 0; i < DOF; ++i)
+            RHEX_CONTROLLER_TRACE_SCOPE(motor_timer, HOPF_MOTOR_INPUT);
+            RHEX_CONTROLLER_TRACE_TICK(motor_timer, t, _dt);
+            for (size_t i = 0; i < Legs; ++i)
             {
-                if (_state[i][0] <= -1)
+                if (!_mask.live(i))
+                    continue;
+
+                if (_state[i] <= -1)
                     _counter[i] += 1;
 
-                double x = get_land_couple()[i];
+                Scalar x = land_couple(i);
                 if (x < _motor_input[i])
-                    x = x + _counter[i] * 2 * PI;
+                    x = x + _counter[i] * 2 * pi;
 
                 _last_motor_input[i] = _motor_input[i];
                 _motor_input[i] = x;
@@ -155,98 +232,456 @@ namespace rhex_controller {
                 if(_motor_input[i] - _last_motor_input[i] > 6)
                 {
                     while(_motor_input[i] - _last_motor_input[i] > 6){
-                        _motor_input[i] = _motor_input[i] - 2 * PI;
+                        RHEX_CONTROLLER_TRACE_WRAP(motor_timer);
+                        _motor_input[i] = _motor_input[i] - 2 * pi;
                     }
                 }
             }
 
-            for (size_t i = 0; i < DOF; ++i)
-                _motor_input[i] += _stance_offset * 2 * PI;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                if (!_mask.live(i))
+                {
+                    output[i] = 0;
+                    continue;
+                }
+                _motor_input[i] += _stance_offset * 2 * pi;
+                output[i] = _motor_input[i];
+            }
+        }
+
+        // pos(t, command.angle) with the velocities and gains (see rhex_controller_command.hpp).
+        // The velocity is land_couple's slope times the rate of u over the integration
+        // step, which the targets follow (du/dt at the new state differs from it by the
+        // integrator's error), or times du/dt when t did not advance.
+        void command(double t, command_t& command)
+        {
+            state_t previous = _state;
+            pos(t, command.angle);
+
+            state_t rate;
+            if (_dt > 0)
+            {
+                for (size_t i = 0; i < Legs; ++i)
+                    rate[i] = (_state[i] - previous[i]) / Scalar(_dt);
+            }
+            else
+                derivative(_state, rate);
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                bool stance = !_swing[i];
+                Scalar slope = stance ? (_leg_stance_angle[i] * pi) / _A : -(1 - _leg_stance_angle[i] * pi) / _A;
+                Scalar live = _mask.live(i) ? 1 : 0;
 
-            return _motor_input;
+                command.velocity[i] = slope * rate[i] * live;
+                command.Kp[i] = _gains.Kp(i, stance) * live;
+                command.Kd[i] = _gains.Kd(i, stance) * live;
+            }
         }
 
-        void amp_couple_update(double dt)
+        // time derivative of the whole network: the radial and rotation terms of all
+        // oscillators at once (fixed-size loops over lanes, which the compiler turns
+        // into AVX2/AVX-512 code), then one term per edge of the coupling graph
+        void derivative(const state_t& x, state_t& dx) const
+        {
+            _network.derivative(x, dx);
+        }
+
+        // Semi-implicit Euler: the stiff radial direction of each oscillator is stepped
+        // linearly implicit (with the radial Jacobian k * (A^2 - 3 r^2)), the rotation and
+        // the coupling explicitly. The radius relaxes onto the limit cycle for any dt, so
+        // large K no longer forces tiny steps, while the phase is advanced as with Euler.
+        size_t semi_implicit_step(state_t& x, double dt) const
         {
-            for (size_t i = 0; i < DOF; ++i)
+            state_t dx;
+            derivative(x, dx);
+
+            const typename network_t::parameters_t& p = _network.parameters();
+
+            Scalar* u = &x[0];
+            Scalar* v = &x[lanes];
+            const Scalar* du = &dx[0];
+            const Scalar* dv = &dx[lanes];
+
+            for (size_t i = 0; i < lanes; ++i)
             {
-                double du = _k_weights[i] * \
-                (_A*_A - _state[i][0]*_state[i][0] - _state[i][1]*_state[i][1]) * \
-                _state[i][0] - 2 * PI * _f * _state[i][1];
+                Scalar r2 = u[i]*u[i] + v[i]*v[i];
+                if (r2 == 0)
+                    continue;
 
-                double dv = _k_weights[i] * \
-                (_A*_A - _state[i][0]*_state[i][0] - _state[i][1]*_state[i][1]) * \
-                _state[i][1] + 2 * PI * _f *_state[i][0];
+                // split the derivative into its radial and tangential parts
+                Scalar radial = (du[i] * u[i] + dv[i] * v[i]) / r2;
+                Scalar jacobian = std::min(Scalar(0), p.convergence[i] * (_A*_A - 3 * r2));
+                Scalar implicit = radial / (1 - Scalar(dt) * jacobian);
 
-                _time += dt;
+                u[i] += dt * (du[i] - radial * u[i] + implicit * u[i]);
+                v[i] += dt * (dv[i] - radial * v[i] + implicit * v[i]);
+            }
 
-                for (size_t j = 0; j < DOF; ++j)
-                {
-                    if (i != j && _phase_bias[i][j] != IGNORE)
-                        dv += _sigma * _sigma_weights[i][j] * \
-                        (_state[j][0] * sin(_phase_bias[i][j]) + \
-                         _state[j][1] * cos(_phase_bias[i][j]));
-                }
+            return 1;
+        }
 
-                _state[i][0] += du * dt;
-                _state[i][1] += dv * dt;
+        void amp_couple_update(double dt)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, HOPF_AMP_COUPLE_UPDATE);
+            RHEX_CONTROLLER_TRACE_TICK(timer, _last_time + dt, dt);
+            _time += dt;
 
-                if(_state[i][0] >= 1)
+            switch (_integrator)
+            {
+            case Integrator::SEMI_IMPLICIT:
+                _evaluations += semi_implicit_step(_state, dt);
+                break;
+            case Integrator::RK4:
+                _evaluations += rk4_step(*this, _state, dt);
+                break;
+            case Integrator::RK45:
+                _evaluations += rk45_step(*this, _state, dt, _h, _tolerance);
+                break;
+            default:
+                _evaluations += euler_step(*this, _state, dt);
+            }
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                if(_state[i] >= 1)
                     _swing[i] = true;
-                if (_state[i][0] <= -1)
+                if (_state[i] <= -1)
+                {
                     _swing[i] = false;
+                    _leg_stance_angle[i] = _next_stance_angle[i];
+                }
             }
+        }
 
+        // stance flags of the last tick, outside the swing that land_couple maps (see
+        // rhex_controller_descriptor.hpp)
+        void stance(std::array<bool, Legs>& stance) const
+        {
+            for (size_t i = 0; i < Legs; ++i)
+                stance[i] = _mask.live(i) && !_swing[i];
         }
 
         std::vector<double> get_land_couple()
         {
 
-            std::vector<double> output(DOF, 0);
-            double x = 0;
-            for (size_t i = 0; i < DOF; ++i)
+            std::vector<double> output(Legs, 0);
+            for (size_t i = 0; i < Legs; ++i)
+                output[i] = land_couple(i);
+
+            return output;
+        }
+
+        Scalar land_couple(size_t i) const
+        {
+            if (_swing[i])
+                return (2 * pi) - (1 - _leg_stance_angle[i] * pi) * \
+                        (1 + _state[i] / _A);
+            else
+                return (_leg_stance_angle[i] * pi) * \
+                        (1 + (_state[i] / _A));
+        }
+
+        const state_t& parameters() const
+        {
+            return _state;
+        }
+
+        // oscillator state, u then v (see state_t)
+        const state_t& state() const
+        {
+            return _state;
+        }
+
+        // State on the limit cycle with the phases the coupling network locks into
+        // (locked_phases, the coupling pulling oscillator i to the phase of j plus
+        // bias[i][j]), leg 0 at the phase set_parameters starts it at. The phases are
+        // those of the weakly coupled network, which TripodCoupling genomes settle at.
+        // The warm start only helps genomes that lock: a frustrated HexapodCoupling
+        // network may settle radians away from them, or never lock at all;
+        // WarmStartCache (rhex_controller_warm_start.hpp) keeps the states they reach.
+        state_t locked_state() const
+        {
+            matrix_t bias, weights;
+            live_network(bias, weights);
+            for (size_t i = 0; i < Legs; ++i)
+                for (size_t j = 0; j < Legs; ++j)
+                    bias[i][j] = -bias[i][j];
+
+            std::array<double, Legs> phase;
+            locked_phases(bias, weights, phase);
+
+            state_t state;
+            state.fill(0);
+            for (size_t i = 0; i < Legs && _mask.live_count() > 0; ++i)
+            {
+                if (!_mask.live(i))
+                    continue;
+                // set_parameters starts leg 0 at u = 1, v = -1
+                double angle = phase[i] - phase[_mask.leg(0)] - pi / 4;
+                state[i] = _A * std::cos(angle);
+                state[lanes + i] = _A * std::sin(angle);
+            }
+            return state;
+        }
+
+        // Replaces the oscillator state (u then v, see state_t), e.g. by locked_state()
+        // or a converged state. Each live leg is in swing while u decreases, that is
+        // for v > 0, as amp_couple_update would have found it.
+        void set_state(const state_t& state)
+        {
+            _state = state;
+            for (size_t i = 0; i < Legs; ++i)
             {
-                if (_swing[i])
-                    x = (2 * PI) - (1 - _stance_angle * PI) * \
-                            (1 + _state[i][0] / _A);
-                else
-                    x = (_stance_angle * PI) * \
-                            (1 + (_state[i][0] / _A));
+                if (!_mask.live(i))
+                {
+                    _state[i] = _state[lanes + i] = 0;
+                    continue;
+                }
+                _swing[i] = _state[lanes + i] > 0;
+            }
+        }
 
+        // starts the oscillators on their limit cycle, after set_parameters
+        void warm_start()
+        {
+            set_state(locked_state());
+        }
 
-                output[i] = x;
+        // position of the last tick in the gait cycle, in [0, 1): the angle of the
+        // oscillator of the reference leg (the first live one), atan2(v, u), over 2 pi
+        double gait_phase() const
+        {
+            if (_mask.live_count() == 0)
+                return 0;
+            size_t i = _mask.leg(0);
+            double phase = std::atan2(double(_state[lanes + i]), double(_state[i])) / (2 * pi);
+            return phase - std::floor(phase);
+        }
+
+        // turns all the oscillators by the angle that brings the reference leg to cycle
+        // position phase (see gait_phase), keeping their radii and relative phases (those
+        // of warm_start() or of a WarmStartCache state, say), e.g. to carry on the phase
+        // of another gait (rhex_controller_hot_swap.hpp)
+        void set_gait_phase(double phase)
+        {
+            double turn = 2 * pi * (phase - gait_phase());
+            Scalar c = Scalar(std::cos(turn));
+            Scalar s = Scalar(std::sin(turn));
+
+            state_t state = _state;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                state[i] = c * _state[i] - s * _state[lanes + i];
+                state[lanes + i] = s * _state[i] + c * _state[lanes + i];
             }
+            set_state(state);
+        }
 
-            return output;
+        void snapshot(snapshot_t& snapshot) const
+        {
+            snapshot.time = _time;
+            snapshot.last_time = _last_time;
+            snapshot.dt = _dt;
+            snapshot.h = _h;
+            snapshot.evaluations = _evaluations;
+            snapshot.state = _state;
+            snapshot.swing = _swing;
+            snapshot.counter = _counter;
+            snapshot.last_motor_input = _last_motor_input;
+            snapshot.motor_input = _motor_input;
+            snapshot.speed = _speed;
+            snapshot.turn_rate = _turn_rate;
+            snapshot.stance_angle = _leg_stance_angle;
+            snapshot.next_stance_angle = _next_stance_angle;
         }
 
-        const std::vector<std::vector<double> >& parameters() const
+        snapshot_t snapshot() const
         {
-            return _state;
+            snapshot_t s;
+            snapshot(s);
+            return s;
+        }
+
+        void restore(const snapshot_t& snapshot)
+        {
+            _time = snapshot.time;
+            _last_time = snapshot.last_time;
+            _dt = snapshot.dt;
+            _h = snapshot.h;
+            _evaluations = snapshot.evaluations;
+            _state = snapshot.state;
+            _swing = snapshot.swing;
+            _counter = snapshot.counter;
+            _last_motor_input = snapshot.last_motor_input;
+            _motor_input = snapshot.motor_input;
+            _leg_stance_angle = snapshot.stance_angle;
+            _next_stance_angle = snapshot.next_stance_angle;
+            _turn_rate = snapshot.turn_rate;
+            if (snapshot.speed != _speed)
+            {
+                _speed = snapshot.speed;
+                set_frequencies();
+            }
+        }
+
+        // Locomotion command (see rhex_controller_command.hpp), from the next tick on.
+        // The frequency of the oscillators changes, not their state, so the legs carry
+        // on from where they are. A new stance angle is taken by each leg as it enters
+        // stance, where land_couple does not depend on it. O(Legs), no allocation.
+        void set_command(double speed, double turn_rate)
+        {
+            assert(speed > 0);
+            _speed = speed;
+            _turn_rate = std::max(-1., std::min(turn_rate, 1.));
+            set_frequencies();
+            commanded_stance_angles(_next_stance_angle);
+        }
+
+        double speed() const
+        {
+            return _speed;
+        }
+
+        double turn_rate() const
+        {
+            return _turn_rate;
+        }
+
+        Scalar amplitude() const
+        {
+            return _A;
+        }
+
+        // of the commanded gait
+        Scalar frequency() const
+        {
+            return _f * Scalar(_speed);
+        }
+
+        Scalar period() const
+        {
+            return 1 / frequency();
+        }
+
+        Scalar convergence() const
+        {
+            return _k;
+        }
+
+        Scalar stance_angle() const
+        {
+            return _stance_angle;
+        }
+
+        Scalar stance_offset() const
+        {
+            return _stance_offset;
+        }
+
+        // the oscillators of the live legs and their coupling graph, whose edge e from
+        // j to i pulls with weight_sin(e) * u_j + weight_cos(e) * v_j
+        const network_t& network() const
+        {
+            return _network;
         }
 
     protected:
-        double _A;
-        double _f;
+        void reset_oscillator(size_t i)
+        {
+            _state[i] = !_mask.live(i) ? 0 : (i < Legs / 2) ? 1 : -1;
+            _state[lanes + i] = -_state[i];
+        }
+
+        typedef std::array<std::array<Scalar, Legs>, Legs> matrix_t;
+
+        // of the commanded gait
+        void set_frequencies()
+        {
+            typename network_t::parameters_t& p = _network.parameters();
+            for (size_t i = 0; i < lanes; ++i)
+                p.omega[i] = 2 * pi * frequency();
+        }
+
+        // stance angle of the genome, scaled by the turn rate
+        void commanded_stance_angles(std::array<Scalar, Legs>& angles) const
+        {
+            for (size_t i = 0; i < Legs; ++i)
+                angles[i] = _stance_angle * Scalar(1 + leg_side<Legs>(i) * _turn_rate);
+        }
+
+        // phase biases and weights of the live legs
+        void live_network(matrix_t& bias, matrix_t& weights) const
+        {
+            bias = _phase_bias;
+            for (size_t i = 0; i < Legs; ++i)
+                for (size_t j = 0; j < Legs; ++j)
+                    weights[i][j] = (i != j && bias[i][j] != Scalar(no_coupling)) ? _sigma_weights[i][j] : 0;
+            live_coupling(_mask, bias, weights);
+        }
+
+        // oscillators and coupling graph of the live legs
+        void build_coupling()
+        {
+            // broken legs and the padding lanes get a zero radial gain and no edges,
+            // so they stay at rest at 0
+            typename network_t::parameters_t& p = _network.parameters();
+            for (size_t i = 0; i < lanes; ++i)
+            {
+                p.convergence[i] = (i < Legs && _mask.live(i)) ? _k : 0;
+                p.amplitude[i] = _A;
+            }
+            set_frequencies();
+
+            // the edges pull with sigma * w, their terms sigma * w * sin(bias) and
+            // sigma * w * cos(bias) are computed once by the graph
+            matrix_t bias, weights;
+            live_network(bias, weights);
+            _network.set_coupling(bias, weights, _sigma);
+        }
+
+        Scalar _A;
+        Scalar _f;
         double _time;
         double _dt;
-        double _sigma;
-        double _k;
+        Scalar _sigma;
+        Scalar _k;
         double _last_time;
-        double _stance_offset;
-        double _stance_angle;
-        bool _fully_connected;
-
-        std::vector<double> _k_weights;
-        std::vector<bool> _swing;
-        std::vector<std::vector<double> > _phase_bias;
-        std::vector<std::vector<double> > _sigma_weights;
-        std::vector<std::vector<double> > _weights;
-        std::vector<std::vector<double> > _state;
-        std::vector<int> _counter;
-        std::vector<double> _last_motor_input;
-        std::vector<double> _motor_input;
+        Scalar _stance_offset;
+        Scalar _stance_angle;
+        double _speed;
+        double _turn_rate;
+
+        Integrator _integrator;
+        double _tolerance;
+        double _h;
+        size_t _evaluations;
+
+        std::array<bool, Legs> _swing;
+        std::array<Scalar, Legs> _leg_stance_angle;
+        std::array<Scalar, Legs> _next_stance_angle;
+        matrix_t _phase_bias;
+        matrix_t _sigma_weights;
+        network_t _network;
+        state_t _state;
+        std::array<int, Legs> _counter;
+        std::array<Scalar, Legs> _last_motor_input;
+        std::array<Scalar, Legs> _motor_input;
+        LegMask<Legs> _mask;
+        gain_schedule_t _gains;
     };
+
+    template <size_t Legs, typename Scalar, typename Coupling, typename Math>
+    constexpr size_t BasicRhexControllerHopf<Legs, Scalar, Coupling, Math>::legs;
+
+    template <size_t Legs, typename Scalar, typename Coupling, typename Math>
+    constexpr size_t BasicRhexControllerHopf<Legs, Scalar, Coupling, Math>::lanes;
+
+    template <size_t Legs, typename Scalar, typename Coupling, typename Math>
+    constexpr size_t BasicRhexControllerHopf<Legs, Scalar, Coupling, Math>::ctrl_size;
+
+    typedef BasicRhexControllerHopf<> RhexControllerHopf;
 }
 
 #endif
@@ -0,0 +1,332 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_HOPF_BATCHED_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_HOPF_BATCHED_HPP
+
+#include <cassert>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_hopf.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+
+// Population version of the Hopf controller: N independent oscillator networks
+// integrated together. As in rhex_controller_batched.hpp every value is stored
+// leg-major, value[leg * size() + n], so that each loop runs across the networks
+// and vectorizes. Only the edges used by at least one network are integrated.
+// pos_batch() writes an N x 6 row-major matrix: out[n * 6 + leg].
+// With broken legs (one list per genome) only the live legs are stored and
+// integrated, numbered by BatchedLegIndex, and the targets of broken legs are 0.
+
+namespace rhex_controller {
+
+    class BatchedHopfController {
+    public:
+        static constexpr size_t legs = RhexControllerHopf::legs;
+
+        BatchedHopfController() : _size(0), _last_time(0) {}
+
+        // broken_legs[n] lists the broken legs of genome n, or is empty when none is
+        BatchedHopfController(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            set_parameters(ctrls, broken_legs);
+        }
+
+        void set_parameters(const std::vector<std::vector<double> >& ctrls,
+            const std::vector<std::vector<int> >& broken_legs = std::vector<std::vector<int> >())
+        {
+            _size = ctrls.size();
+            _last_time = 0;
+            _index.assign(_size, broken_legs);
+
+            // decode every genome with the single controller so both stay in sync,
+            // including the coupling re-derived for the live legs
+            std::vector<RhexControllerHopf> nets;
+            nets.reserve(_size);
+            for (size_t n = 0; n < _size; ++n)
+            {
+                nets.push_back(RhexControllerHopf(ctrls[n]));
+                if (!broken_legs.empty())
+                    nets.back().set_broken(broken_legs[n]);
+            }
+
+            _edges.clear();
+            for (size_t j = 0; j < legs; ++j)
+            {
+                for (size_t i = 0; i < legs; ++i)
+                {
+                    for (size_t n = 0; n < _size; ++n)
+                    {
+                        if (coupling_u(nets[n], i, j) != 0 || coupling_v(nets[n], i, j) != 0)
+                        {
+                            _edges.push_back(std::make_pair(i, j));
+                            break;
+                        }
+                    }
+                }
+            }
+
+            size_t slots = _index.slots();
+            _A.assign(slots, 0);
+            _omega.assign(slots, 0);
+            _k.assign(slots, 0);
+            _stance_angle.assign(slots, 0);
+            _stance_offset.assign(slots, 0);
+
+            _u.assign(slots, 0);
+            _v.assign(slots, 0);
+            _du.assign(slots, 0);
+            _dv.assign(slots, 0);
+            _scratch.assign(slots, 0);
+            _swing.assign(slots, 0);
+            _counter.assign(slots, 0);
+            _motor_input.assign(slots, 0);
+
+            // edge e covers the slots of its leg i, pulled by the slots of leg j of
+            // the same genomes: contiguous when leg j is live wherever leg i is
+            _edge_first.clear();
+            _edge_aligned.clear();
+            _edge_source.clear();
+            _coupling_u.clear();
+            _coupling_v.clear();
+            for (size_t e = 0; e < _edges.size(); ++e)
+            {
+                size_t i = _edges[e].first;
+                size_t j = _edges[e].second;
+                _edge_first.push_back(_coupling_u.size());
+                _edge_aligned.push_back(_index.count(i) == _size && _index.count(j) == _size);
+
+                for (size_t k = _index.offset(i); k < _index.offset(i) + _index.count(i); ++k)
+                {
+                    size_t n = _index.genome(k);
+                    int source = _index.slot(j, n);
+                    // a broken source has a zero weight, any live slot will do
+                    _edge_source.push_back(source >= 0 ? source : k);
+                    _coupling_u.push_back(coupling_u(nets[n], i, j));
+                    _coupling_v.push_back(coupling_v(nets[n], i, j));
+                }
+            }
+
+            for (size_t k = 0; k < slots; ++k)
+            {
+                size_t n = _index.genome(k);
+                const RhexControllerHopf& net = nets[n];
+
+                _A[k] = net.amplitude();
+                _omega[k] = 2 * pi * net.frequency();
+                _k[k] = net.convergence();
+                _stance_angle[k] = net.stance_angle();
+                _stance_offset[k] = net.stance_offset();
+            }
+
+            for (size_t i = 0; i < legs; ++i)
+            {
+                for (size_t k = _index.offset(i); k < _index.offset(i) + _index.count(i); ++k)
+                {
+                    _u[k] = nets[_index.genome(k)].parameters()[i];
+                    _v[k] = nets[_index.genome(k)].parameters()[RhexControllerHopf::lanes + i];
+                }
+            }
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        const BatchedLegIndex<legs>& leg_index() const
+        {
+            return _index;
+        }
+
+        void pos_batch(double t, std::vector<double>& out)
+        {
+            if (out.size() != legs * _size)
+                out.resize(legs * _size);
+            pos_batch(t, out.data());
+        }
+
+        // out must hold size() * 6 values, broken legs get 0
+        void pos_batch(double t, double* out)
+        {
+            double dt = t - _last_time;
+            _last_time = t;
+
+            amp_couple_update(dt);
+
+            const double* A = _A.data();
+            const double* stance_angle = _stance_angle.data();
+            const double* stance_offset = _stance_offset.data();
+            const double* u = _u.data();
+            const double* swing = _swing.data();
+            const size_t* output = _index.output().data();
+            double* land = _scratch.data();
+            double* counter = _counter.data();
+            double* motor_input = _motor_input.data();
+            size_t slots = _index.slots();
+
+            // same monotonous motor input as RhexControllerHopf::pos, with the
+            // 2 * pi wrap-around loop replaced by its closed form. Each loop touches
+            // few enough arrays for the compiler to vectorize it.
+            for (size_t k = 0; k < slots; ++k)
+            {
+                counter[k] += (u[k] <= -1) ? 1 : 0;
+
+                double stance = (stance_angle[k] * pi) * (1 + u[k] / A[k]);
+                double flight = (2 * pi) - (1 - stance_angle[k] * pi) * (1 + u[k] / A[k]);
+                land[k] = (swing[k] != 0) ? flight : stance;
+            }
+
+            for (size_t k = 0; k < slots; ++k)
+            {
+                double x = land[k];
+                if (x < motor_input[k])
+                    x = x + counter[k] * 2 * pi;
+
+                double jump = x - motor_input[k];
+                if (jump > 6)
+                    x = x - ceil((jump - 6) / (2 * pi)) * 2 * pi;
+
+                motor_input[k] = x + stance_offset[k] * 2 * pi;
+            }
+
+            // legs no genome misses keep the strided stores of the undamaged layout
+            for (size_t i = 0; i < legs; ++i)
+            {
+                size_t first = _index.offset(i);
+                size_t count = _index.count(i);
+                const double* input = motor_input + first;
+
+                if (count == _size)
+                {
+                    for (size_t n = 0; n < count; ++n)
+                        out[n * legs + i] = input[n];
+                }
+                else
+                {
+                    for (size_t n = 0; n < count; ++n)
+                        out[output[first + n]] = input[n];
+                }
+            }
+
+            for (size_t b : _index.broken_output())
+                out[b] = 0;
+        }
+
+        void amp_couple_update(double dt)
+        {
+            const double* A = _A.data();
+            const double* omega = _omega.data();
+            const double* k = _k.data();
+            size_t slots = _index.slots();
+
+            {
+                const double* u = _u.data();
+                const double* v = _v.data();
+                double* r = _scratch.data();
+                double* du = _du.data();
+                double* dv = _dv.data();
+
+                for (size_t m = 0; m < slots; ++m)
+                    r[m] = k[m] * (A[m] * A[m] - u[m] * u[m] - v[m] * v[m]);
+
+                for (size_t m = 0; m < slots; ++m)
+                {
+                    du[m] = r[m] * u[m] - omega[m] * v[m];
+                    dv[m] = r[m] * v[m] + omega[m] * u[m];
+                }
+            }
+
+            for (size_t e = 0; e < _edges.size(); ++e)
+            {
+                size_t i = _edges[e].first;
+                size_t count = _index.count(i);
+                const double* cu = &_coupling_u[_edge_first[e]];
+                const double* cv = &_coupling_v[_edge_first[e]];
+                double* dv = &_dv[_index.offset(i)];
+
+                if (_edge_aligned[e])
+                {
+                    const double* u = &_u[_index.offset(_edges[e].second)];
+                    const double* v = &_v[_index.offset(_edges[e].second)];
+
+                    for (size_t n = 0; n < count; ++n)
+                        dv[n] += cu[n] * u[n] + cv[n] * v[n];
+                }
+                else
+                {
+                    const size_t* source = &_edge_source[_edge_first[e]];
+
+                    for (size_t n = 0; n < count; ++n)
+                        dv[n] += cu[n] * _u[source[n]] + cv[n] * _v[source[n]];
+                }
+            }
+
+            double* u = _u.data();
+            double* v = _v.data();
+            double* swing = _swing.data();
+            const double* du = _du.data();
+            const double* dv = _dv.data();
+
+            for (size_t m = 0; m < slots; ++m)
+            {
+                u[m] += du[m] * dt;
+                v[m] += dv[m] * dt;
+
+                if (u[m] >= 1)
+                    swing[m] = 1;
+                if (u[m] <= -1)
+                    swing[m] = 0;
+            }
+        }
+
+    protected:
+        // coupling terms of the edge from leg j to leg i of a network, 0 without one
+        static double coupling_u(const RhexControllerHopf& net, size_t i, size_t j)
+        {
+            const RhexControllerHopf::network_t::graph_t& graph = net.network().graph();
+            size_t e = graph.find(i, j);
+            return (e < graph.edges()) ? graph.weight_sin(e) : 0;
+        }
+
+        static double coupling_v(const RhexControllerHopf& net, size_t i, size_t j)
+        {
+            const RhexControllerHopf::network_t::graph_t& graph = net.network().graph();
+            size_t e = graph.find(i, j);
+            return (e < graph.edges()) ? graph.weight_cos(e) : 0;
+        }
+
+        size_t _size;
+        double _last_time;
+        BatchedLegIndex<legs> _index;
+
+        // network parameters, repeated for each live leg of the network
+        std::vector<double> _A;
+        std::vector<double> _omega;
+        std::vector<double> _k;
+        std::vector<double> _stance_angle;
+        std::vector<double> _stance_offset;
+
+        // (i, j) pairs, oscillator j pulls on oscillator i. For the slot s of leg i at
+        // _edge_first[e] + s - offset(i), the weights are _coupling_u and _coupling_v
+        // and the slot of leg j is _edge_source (offset(j) + s - offset(i) when aligned)
+        std::vector<std::pair<size_t, size_t> > _edges;
+        std::vector<size_t> _edge_first;
+        std::vector<bool> _edge_aligned;
+        std::vector<size_t> _edge_source;
+        std::vector<double> _coupling_u;
+        std::vector<double> _coupling_v;
+
+        // per live leg state
+        std::vector<double> _u;
+        std::vector<double> _v;
+        std::vector<double> _du;
+        std::vector<double> _dv;
+        std::vector<double> _scratch;
+        std::vector<double> _swing;
+        std::vector<double> _counter;
+        std::vector<double> _motor_input;
+    };
+} // namespace rhex_controller
+
+#endif
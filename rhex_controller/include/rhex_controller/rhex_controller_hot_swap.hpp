@@ -0,0 +1,257 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_HOT_SWAP_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_HOT_SWAP_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+// Parameter updates for a controller that is running in another thread.
+//
+// HotSwapController keeps four copies of the controller. The control thread
+// calls pos() on the front copy; a learning thread prepares a new gait in the
+// back copy (publish() calls set_parameters or assigns a whole controller there,
+// so any allocation happens on its side) and publishes it with one atomic
+// exchange. pos() picks up the latest published copy on its next tick with
+// another exchange: it never waits for the publisher and never allocates.
+// The fourth copy keeps the previous gait alive while the two are blended.
+//
+// A new gait is picked up at the phase the old one is in: set_gait_phase() moves it
+// to the gait_phase() of the old gait at that tick (the reference leg at the same
+// position of its cycle, in the period of the new gait; Hopf and CPG turn their
+// oscillators together, from their limit cycle). Its leg angles are then shifted by
+// whole turns to the revolution the legs are in. Republishing the parameters the
+// running gait was published with leaves it alone (the oscillators of Hopf and CPG
+// keep their state, which a warm start would move to its locked cycle), unless the
+// previous publication has not been picked up yet.
+// If the blend window is not 0, what is left of the difference between the gaits
+// is blended out over that window (smoothstep weights, both gaits are stepped).
+// Publications made while a blend is running wait for it to finish; only the
+// latest one is kept.
+//
+// pos() must be called from one thread only, publish() from any number.
+
+namespace rhex_controller {
+
+    template <typename Controller>
+    class HotSwapController {
+    public:
+        typedef Controller controller_t;
+        typedef typename Controller::output_t output_t;
+        typedef typename Controller::scalar_t scalar_t;
+
+        static constexpr size_t legs = Controller::legs;
+
+        // blend_window in seconds of controller time, 0 switches at once
+        HotSwapController(const Controller& controller, double blend_window = 0)
+            : _middle(1), _back(0), _front(2), _spare(3), _blend_window(blend_window),
+              _origin(0), _old_origin(0), _blend_start(0), _blending(false), _swaps(0)
+        {
+            _slots.fill(controller);
+            _keep.fill(false);
+            _shift.fill(0);
+            _old_shift.fill(0);
+        }
+
+        // starts with a controller running these parameters, which republishing keeps
+        HotSwapController(const std::vector<double>& ctrl, double blend_window = 0)
+            : HotSwapController(Controller(ctrl), blend_window)
+        {
+            _published = ctrl;
+        }
+
+        HotSwapController(const HotSwapController&) = delete;
+        HotSwapController& operator=(const HotSwapController&) = delete;
+
+        // publisher side: the next tick switches to a controller with these parameters,
+        // started on its limit cycle if it has one (warm_start()). The running gait is
+        // kept if it was published with the same parameters and has been picked up.
+        void publish(const std::vector<double>& ctrl)
+        {
+            std::lock_guard<std::mutex> lock(_publisher);
+            _keep[_back] = !pending() && ctrl == _published;
+            if (!_keep[_back])
+            {
+                _slots[_back].set_parameters(ctrl);
+                warm_start(_slots[_back], 0);
+                _published = ctrl;
+            }
+            _back = _middle.exchange(_back | fresh, std::memory_order_acq_rel) & index;
+        }
+
+        // publisher side: the next tick switches to a copy of controller (other settings
+        // such as the integrator or the broken legs included), set up as after
+        // set_parameters: its clock starts again at 0. An oscillator controller keeps
+        // the relative phases it has, e.g. the converged ones of a WarmStartCache.
+        void publish(const Controller& controller)
+        {
+            std::lock_guard<std::mutex> lock(_publisher);
+            _slots[_back] = controller;
+            _keep[_back] = false;
+            _published.clear();
+            _back = _middle.exchange(_back | fresh, std::memory_order_acq_rel) & index;
+        }
+
+        // publisher side: whether the last publication has not been picked up yet
+        bool pending() const
+        {
+            return _middle.load(std::memory_order_acquire) & fresh;
+        }
+
+        void set_blend_window(double blend_window)
+        {
+            _blend_window = blend_window;
+        }
+
+        double blend_window() const
+        {
+            return _blend_window;
+        }
+
+        std::vector<double> pos(double t)
+        {
+            output_t output;
+            pos(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
+
+        // control thread side
+        void pos(double t, output_t& output)
+        {
+            if (!_blending && (_middle.load(std::memory_order_acquire) & fresh))
+            {
+                swap(t, output);
+                return;
+            }
+
+            _slots[_front].pos(t - _origin, output);
+            for (size_t i = 0; i < legs; ++i)
+                output[i] += _shift[i];
+
+            if (!_blending)
+                return;
+
+            double x = (t - _blend_start) / _blend_window;
+            if (x >= 1)
+            {
+                _blending = false;
+                return;
+            }
+
+            _slots[_spare].pos(t - _old_origin, _old);
+            scalar_t w = scalar_t(x * x * (3 - 2 * x));
+            for (size_t i = 0; i < legs; ++i)
+            {
+                scalar_t old = _old[i] + _old_shift[i];
+                output[i] = old + w * (output[i] - old);
+            }
+        }
+
+        // control thread side: the controller driving the legs
+        const Controller& current() const
+        {
+            return _slots[_front];
+        }
+
+        bool blending() const
+        {
+            return _blending;
+        }
+
+        // number of publications picked up by pos()
+        size_t swaps() const
+        {
+            return _swaps;
+        }
+
+    protected:
+        static constexpr unsigned fresh = 4;
+        static constexpr unsigned index = 3;
+
+        // controllers with warm_start() (Hopf, CPG) start on their limit cycle
+        template <typename C>
+        static auto warm_start(C& controller, int) -> decltype(controller.warm_start(), void())
+        {
+            controller.warm_start();
+        }
+
+        template <typename C>
+        static void warm_start(C&, long) {}
+
+        // switches to the published controller, output gets the targets of this tick
+        void swap(double t, output_t& output)
+        {
+            // the idle spare goes back to the publisher
+            unsigned next = _middle.exchange(_spare, std::memory_order_acq_rel) & index;
+            ++_swaps;
+
+            // targets of the old gait at this tick, before it is replaced
+            _slots[_front].pos(t - _origin, _old);
+            for (size_t i = 0; i < legs; ++i)
+                _old[i] += _shift[i];
+
+            // a republication of the running gait is dropped into the spare
+            if (_keep[next])
+            {
+                _spare = next;
+                output = _old;
+                return;
+            }
+
+            // the old front becomes the spare
+            double phase = _slots[_front].gait_phase();
+            _spare = _front;
+            _front = next;
+            _old_origin = _origin;
+            _old_shift = _shift;
+            _origin = t;
+
+            // the new gait (whose clock, t - origin, starts at 0 as after set_parameters)
+            // carries on from the phase of the old one, in the revolution the legs are in
+            _slots[_front].set_gait_phase(phase);
+            _slots[_front].pos(0, output);
+            for (size_t i = 0; i < legs; ++i)
+            {
+                _shift[i] = scalar_t(std::round(double((_old[i] - output[i]) / (2 * Controller::pi)))) * 2 * Controller::pi;
+                output[i] += _shift[i];
+            }
+
+            _blending = _blend_window > 0;
+            _blend_start = t;
+            // the blend starts from the old targets
+            if (_blending)
+                output = _old;
+        }
+
+        std::array<Controller, 4> _slots;
+        // slot published last (index | fresh until picked up)
+        std::atomic<unsigned> _middle;
+        // publisher slot
+        unsigned _back;
+        // control thread slots
+        unsigned _front;
+        unsigned _spare;
+        std::mutex _publisher;
+        // parameters of the last publish(ctrl), and whether each slot republishes them
+        std::vector<double> _published;
+        std::array<bool, 4> _keep;
+
+        double _blend_window;
+        // controller times are t - origin
+        double _origin;
+        double _old_origin;
+        double _blend_start;
+        bool _blending;
+        size_t _swaps;
+        output_t _shift;
+        output_t _old_shift;
+        output_t _old;
+    };
+
+    template <typename Controller>
+    constexpr size_t HotSwapController<Controller>::legs;
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_INTEGRATOR_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_INTEGRATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+// ODE integration schemes shared by the oscillator based controllers (Hopf, CPG).
+// A System only has to provide
+//     void derivative(const State& x, State& dx) const
+// for a fixed-size State (std::array), so no step ever touches the heap.
+// Every step returns the number of derivative evaluations it used.
+
+namespace rhex_controller {
+
+    enum class Integrator {
+        EULER,         // explicit forward Euler, 1 evaluation
+        SEMI_IMPLICIT, // scheme specific to each controller, see their semi_implicit_step()
+        RK4,           // classic 4th order Runge-Kutta, 4 evaluations
+        RK45           // adaptive Dormand-Prince 5(4) with error control
+    };
+
+    template <typename System, typename State>
+    size_t euler_step(const System& sys, State& x, double dt)
+    {
+        State dx;
+        sys.derivative(x, dx);
+
+        for (size_t i = 0; i < x.size(); ++i)
+            x[i] += dx[i] * dt;
+
+        return 1;
+    }
+
+    template <typename System, typename State>
+    size_t rk4_step(const System& sys, State& x, double dt)
+    {
+        State k1, k2, k3, k4, y;
+
+        sys.derivative(x, k1);
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = x[i] + 0.5 * dt * k1[i];
+
+        sys.derivative(y, k2);
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = x[i] + 0.5 * dt * k2[i];
+
+        sys.derivative(y, k3);
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = x[i] + dt * k3[i];
+
+        sys.derivative(y, k4);
+        for (size_t i = 0; i < x.size(); ++i)
+            x[i] += dt / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+
+        return 4;
+    }
+
+    template <typename State>
+    bool all_finite(const State& x)
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+            if (!std::isfinite(x[i]))
+                return false;
+        return true;
+    }
+
+    // Integrates x over dt with as many Dormand-Prince steps as the tolerance
+    // requires. h is the step size suggestion, carried over between calls so that
+    // a smooth limit cycle is crossed with few, large steps. It never goes below
+    // 1e-9 dt, and a state that is not finite is left as it is (the system diverged,
+    // smaller steps would never get it over dt).
+    template <typename System, typename State>
+    size_t rk45_step(const System& sys, State& x, double dt, double& h, double tolerance)
+    {
+        // Dormand-Prince tableau, the systems are autonomous so the c nodes are not needed
+        static const double a21 = 1. / 5;
+        static const double a31 = 3. / 40, a32 = 9. / 40;
+        static const double a41 = 44. / 45, a42 = -56. / 15, a43 = 32. / 9;
+        static const double a51 = 19372. / 6561, a52 = -25360. / 2187, a53 = 64448. / 6561, a54 = -212. / 729;
+        static const double a61 = 9017. / 3168, a62 = -355. / 33, a63 = 46732. / 5247, a64 = 49. / 176, a65 = -5103. / 18656;
+        static const double b1 = 35. / 384, b3 = 500. / 1113, b4 = 125. / 192, b5 = -2187. / 6784, b6 = 11. / 84;
+        // difference between the 5th and the embedded 4th order weights
+        static const double e1 = 71. / 57600, e3 = -71. / 16695, e4 = 71. / 1920, e5 = -17253. / 339200, e6 = 22. / 525, e7 = -1. / 40;
+
+        size_t evaluations = 0;
+        if (dt <= 0 || !all_finite(x))
+            return evaluations;
+
+        if (h <= 0)
+            h = dt;
+
+        State k1, k2, k3, k4, k5, k6, k7, y, x_new;
+        sys.derivative(x, k1);
+        ++evaluations;
+
+        double remaining = dt;
+        while (remaining > 0)
+        {
+            double step = std::min(h, remaining);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = x[i] + step * a21 * k1[i];
+            sys.derivative(y, k2);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = x[i] + step * (a31 * k1[i] + a32 * k2[i]);
+            sys.derivative(y, k3);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = x[i] + step * (a41 * k1[i] + a42 * k2[i] + a43 * k3[i]);
+            sys.derivative(y, k4);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = x[i] + step * (a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i]);
+            sys.derivative(y, k5);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = x[i] + step * (a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] + a65 * k5[i]);
+            sys.derivative(y, k6);
+
+            for (size_t i = 0; i < x.size(); ++i)
+                x_new[i] = x[i] + step * (b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i]);
+            sys.derivative(x_new, k7);
+            evaluations += 6;
+
+            // scaled max norm of the local error estimate. std::max would drop a NaN,
+            // so a step that diverged gets an infinite error and is shrunk
+            double error = 0;
+            for (size_t i = 0; i < x.size(); ++i)
+            {
+                double e = step * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i]);
+                if (!std::isfinite(e) || !std::isfinite(x_new[i]))
+                {
+                    error = std::numeric_limits<double>::infinity();
+                    break;
+                }
+                double scale = tolerance * (1 + std::max(std::fabs(x[i]), std::fabs(x_new[i])));
+                error = std::max(error, std::fabs(e) / scale);
+            }
+
+            // accept the step if it is within tolerance, or if it cannot get any smaller
+            // (a state that is not finite even then comes from the system itself)
+            if (error <= 1 || step <= 1e-9 * dt)
+            {
+                x = x_new;
+                k1 = k7; // first same as last
+                remaining -= step;
+                if (!all_finite(x))
+                    return evaluations;
+            }
+
+            double factor = (error > 0) ? 0.9 * std::pow(error, -0.2) : 5;
+            factor = std::min(5., std::max(0.2, factor));
+
+            // do not let the suggestion collapse because of the last, shortened step
+            if (step == h || error > 1)
+                h = std::max(step * factor, 1e-9 * dt);
+        }
+
+        return evaluations;
+    }
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_LEG_MASK_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_LEG_MASK_HPP
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_coupling.hpp>
+
+// Damaged robots. A broken leg is left out of the controller's computation and
+// of its coupling network, and its target in the output is 0. Broken legs are
+// given, as in RhexControllerSimple, as a list of leg indices.
+
+namespace rhex_controller {
+
+    // live legs of one robot, with the compact numbering of the live legs
+    template <size_t Legs>
+    class LegMask {
+    public:
+        static_assert(Legs <= 32, "LegMask holds up to 32 legs");
+
+        LegMask()
+        {
+            set_broken(std::vector<int>());
+        }
+
+        LegMask(const std::vector<int>& broken_legs)
+        {
+            set_broken(broken_legs);
+        }
+
+        void set_broken(const std::vector<int>& broken_legs)
+        {
+            _bits = (Legs == 32) ? ~uint32_t(0) : (uint32_t(1) << Legs) - 1;
+            for (int leg : broken_legs)
+            {
+                assert(leg >= 0 && size_t(leg) < Legs);
+                _bits &= ~(uint32_t(1) << leg);
+            }
+
+            _count = 0;
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                _index[i] = live(i) ? int(_count) : -1;
+                if (live(i))
+                    _live[_count++] = i;
+            }
+        }
+
+        bool live(size_t leg) const
+        {
+            return (_bits >> leg) & 1;
+        }
+
+        bool all_live() const
+        {
+            return _count == Legs;
+        }
+
+        // bit i set when leg i is live
+        uint32_t bits() const
+        {
+            return _bits;
+        }
+
+        size_t live_count() const
+        {
+            return _count;
+        }
+
+        // leg of the k-th live leg
+        size_t leg(size_t k) const
+        {
+            return _live[k];
+        }
+
+        // k such that leg(k) == leg, -1 for a broken leg
+        int index(size_t leg) const
+        {
+            return _index[leg];
+        }
+
+        // 1 for the live legs and 0 for the broken ones, to mask vectorized leg loops
+        template <typename Scalar>
+        void weights(std::array<Scalar, Legs>& w) const
+        {
+            for (size_t i = 0; i < Legs; ++i)
+                w[i] = live(i) ? 1 : 0;
+        }
+
+        std::vector<int> broken_legs() const
+        {
+            std::vector<int> broken;
+            for (size_t i = 0; i < Legs; ++i)
+                if (!live(i))
+                    broken.push_back(i);
+            return broken;
+        }
+
+    protected:
+        uint32_t _bits;
+        size_t _count;
+        std::array<size_t, Legs> _live;
+        std::array<int, Legs> _index;
+    };
+
+    // Restricts a coupling network (phase biases as in rhex_controller_coupling.hpp,
+    // weights 0 where j does not pull on i) to the live legs:
+    //   - the edges of broken legs are removed
+    //   - if that splits the live legs into several groups, each group is linked
+    //     both ways to the first one, with the phase bias the full network implies
+    //     between the two legs
+    //   - the weights pulling on each live leg are rescaled so that the sum of its
+    //     incoming weights is the one it had in the full network
+    // so the remaining oscillators still lock into the same relative phases.
+    template <size_t Legs, typename Scalar>
+    void live_coupling(const LegMask<Legs>& mask, std::array<std::array<Scalar, Legs>, Legs>& bias,
+        std::array<std::array<Scalar, Legs>, Legs>& weights)
+    {
+        if (mask.all_live())
+            return;
+
+        // phase of every leg implied by the full network
+        std::array<double, Legs> phase;
+        implied_phases(bias, weights, phase);
+
+        std::array<Scalar, Legs> total;
+        Scalar mean = 0;
+        size_t edges = 0;
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            total[i] = 0;
+            for (size_t j = 0; j < Legs; ++j)
+            {
+                total[i] += weights[i][j];
+                if (weights[i][j] != 0)
+                {
+                    mean += weights[i][j];
+                    ++edges;
+                }
+            }
+        }
+        mean = edges ? mean / edges : 0;
+
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            for (size_t j = 0; j < Legs; ++j)
+            {
+                if (!mask.live(i) || !mask.live(j))
+                {
+                    weights[i][j] = 0;
+                    bias[i][j] = Scalar(no_coupling);
+                }
+            }
+        }
+
+        // groups of live legs still connected (either direction)
+        std::array<int, Legs> group;
+        group.fill(-1);
+        int groups = 0;
+        std::array<size_t, Legs> first;
+        for (size_t k = 0; k < mask.live_count(); ++k)
+        {
+            size_t root = mask.leg(k);
+            if (group[root] >= 0)
+                continue;
+            first[groups] = root;
+            group[root] = groups;
+
+            std::array<size_t, Legs> queue;
+            size_t head = 0, tail = 0;
+            queue[tail++] = root;
+            while (head < tail)
+            {
+                size_t i = queue[head++];
+                for (size_t j = 0; j < Legs; ++j)
+                {
+                    if (group[j] < 0 && mask.live(j) && (weights[i][j] != 0 || weights[j][i] != 0))
+                    {
+                        group[j] = groups;
+                        queue[tail++] = j;
+                    }
+                }
+            }
+            ++groups;
+        }
+
+        if (edges)
+        {
+            size_t a = first[0];
+            for (int g = 1; g < groups; ++g)
+            {
+                size_t b = first[g];
+                weights[a][b] = weights[b][a] = mean;
+                bias[a][b] = Scalar(std::remainder(phase[b] - phase[a], 2 * pi));
+                bias[b][a] = -bias[a][b];
+            }
+        }
+
+        for (size_t i = 0; i < Legs; ++i)
+        {
+            Scalar sum = 0;
+            for (size_t j = 0; j < Legs; ++j)
+                sum += weights[i][j];
+            if (sum == 0 || total[i] == 0)
+                continue;
+            for (size_t j = 0; j < Legs; ++j)
+                weights[i][j] *= total[i] / sum;
+        }
+    }
+
+    // Compact numbering of the live (leg, genome) pairs of a population, for the
+    // batched controllers. Pairs are numbered leg-major, and within a leg by genome,
+    // so the values of one leg stay contiguous: with no broken leg, slot
+    // leg * size + n, as in the undamaged layout.
+    template <size_t Legs>
+    class BatchedLegIndex {
+    public:
+        BatchedLegIndex() : _size(0) {}
+
+        // broken_legs[n] for genome n, or empty for an undamaged population
+        void assign(size_t size, const std::vector<std::vector<int> >& broken_legs)
+        {
+            assert(broken_legs.empty() || broken_legs.size() == size);
+            _size = size;
+            _masks.assign(size, LegMask<Legs>());
+            for (size_t n = 0; n < broken_legs.size(); ++n)
+                _masks[n].set_broken(broken_legs[n]);
+
+            _genome.clear();
+            _output.clear();
+            _broken_output.clear();
+            _slot.assign(Legs * size, -1);
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                _offset[i] = _genome.size();
+                for (size_t n = 0; n < size; ++n)
+                {
+                    if (_masks[n].live(i))
+                    {
+                        _slot[i * size + n] = _genome.size();
+                        _genome.push_back(n);
+                        _output.push_back(n * Legs + i);
+                    }
+                    else
+                        _broken_output.push_back(n * Legs + i);
+                }
+                _count[i] = _genome.size() - _offset[i];
+            }
+        }
+
+        // number of genomes
+        size_t size() const
+        {
+            return _size;
+        }
+
+        // number of live pairs
+        size_t slots() const
+        {
+            return _genome.size();
+        }
+
+        bool damaged() const
+        {
+            return !_broken_output.empty();
+        }
+
+        const LegMask<Legs>& mask(size_t n) const
+        {
+            return _masks[n];
+        }
+
+        // the slots of leg i are [offset(i), offset(i) + count(i))
+        size_t offset(size_t leg) const
+        {
+            return _offset[leg];
+        }
+
+        size_t count(size_t leg) const
+        {
+            return _count[leg];
+        }
+
+        size_t genome(size_t slot) const
+        {
+            return _genome[slot];
+        }
+
+        // slot of the pair, -1 if the leg is broken in that genome
+        int slot(size_t leg, size_t n) const
+        {
+            return _slot[leg * _size + n];
+        }
+
+        // index of each slot, and of each broken pair, in an N x Legs row-major output
+        const std::vector<size_t>& output() const
+        {
+            return _output;
+        }
+
+        const std::vector<size_t>& broken_output() const
+        {
+            return _broken_output;
+        }
+
+    protected:
+        size_t _size;
+        std::vector<LegMask<Legs> > _masks;
+        std::array<size_t, Legs> _offset;
+        std::array<size_t, Legs> _count;
+        std::vector<size_t> _genome;
+        std::vector<int> _slot;
+        std::vector<size_t> _output;
+        std::vector<size_t> _broken_output;
+    };
+} // namespace rhex_controller
+
+#endif
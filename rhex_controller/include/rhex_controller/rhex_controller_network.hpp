@@ -0,0 +1,434 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_NETWORK_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_NETWORK_HPP
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_coupling.hpp>
+#include <rhex_controller/rhex_controller_math.hpp>
+
+// Networks of coupled oscillators of any size and topology: legs, body joints, or
+// both. The coupling graph is stored in compressed sparse rows (CSR), the edges
+// pulling on each node next to each other, so a derivative costs one term per node
+// plus one per edge. RhexControllerHopf and RhexControllerCPG are both such a network
+// of one oscillator per leg.
+//
+// OscillatorNetwork<Oscillator, Size> holds the parameters of Size nodes and their
+// CouplingGraph, and provides
+//     void derivative(const state_t& x, state_t& dx) const
+// so any integrator of rhex_controller_integrator.hpp steps it:
+//
+//     OscillatorNetwork<KuramotoOscillator, 8> network;
+//     network.set_coupling(bias, weights); // 8 x 8, no_coupling where there is no edge
+//     OscillatorNetwork<KuramotoOscillator, 8>::state_t x = {};
+//     rk4_step(network, x, 0.001);
+//
+// The state of an oscillator with several variables is stored variable by variable,
+// Size values each (e.g. Hopf: u of every node, then v of every node). Size may be
+// more than the nodes of the graph (padding, so that the loops over nodes fill whole
+// vector registers): the extra nodes have no edges and stay at rest at 0.
+//
+// Edge e of the graph pulls node target on node source with weight w and phase bias
+// b, the phase the target keeps with the source as in rhex_controller_coupling.hpp.
+// Three oscillators are provided (see each of them):
+//   - KuramotoOscillator: a phase, dtheta_i = omega_i + sum_e w sin(theta_j - theta_i - b)
+//   - HopfOscillator: a limit cycle of radius amplitude in the (u, v) plane, pulled by
+//     the neighbours rotated by b
+//   - MatsuokaOscillator: a pair of mutually inhibiting neurons with adaptation,
+//     coupled through their outputs, with a sign given by b (in phase or antiphase)
+
+namespace rhex_controller {
+
+    // CSR coupling graph: the edges pulling on node i are [begin(i), end(i)), sorted
+    // by source. weight_sin and weight_cos (w sin(b), w cos(b)) are computed once
+    // here for the oscillators that rotate their neighbours.
+    template <typename Scalar = double, typename Math = StdMath>
+    class CouplingGraph {
+    public:
+        struct Edge {
+            size_t target;
+            size_t source;
+            Scalar weight;
+            Scalar bias;
+        };
+
+        CouplingGraph(size_t nodes = 0)
+        {
+            assign(nodes, std::vector<Edge>());
+        }
+
+        CouplingGraph(size_t nodes, const std::vector<Edge>& edges)
+        {
+            assign(nodes, edges);
+        }
+
+        // edges in any order, at most one per target and source
+        void assign(size_t nodes, std::vector<Edge> edges)
+        {
+            std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+                return a.target != b.target ? a.target < b.target : a.source < b.source;
+            });
+
+            _offset.assign(nodes + 1, 0);
+            _source.clear();
+            _weight.clear();
+            _bias.clear();
+            _weight_sin.clear();
+            _weight_cos.clear();
+
+            for (size_t e = 0; e < edges.size(); ++e)
+            {
+                const Edge& edge = edges[e];
+                if (edge.target >= nodes || edge.source >= nodes)
+                    throw std::runtime_error("CouplingGraph: edge between nodes out of range");
+                if (e > 0 && edge.target == edges[e - 1].target && edge.source == edges[e - 1].source)
+                    throw std::runtime_error("CouplingGraph: duplicate edge");
+
+                ++_offset[edge.target + 1];
+                _source.push_back(uint32_t(edge.source));
+                _weight.push_back(edge.weight);
+                _bias.push_back(edge.bias);
+                _weight_sin.push_back(edge.weight * Math::sin(edge.bias));
+                _weight_cos.push_back(edge.weight * Math::cos(edge.bias));
+            }
+
+            for (size_t i = 0; i < nodes; ++i)
+                _offset[i + 1] += _offset[i];
+        }
+
+        // From the dense matrices of the controllers: an edge of weight scale *
+        // weights[i][j] from j to i wherever weights[i][j] is not 0 and bias[i][j] is
+        // not no_coupling (the diagonal is skipped).
+        template <size_t Nodes, typename T>
+        void assign(const std::array<std::array<T, Nodes>, Nodes>& bias,
+            const std::array<std::array<T, Nodes>, Nodes>& weights, Scalar scale = 1)
+        {
+            std::vector<Edge> edges;
+            for (size_t i = 0; i < Nodes; ++i)
+            {
+                for (size_t j = 0; j < Nodes; ++j)
+                {
+                    if (i != j && weights[i][j] != 0 && bias[i][j] != T(no_coupling))
+                        edges.push_back(Edge{i, j, scale * Scalar(weights[i][j]), Scalar(bias[i][j])});
+                }
+            }
+            assign(Nodes, edges);
+        }
+
+        size_t nodes() const
+        {
+            return _offset.size() - 1;
+        }
+
+        size_t edges() const
+        {
+            return _source.size();
+        }
+
+        size_t begin(size_t i) const
+        {
+            return _offset[i];
+        }
+
+        size_t end(size_t i) const
+        {
+            return _offset[i + 1];
+        }
+
+        size_t source(size_t e) const
+        {
+            return _source[e];
+        }
+
+        Scalar weight(size_t e) const
+        {
+            return _weight[e];
+        }
+
+        Scalar bias(size_t e) const
+        {
+            return _bias[e];
+        }
+
+        Scalar weight_sin(size_t e) const
+        {
+            return _weight_sin[e];
+        }
+
+        Scalar weight_cos(size_t e) const
+        {
+            return _weight_cos[e];
+        }
+
+        // index of the edge from source to target, edges() if there is none
+        size_t find(size_t target, size_t source) const
+        {
+            for (size_t e = begin(target); e < end(target); ++e)
+                if (_source[e] == source)
+                    return e;
+            return edges();
+        }
+
+    protected:
+        std::vector<uint32_t> _offset;
+        std::vector<uint32_t> _source;
+        std::vector<Scalar> _weight;
+        std::vector<Scalar> _bias;
+        std::vector<Scalar> _weight_sin;
+        std::vector<Scalar> _weight_cos;
+    };
+
+    // Phase oscillators, dtheta_i/dt = omega_i + sum_e w sin(theta_j - theta_i - b).
+    // The rate of a single node is available for Gauss-Seidel sweeps.
+    struct KuramotoOscillator {
+        static constexpr size_t dimension = 1;
+
+        template <typename Scalar, size_t Size>
+        struct parameters_t {
+            parameters_t()
+            {
+                omega.fill(Scalar(2 * pi));
+            }
+
+            // natural frequency (rad/s)
+            std::array<Scalar, Size> omega;
+        };
+
+        template <typename Math, typename Scalar, size_t Size>
+        static Scalar rate(const parameters_t<Scalar, Size>& p, const CouplingGraph<Scalar, Math>& graph,
+            const Scalar* theta, size_t i)
+        {
+            Scalar rate = p.omega[i];
+            for (size_t e = graph.begin(i); e < graph.end(i); ++e)
+                rate += graph.weight(e) * Math::sin(theta[graph.source(e)] - theta[i] - graph.bias(e));
+            return rate;
+        }
+
+        template <typename Math, typename Scalar, size_t Size>
+        static void derivative(const parameters_t<Scalar, Size>& p, const CouplingGraph<Scalar, Math>& graph,
+            const Scalar* theta, Scalar* dtheta)
+        {
+            for (size_t i = 0; i < graph.nodes(); ++i)
+                dtheta[i] = rate(p, graph, theta, i);
+            for (size_t i = graph.nodes(); i < Size; ++i)
+                dtheta[i] = 0;
+        }
+
+        template <typename Scalar, size_t Size>
+        static Scalar output(const Scalar* theta, size_t i)
+        {
+            return theta[i];
+        }
+    };
+
+    // Hopf oscillators, state u then v:
+    //     du_i/dt = k_i (A_i^2 - r_i^2) u_i - omega_i v_i
+    //     dv_i/dt = k_i (A_i^2 - r_i^2) v_i + omega_i u_i + sum_e w (sin(b) u_j + cos(b) v_j)
+    // The radial part runs over all Size nodes at once, which the compiler vectorizes.
+    struct HopfOscillator {
+        static constexpr size_t dimension = 2;
+
+        template <typename Scalar, size_t Size>
+        struct parameters_t {
+            parameters_t()
+            {
+                convergence.fill(10);
+                amplitude.fill(1);
+                omega.fill(Scalar(2 * pi));
+            }
+
+            // k (1/s), 0 leaves the radius free
+            std::array<Scalar, Size> convergence;
+            std::array<Scalar, Size> amplitude;
+            // rad/s
+            std::array<Scalar, Size> omega;
+        };
+
+        template <typename Math, typename Scalar, size_t Size>
+        static void derivative(const parameters_t<Scalar, Size>& p, const CouplingGraph<Scalar, Math>& graph,
+            const Scalar* x, Scalar* dx)
+        {
+            const Scalar* u = x;
+            const Scalar* v = x + Size;
+            Scalar* du = dx;
+            Scalar* dv = dx + Size;
+
+            for (size_t i = 0; i < Size; ++i)
+            {
+                Scalar r = p.convergence[i] * (p.amplitude[i] * p.amplitude[i] - u[i]*u[i] - v[i]*v[i]);
+                du[i] = r * u[i] - p.omega[i] * v[i];
+                dv[i] = r * v[i] + p.omega[i] * u[i];
+            }
+
+            for (size_t i = 0; i < graph.nodes(); ++i)
+            {
+                for (size_t e = graph.begin(i); e < graph.end(i); ++e)
+                {
+                    size_t j = graph.source(e);
+                    dv[i] += graph.weight_sin(e) * u[j] + graph.weight_cos(e) * v[j];
+                }
+            }
+        }
+
+        template <typename Scalar, size_t Size>
+        static Scalar output(const Scalar* x, size_t i)
+        {
+            return x[i];
+        }
+    };
+
+    // Matsuoka oscillators: two neurons x1, x2 that inhibit each other, each with a
+    // fatigue v1, v2, state x1, x2, v1 then v2:
+    //     tau dx1/dt = -x1 - beta v1 - a y2 + s + c_i     y = max(x, 0)
+    //     tau dx2/dt = -x2 - beta v2 - a y1 + s - c_i
+    //     T dv1/dt = y1 - v1,  T dv2/dt = y2 - v2
+    // with c_i = sum_e w cos(b) (y1_j - y2_j): the neurons couple through their output
+    // y1 - y2, so only the sign of cos(b) matters for the phase (in phase or in
+    // antiphase) and the other biases only weaken the edge. The defaults oscillate at
+    // about 0.5 Hz; the frequency scales with 1 / tau.
+    struct MatsuokaOscillator {
+        static constexpr size_t dimension = 4;
+
+        template <typename Scalar, size_t Size>
+        struct parameters_t {
+            parameters_t()
+            {
+                tau.fill(Scalar(0.25));
+                adaptation_tau.fill(Scalar(0.5));
+                adaptation.fill(Scalar(2.5));
+                inhibition.fill(Scalar(2.5));
+                tonic.fill(1);
+            }
+
+            // tau and T (s)
+            std::array<Scalar, Size> tau;
+            std::array<Scalar, Size> adaptation_tau;
+            // beta, a and s
+            std::array<Scalar, Size> adaptation;
+            std::array<Scalar, Size> inhibition;
+            std::array<Scalar, Size> tonic;
+        };
+
+        template <typename Math, typename Scalar, size_t Size>
+        static void derivative(const parameters_t<Scalar, Size>& p, const CouplingGraph<Scalar, Math>& graph,
+            const Scalar* x, Scalar* dx)
+        {
+            const Scalar* x1 = x;
+            const Scalar* x2 = x + Size;
+            const Scalar* v1 = x + 2 * Size;
+            const Scalar* v2 = x + 3 * Size;
+
+            for (size_t i = 0; i < Size; ++i)
+            {
+                Scalar coupling = 0;
+                if (i < graph.nodes())
+                {
+                    for (size_t e = graph.begin(i); e < graph.end(i); ++e)
+                    {
+                        size_t j = graph.source(e);
+                        coupling += graph.weight_cos(e) * (std::max(x1[j], Scalar(0)) - std::max(x2[j], Scalar(0)));
+                    }
+                }
+
+                Scalar y1 = std::max(x1[i], Scalar(0));
+                Scalar y2 = std::max(x2[i], Scalar(0));
+                dx[i] = (-x1[i] - p.adaptation[i] * v1[i] - p.inhibition[i] * y2 + p.tonic[i] + coupling) / p.tau[i];
+                dx[Size + i] = (-x2[i] - p.adaptation[i] * v2[i] - p.inhibition[i] * y1 + p.tonic[i] - coupling) / p.tau[i];
+                dx[2 * Size + i] = (y1 - v1[i]) / p.adaptation_tau[i];
+                dx[3 * Size + i] = (y2 - v2[i]) / p.adaptation_tau[i];
+            }
+        }
+
+        template <typename Scalar, size_t Size>
+        static Scalar output(const Scalar* x, size_t i)
+        {
+            return std::max(x[i], Scalar(0)) - std::max(x[Size + i], Scalar(0));
+        }
+    };
+
+    template <typename Oscillator, size_t Size, typename Scalar = double, typename Math = StdMath>
+    class OscillatorNetwork {
+    public:
+        typedef Scalar scalar_t;
+        typedef Math math_t;
+        typedef CouplingGraph<Scalar, Math> graph_t;
+        typedef typename Oscillator::template parameters_t<Scalar, Size> parameters_t;
+
+        static constexpr size_t size = Size;
+        static constexpr size_t dimension = Oscillator::dimension;
+
+        typedef std::array<Scalar, dimension * Size> state_t;
+
+        // Size nodes without edges
+        OscillatorNetwork() : _graph(Size) {}
+
+        parameters_t& parameters()
+        {
+            return _parameters;
+        }
+
+        const parameters_t& parameters() const
+        {
+            return _parameters;
+        }
+
+        const graph_t& graph() const
+        {
+            return _graph;
+        }
+
+        // a graph of at most Size nodes
+        void set_graph(const graph_t& graph)
+        {
+            if (graph.nodes() > Size)
+                throw std::runtime_error("OscillatorNetwork: graph larger than the network");
+            _graph = graph;
+        }
+
+        // see CouplingGraph::assign
+        template <size_t Nodes, typename T>
+        void set_coupling(const std::array<std::array<T, Nodes>, Nodes>& bias,
+            const std::array<std::array<T, Nodes>, Nodes>& weights, Scalar scale = 1)
+        {
+            static_assert(Nodes <= Size, "OscillatorNetwork: coupling larger than the network");
+            _graph.assign(bias, weights, scale);
+        }
+
+        void derivative(const state_t& x, state_t& dx) const
+        {
+            Oscillator::derivative(_parameters, _graph, x.data(), dx.data());
+        }
+
+        // derivative of node i alone, for one variable oscillators (KuramotoOscillator)
+        template <typename State>
+        Scalar rate(const State& x, size_t i) const
+        {
+            return Oscillator::rate(_parameters, _graph, x.data(), i);
+        }
+
+        // signal of node i: the phase (Kuramoto), u (Hopf) or y1 - y2 (Matsuoka)
+        Scalar output(const state_t& x, size_t i) const
+        {
+            return Oscillator::template output<Scalar, Size>(x.data(), i);
+        }
+
+    protected:
+        parameters_t _parameters;
+        graph_t _graph;
+    };
+
+    template <typename Oscillator, size_t Size, typename Scalar, typename Math>
+    constexpr size_t OscillatorNetwork<Oscillator, Size, Scalar, Math>::size;
+
+    template <typename Oscillator, size_t Size, typename Scalar, typename Math>
+    constexpr size_t OscillatorNetwork<Oscillator, Size, Scalar, Math>::dimension;
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_PIPELINE_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_PIPELINE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <rhex_controller/rhex_controller_command.hpp>
+#include <rhex_controller/rhex_controller_common.hpp>
+
+// Multi-rate control: the gait and the torque loop at their own rates.
+//
+// GaitPipeline runs two stages. The gait stage calls controller.command() at
+// gait_rate (200 Hz by default) for a time lead seconds ahead of the clock and pushes
+// the setpoint into a wait-free single producer, single consumer ring. The control
+// stage, at control_rate (1 kHz), pops the setpoints it reaches and interpolates the
+// two around its time: angles and velocities linearly, the gains of the earlier one.
+// Past the newest setpoint, the gait stage being late, it extrapolates with the
+// velocity. Angle steps between setpoints are taken modulo 2 pi towards the step the
+// velocities predict, so the wrapped targets of RhexControllerSimple interpolate
+// forwards.
+//
+// start(sink) runs each stage in its own thread (pinned to a core when
+// PipelineConfig says so, on Linux), sink(t, command) receiving every control tick;
+// stop() joins them. simulate(duration, sink) runs both stages in the calling thread
+// on a simulated clock, with a given computation time of the gait stage, so that the
+// handoff can be checked without hardware or a real-time kernel.
+//
+// PipelineStats counts the setpoints and measures the latency from the start of the
+// gait tick that computed a setpoint to the first control tick that sees it. start()
+// also measures the jitter of each stage, its tick times minus their schedule. Each
+// stage writes its own statistics: read them after stop(), or after simulate().
+// Link with -pthread.
+
+namespace rhex_controller {
+
+    // Wait-free ring for one producer thread and one consumer thread. Capacity is a
+    // power of 2; each index is written by one side only, on its own cache line.
+    template <typename T, size_t Capacity>
+    class SpscRing {
+    public:
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of 2");
+
+        static constexpr size_t capacity = Capacity;
+
+        SpscRing() : _head(0), _tail(0) {}
+
+        // producer side, false (and nothing pushed) when the ring is full
+        bool push(const T& value)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == Capacity)
+                return false;
+
+            _slots[tail & (Capacity - 1)] = value;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side, false when the ring is empty
+        bool pop(T& value)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+                return false;
+
+            value = _slots[head & (Capacity - 1)];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // exact from either side when the other one is idle, a snapshot otherwise
+        size_t size() const
+        {
+            return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+        }
+
+        // not to be called while either side is running
+        void clear()
+        {
+            _head.store(0, std::memory_order_relaxed);
+            _tail.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        static constexpr size_t line = 64;
+
+        std::atomic<size_t> _head;
+        char _head_padding[line - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> _tail;
+        char _tail_padding[line - sizeof(std::atomic<size_t>)];
+        std::array<T, Capacity> _slots;
+    };
+
+    template <typename T, size_t Capacity>
+    constexpr size_t SpscRing<T, Capacity>::capacity;
+
+    // Durations in seconds: mean, deviation and extremes, and a log2 histogram of
+    // the absolute values in ns (bucket b counts [2^b, 2^(b+1)) ns) for the quantiles.
+    struct TimingStats {
+        static constexpr size_t buckets = 40;
+
+        TimingStats()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            count = 0;
+            sum = squares = 0;
+            min = std::numeric_limits<double>::infinity();
+            max = -std::numeric_limits<double>::infinity();
+            histogram.fill(0);
+        }
+
+        void add(double x)
+        {
+            ++count;
+            sum += x;
+            squares += x * x;
+            min = std::min(min, x);
+            max = std::max(max, x);
+
+            double ns = std::abs(x) * 1e9;
+            size_t b = 0;
+            while (ns >= 2 && b + 1 < buckets)
+            {
+                ns /= 2;
+                ++b;
+            }
+            ++histogram[b];
+        }
+
+        double mean() const
+        {
+            return count ? sum / count : 0;
+        }
+
+        double deviation() const
+        {
+            double m = mean();
+            return count ? std::sqrt(std::max(0., squares / count - m * m)) : 0;
+        }
+
+        // upper bound of the q quantile of the absolute values, from the histogram
+        double quantile(double q) const
+        {
+            uint64_t rank = uint64_t(std::ceil(q * count));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < buckets; ++b)
+            {
+                seen += histogram[b];
+                if (seen >= rank && seen > 0)
+                    return std::ldexp(1., int(b) + 1) * 1e-9;
+            }
+            return 0;
+        }
+
+        uint64_t count;
+        double sum;
+        double squares;
+        double min;
+        double max;
+        std::array<uint64_t, buckets> histogram;
+    };
+
+    struct PipelineStats {
+        PipelineStats() : produced(0), dropped(0), consumed(0), extrapolated(0), starved(0) {}
+
+        // setpoints pushed, and lost to a full ring
+        uint64_t produced;
+        uint64_t dropped;
+        // control ticks, those past the newest setpoint, those before any
+        uint64_t consumed;
+        uint64_t extrapolated;
+        uint64_t starved;
+
+        TimingStats latency;
+        TimingStats gait_jitter;
+        TimingStats control_jitter;
+    };
+
+    struct PipelineConfig {
+        PipelineConfig()
+            : gait_rate(200), control_rate(1000), lead(-1), gait_cpu(-1), control_cpu(-1) {}
+
+        double gait_rate;
+        double control_rate;
+        // how far ahead of the clock the setpoints are computed, negative for two gait
+        // periods: the control stage then has the setpoint after its time even when a
+        // gait tick is up to a period late
+        double lead;
+        // cores the threads of start() are pinned to, -1 to leave them to the scheduler
+        int gait_cpu;
+        int control_cpu;
+    };
+
+    // clock of start(), in seconds
+    struct SteadyClock {
+        typedef std::chrono::steady_clock clock;
+
+        double now() const
+        {
+            return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+        }
+
+        void sleep_until(double t) const
+        {
+            std::this_thread::sleep_until(clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(t))));
+        }
+    };
+
+    template <typename Controller, size_t Capacity = 64>
+    class GaitPipeline {
+    public:
+        typedef Controller controller_t;
+        typedef typename Controller::scalar_t scalar_t;
+        typedef typename Controller::command_t command_t;
+        typedef std::function<void(double, const command_t&)> sink_t;
+        // computation time of the gait tick k, for simulate()
+        typedef std::function<double(size_t)> delay_t;
+
+        static constexpr size_t legs = Controller::legs;
+
+        struct Setpoint {
+            // gait time of the command, and clock time its gait tick started
+            double time;
+            double stamp;
+            command_t command;
+        };
+
+        // The pipeline drives controller, which must not be used elsewhere while it
+        // runs. Its times are those of the pipeline clock since start() (or 0 in
+        // simulate()), so it should be freshly set up.
+        GaitPipeline(Controller& controller, const PipelineConfig& config = PipelineConfig())
+            : _controller(controller), _config(config), _running(false)
+        {
+            assert(_config.gait_rate > 0 && _config.control_rate > 0);
+            if (_config.lead < 0)
+                _config.lead = 2 / _config.gait_rate;
+            reset();
+        }
+
+        GaitPipeline(const GaitPipeline&) = delete;
+        GaitPipeline& operator=(const GaitPipeline&) = delete;
+
+        ~GaitPipeline()
+        {
+            stop();
+        }
+
+        const PipelineConfig& config() const
+        {
+            return _config;
+        }
+
+        const PipelineStats& stats() const
+        {
+            return _stats;
+        }
+
+        // forgets the setpoints and the statistics, not while running
+        void reset()
+        {
+            assert(!_running);
+            _ring.clear();
+            _stats = PipelineStats();
+            _first = _received = 0;
+            _window = 0;
+        }
+
+        // Gait stage, one tick at clock time now (seconds since the start): computes
+        // the setpoint of now + lead. False if the ring was full.
+        bool produce(double now)
+        {
+            Setpoint setpoint;
+            setpoint.time = now + _config.lead;
+            setpoint.stamp = now;
+            _controller.command(setpoint.time, setpoint.command);
+            return publish(setpoint);
+        }
+
+        // Control stage, one tick at clock time now: the command for now, from the
+        // setpoints received so far. False, with a zero command, before the first one.
+        bool consume(double now, command_t& command)
+        {
+            ++_stats.consumed;
+
+            // take every setpoint pushed so far, as long as there is room, so that the
+            // latency is measured when they arrive rather than when they are used
+            while (_received < Capacity && _ring.pop(_inbox[(_first + _received) % Capacity]))
+            {
+                _stats.latency.add(now - _inbox[(_first + _received) % Capacity].stamp);
+                ++_received;
+            }
+
+            // advance until the newest setpoint held is at or after now
+            while ((_window < 2 || _next.time < now) && _received > 0)
+            {
+                _previous = _next;
+                _next = _inbox[_first];
+                _first = (_first + 1) % Capacity;
+                --_received;
+                _window = std::min(_window + 1, 2);
+            }
+
+            if (_window == 0)
+            {
+                ++_stats.starved;
+                command.angle.fill(0);
+                command.velocity.fill(0);
+                command.Kp.fill(0);
+                command.Kd.fill(0);
+                return false;
+            }
+
+            if (_window == 1 || now >= _next.time)
+            {
+                // hold the newest setpoint, extrapolated past its time
+                if (now > _next.time)
+                    ++_stats.extrapolated;
+                double dt = std::max(0., now - _next.time);
+                for (size_t i = 0; i < legs; ++i)
+                {
+                    command.angle[i] = _next.command.angle[i] + _next.command.velocity[i] * scalar_t(dt);
+                    command.velocity[i] = _next.command.velocity[i];
+                }
+                command.Kp = _next.command.Kp;
+                command.Kd = _next.command.Kd;
+                return true;
+            }
+
+            interpolate(_previous, _next, now, command);
+            return true;
+        }
+
+        // Angles and velocities at t between a and b, linearly; the gains of a.
+        static void interpolate(const Setpoint& a, const Setpoint& b, double t, command_t& command)
+        {
+            double span = b.time - a.time;
+            double s = (span > 0) ? std::min(1., std::max(0., (t - a.time) / span)) : 1;
+
+            for (size_t i = 0; i < legs; ++i)
+            {
+                double from = double(a.command.angle[i]);
+                double step = double(b.command.angle[i]) - from;
+                // the whole turns that bring the step closest to what the velocities predict
+                double predicted = (double(a.command.velocity[i]) + double(b.command.velocity[i])) / 2 * span;
+                step -= 2 * pi * std::round((step - predicted) / (2 * pi));
+
+                command.angle[i] = scalar_t(from + s * step);
+                command.velocity[i] = scalar_t(double(a.command.velocity[i]) + s * (double(b.command.velocity[i]) - double(a.command.velocity[i])));
+            }
+            command.Kp = a.command.Kp;
+            command.Kd = a.command.Kd;
+        }
+
+        // Runs the stages in two threads on SteadyClock until stop(), sink receiving the
+        // command of every control tick (in the control thread).
+        void start(const sink_t& sink)
+        {
+            assert(!_running);
+            reset();
+            _sink = sink;
+            _running = true;
+
+            SteadyClock clock;
+            double origin = clock.now();
+            _gait_thread = std::thread(&GaitPipeline::gait_loop, this, origin);
+            _control_thread = std::thread(&GaitPipeline::control_loop, this, origin);
+        }
+
+        void stop()
+        {
+            if (!_running)
+                return;
+            _running = false;
+            _gait_thread.join();
+            _control_thread.join();
+        }
+
+        bool running() const
+        {
+            return _running;
+        }
+
+        // Runs both stages for duration simulated seconds in the calling thread. Gait
+        // tick k starts at k / gait_rate and its setpoint is pushed delay(k) seconds
+        // later (none for an empty delay); the control ticks run at m / control_rate
+        // (m from 1), after the pushes of the same time.
+        void simulate(double duration, const sink_t& sink, const delay_t& delay = delay_t())
+        {
+            assert(!_running);
+            reset();
+
+            // setpoints computed, waiting for the end of their simulated computation
+            std::deque<std::pair<double, Setpoint> > pending;
+            command_t command;
+            size_t k = 0, m = 1;
+
+            while (true)
+            {
+                double gait_time = k / _config.gait_rate;
+                double push_time = pending.empty() ? std::numeric_limits<double>::infinity() : pending.front().first;
+                double control_time = m / _config.control_rate;
+                double now = std::min(std::min(gait_time, push_time), control_time);
+                if (now > duration)
+                    break;
+
+                if (now == gait_time)
+                {
+                    Setpoint setpoint;
+                    setpoint.time = now + _config.lead;
+                    setpoint.stamp = now;
+                    _controller.command(setpoint.time, setpoint.command);
+
+                    double done = now + (delay ? std::max(0., delay(k)) : 0);
+                    // setpoints are pushed in order, a fast tick waits for a slow one
+                    if (!pending.empty())
+                        done = std::max(done, pending.back().first);
+                    pending.push_back(std::make_pair(done, setpoint));
+                    ++k;
+                }
+                else if (now == push_time)
+                {
+                    publish(pending.front().second);
+                    pending.pop_front();
+                }
+                else
+                {
+                    consume(now, command);
+                    if (sink)
+                        sink(now, command);
+                    ++m;
+                }
+            }
+        }
+
+    protected:
+        bool publish(const Setpoint& setpoint)
+        {
+            if (!_ring.push(setpoint))
+            {
+                ++_stats.dropped;
+                return false;
+            }
+            ++_stats.produced;
+            return true;
+        }
+
+        static void pin(int cpu)
+        {
+#ifdef __linux__
+            if (cpu < 0)
+                return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+            (void)cpu;
+#endif
+        }
+
+        void gait_loop(double origin)
+        {
+            pin(_config.gait_cpu);
+            SteadyClock clock;
+            double period = 1 / _config.gait_rate;
+
+            for (size_t k = 0; _running; ++k)
+            {
+                double scheduled = origin + k * period;
+                clock.sleep_until(scheduled);
+                double now = clock.now();
+                _stats.gait_jitter.add(now - scheduled);
+                produce(now - origin);
+            }
+        }
+
+        void control_loop(double origin)
+        {
+            pin(_config.control_cpu);
+            SteadyClock clock;
+            double period = 1 / _config.control_rate;
+            command_t command;
+
+            for (size_t m = 1; _running; ++m)
+            {
+                double scheduled = origin + m * period;
+                clock.sleep_until(scheduled);
+                double now = clock.now();
+                _stats.control_jitter.add(now - scheduled);
+                consume(now - origin, command);
+                if (_sink)
+                    _sink(now - origin, command);
+            }
+        }
+
+        Controller& _controller;
+        PipelineConfig _config;
+        PipelineStats _stats;
+        SpscRing<Setpoint, Capacity> _ring;
+
+        // setpoints taken from the ring by the control stage and not used yet, from
+        // _first on
+        std::array<Setpoint, Capacity> _inbox;
+        size_t _first;
+        size_t _received;
+        // setpoints the control stage interpolates between, _window of them held
+        Setpoint _previous;
+        Setpoint _next;
+        int _window;
+
+        sink_t _sink;
+        std::atomic<bool> _running;
+        std::thread _gait_thread;
+        std::thread _control_thread;
+    };
+
+    template <typename Controller, size_t Capacity>
+    constexpr size_t GaitPipeline<Controller, Capacity>::legs;
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_ROLLOUT_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_ROLLOUT_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_thread_pool.hpp>
+
+// Population rollouts: every genome of a batch drives its own controller in a
+// simulated robot for a fixed duration, the batch spread over a ThreadPool.
+// Each worker owns one clone of the simulation, reset between its rollouts, so
+// the model is parsed once and no world is shared between threads.
+//
+// The simulator is reached through a Simulation adapter (see
+// rhex_controller_dart.hpp for DART) providing
+//
+//     Simulation clone() const;                // independent copy for one worker
+//     void reset();                            // back to the initial state
+//     double time_step() const;
+//     void step(const double* targets, const double* Kp);
+//                                              // drive the legs to targets (Kp per leg,
+//                                              // nullptr for the default gains) for one step
+//     std::array<double, 3> body_position() const;
+//     double tracking_error() const;           // mean |target - angle| over the legs at the last step
+
+namespace rhex_controller {
+
+    struct RolloutStep {
+        double time;
+        std::array<double, 3> position;
+        double tracking_error;
+    };
+
+    struct RolloutResult {
+        RolloutResult()
+            : fitness(0), valid(false), steps(0), wall_time(0), controller_time(0),
+              mean_tracking_error(0), max_tracking_error(0) {}
+
+        // distance covered along x
+        double fitness;
+        // false if the simulation diverged, fitness is then 0
+        bool valid;
+        size_t steps;
+        // seconds spent in the rollout, and in the controller alone
+        double wall_time;
+        double controller_time;
+        double mean_tracking_error;
+        double max_tracking_error;
+        // every step, when RolloutEngine::set_record_trace(true)
+        std::vector<RolloutStep> trace;
+    };
+
+    template <typename Controller, typename Simulation>
+    class RolloutEngine {
+    public:
+        static constexpr size_t legs = Controller::legs;
+
+        // called on each controller right after it is built from its genome, e.g. to
+        // warm start its oscillators (see rhex_controller_warm_start.hpp)
+        typedef std::function<void(Controller&, const std::vector<double>&)> initializer_t;
+
+        // threads = 0 uses one worker per hardware thread
+        RolloutEngine(const Simulation& prototype, double duration, size_t threads = 0)
+            : _pool(threads), _duration(duration), _record_trace(false)
+        {
+            _simulations.reserve(_pool.size());
+            for (size_t w = 0; w < _pool.size(); ++w)
+                _simulations.push_back(prototype.clone());
+        }
+
+        size_t threads() const
+        {
+            return _pool.size();
+        }
+
+        void set_duration(double duration)
+        {
+            _duration = duration;
+        }
+
+        double duration() const
+        {
+            return _duration;
+        }
+
+        void set_initializer(const initializer_t& initializer)
+        {
+            _initializer = initializer;
+        }
+
+        void set_record_trace(bool record_trace)
+        {
+            _record_trace = record_trace;
+        }
+
+        // one result per genome, in the same order
+        std::vector<RolloutResult> run(const std::vector<std::vector<double> >& ctrls)
+        {
+            std::vector<RolloutResult> results(ctrls.size());
+
+            _pool.parallel_for(ctrls.size(), [&](size_t worker, size_t n) {
+                results[n] = rollout(_simulations[worker], ctrls[n]);
+            });
+
+            return results;
+        }
+
+        RolloutResult rollout(Simulation& simulation, const std::vector<double>& ctrl) const
+        {
+            typedef std::chrono::steady_clock clock;
+            clock::time_point start = clock::now();
+
+            RolloutResult result;
+            simulation.reset();
+
+            Controller controller(ctrl);
+            if (_initializer)
+                _initializer(controller, ctrl);
+            typename Controller::output_t output;
+            std::array<double, legs> targets;
+            std::array<double, legs> gains, damping;
+
+            double dt = simulation.time_step();
+            size_t steps = std::ceil(_duration / dt - 1e-9);
+            std::array<double, 3> origin = simulation.body_position();
+
+            if (_record_trace)
+                result.trace.reserve(steps);
+
+            clock::duration controller_time(0);
+            double error_sum = 0;
+            result.valid = true;
+
+            for (size_t k = 0; k < steps; ++k)
+            {
+                double t = (k + 1) * dt;
+
+                clock::time_point tick = clock::now();
+                controller.pos(t, output);
+                std::copy(output.begin(), output.end(), targets.begin());
+                // RhexControllerSimple sets the leg gains (see leg_gains)
+                const double* Kp = leg_gains(controller, gains, damping) ? gains.data() : nullptr;
+                controller_time += clock::now() - tick;
+
+                simulation.step(targets.data(), Kp);
+                ++result.steps;
+
+                double error = simulation.tracking_error();
+                error_sum += error;
+                result.max_tracking_error = std::max(result.max_tracking_error, error);
+
+                std::array<double, 3> position = simulation.body_position();
+                if (!std::isfinite(position[0]) || !std::isfinite(position[1]) || !std::isfinite(position[2]))
+                {
+                    result.valid = false;
+                    break;
+                }
+
+                if (_record_trace)
+                {
+                    RolloutStep step = {t, position, error};
+                    result.trace.push_back(step);
+                }
+            }
+
+            if (result.valid)
+                result.fitness = simulation.body_position()[0] - origin[0];
+            if (result.steps > 0)
+                result.mean_tracking_error = error_sum / result.steps;
+
+            result.controller_time = std::chrono::duration<double>(controller_time).count();
+            result.wall_time = std::chrono::duration<double>(clock::now() - start).count();
+
+            return result;
+        }
+
+    protected:
+        ThreadPool _pool;
+        std::vector<Simulation> _simulations;
+        double _duration;
+        bool _record_trace;
+        initializer_t _initializer;
+    };
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,924 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_SEARCH_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_SEARCH_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <rhex_controller/rhex_controller_rollout.hpp>
+#include <rhex_controller/rhex_controller_thread_pool.hpp>
+
+// Gait parameter search: CMA-ES and MAP-Elites over controller genomes.
+//
+// The optimizers only see genomes (std::vector<double> of Controller::ctrl_size
+// values, in [0, 1] unless other bounds are set) and an evaluator, a callable that
+// scores a whole batch:
+//
+//     std::vector<Evaluation> evaluator(const std::vector<std::vector<double> >& genomes);
+//
+// ParallelEvaluator spreads a thread-safe fitness function of one genome over a
+// ThreadPool (GaitFitness in rhex_controller_gait_fitness.hpp scores a gait from
+// pos() alone), RolloutEvaluator wraps a RolloutEngine, e.g. with DartSimulation.
+// Both optimizers save their whole state, random generator included, to a text
+// checkpoint between generations: a run loaded from a checkpoint goes on exactly
+// as the uninterrupted one would have.
+
+namespace rhex_controller {
+
+    struct Evaluation {
+        Evaluation() : fitness(0), valid(false) {}
+
+        // higher is better
+        double fitness;
+        // invalid genomes, and those of non-finite fitness, are ranked last by CmaEs and
+        // never enter the MapElites archive
+        bool valid;
+        // behaviour of the genome, each value in [0, 1] (used by MapElites)
+        std::vector<double> descriptor;
+    };
+
+    // fitness(genome) -> Evaluation is called from the workers at the same time
+    template <typename Fitness>
+    class ParallelEvaluator {
+    public:
+        // threads = 0 uses one worker per hardware thread
+        ParallelEvaluator(const Fitness& fitness, size_t threads = 0)
+            : _fitness(fitness), _pool(threads) {}
+
+        size_t threads() const
+        {
+            return _pool.size();
+        }
+
+        const Fitness& fitness() const
+        {
+            return _fitness;
+        }
+
+        std::vector<Evaluation> operator()(const std::vector<std::vector<double> >& genomes)
+        {
+            std::vector<Evaluation> evaluations(genomes.size());
+
+            _pool.parallel_for(genomes.size(), [&](size_t, size_t n) {
+                evaluations[n] = _fitness(genomes[n]);
+            });
+
+            return evaluations;
+        }
+
+    protected:
+        Fitness _fitness;
+        ThreadPool _pool;
+    };
+
+    // Fitness from simulated rollouts (the distance walked along x). MapElites needs a
+    // descriptor: descriptor(genome, result) gives it, e.g. from the trace of the
+    // rollout or from GaitFitness::measure().
+    template <typename Engine>
+    class RolloutEvaluator {
+    public:
+        typedef std::function<std::vector<double>(const std::vector<double>&, const RolloutResult&)> descriptor_t;
+
+        RolloutEvaluator(Engine& engine, const descriptor_t& descriptor = descriptor_t())
+            : _engine(engine), _descriptor(descriptor) {}
+
+        std::vector<Evaluation> operator()(const std::vector<std::vector<double> >& genomes)
+        {
+            std::vector<RolloutResult> results = _engine.run(genomes);
+            std::vector<Evaluation> evaluations(genomes.size());
+
+            for (size_t n = 0; n < genomes.size(); ++n)
+            {
+                evaluations[n].fitness = results[n].fitness;
+                evaluations[n].valid = results[n].valid;
+                if (_descriptor)
+                    evaluations[n].descriptor = _descriptor(genomes[n], results[n]);
+            }
+
+            return evaluations;
+        }
+
+    protected:
+        Engine& _engine;
+        descriptor_t _descriptor;
+    };
+
+    namespace search {
+        inline void write_values(std::ostream& out, const char* key, const std::vector<double>& values)
+        {
+            out << key << ' ' << values.size();
+            for (size_t i = 0; i < values.size(); ++i)
+                out << ' ' << values[i];
+            out << '\n';
+        }
+
+        template <typename T>
+        inline void write_value(std::ostream& out, const char* key, const T& value)
+        {
+            out << key << ' ' << value << '\n';
+        }
+
+        inline void expect(std::istream& in, const char* key)
+        {
+            std::string word;
+            if (!(in >> word) || word != key)
+                throw std::runtime_error(std::string("search checkpoint: expected ") + key);
+        }
+
+        inline std::vector<double> read_values(std::istream& in, const char* key)
+        {
+            expect(in, key);
+            size_t size = 0;
+            if (!(in >> size))
+                throw std::runtime_error(std::string("search checkpoint: bad size of ") + key);
+
+            std::vector<double> values(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (!(in >> values[i]))
+                    throw std::runtime_error(std::string("search checkpoint: bad value in ") + key);
+            }
+            return values;
+        }
+
+        template <typename T>
+        inline T read_value(std::istream& in, const char* key)
+        {
+            expect(in, key);
+            T value;
+            if (!(in >> value))
+                throw std::runtime_error(std::string("search checkpoint: bad value of ") + key);
+            return value;
+        }
+
+        // writes next to path and renames over it, so a crash while saving leaves the
+        // previous checkpoint intact
+        template <typename Write>
+        inline void save(const std::string& path, const Write& write)
+        {
+            std::string tmp = path + ".tmp";
+            {
+                std::ofstream out(tmp.c_str());
+                if (!out)
+                    throw std::runtime_error("search checkpoint: cannot create " + tmp);
+                out.precision(std::numeric_limits<double>::max_digits10);
+                write(out);
+                out.flush();
+                if (!out)
+                    throw std::runtime_error("search checkpoint: cannot write to " + tmp);
+            }
+            if (std::rename(tmp.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("search checkpoint: cannot rename " + tmp + " to " + path);
+        }
+
+        inline void open(std::ifstream& in, const std::string& path, const char* magic)
+        {
+            in.open(path.c_str());
+            if (!in)
+                throw std::runtime_error("search checkpoint: cannot open " + path);
+
+            std::string word;
+            int version = 0;
+            if (!(in >> word >> version) || word != magic || version != 1)
+                throw std::runtime_error("search checkpoint: " + path + " is not a " + magic + " checkpoint");
+        }
+
+        inline std::vector<double> clamp(const std::vector<double>& x, const std::vector<double>& lower, const std::vector<double>& upper)
+        {
+            std::vector<double> y(x.size());
+            for (size_t i = 0; i < x.size(); ++i)
+                y[i] = std::min(std::max(x[i], lower[i]), upper[i]);
+            return y;
+        }
+
+        // Eigen decomposition of the symmetric n x n matrix a (row major, destroyed) by
+        // cyclic Jacobi rotations: a = vectors diag(values) vectors^T, the eigenvectors
+        // in the columns of vectors. Plenty for the few dozen genes of a gait.
+        inline void symmetric_eigen(std::vector<double>& a, size_t n, std::vector<double>& values, std::vector<double>& vectors)
+        {
+            vectors.assign(n * n, 0);
+            for (size_t i = 0; i < n; ++i)
+                vectors[i * n + i] = 1;
+
+            for (size_t sweep = 0; sweep < 64; ++sweep)
+            {
+                double off = 0, diagonal = 0;
+                for (size_t p = 0; p < n; ++p)
+                {
+                    diagonal += a[p * n + p] * a[p * n + p];
+                    for (size_t q = p + 1; q < n; ++q)
+                        off += a[p * n + q] * a[p * n + q];
+                }
+                if (off <= 1e-30 * diagonal)
+                    break;
+
+                for (size_t p = 0; p < n; ++p)
+                {
+                    for (size_t q = p + 1; q < n; ++q)
+                    {
+                        double apq = a[p * n + q];
+                        if (apq == 0)
+                            continue;
+
+                        double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                        double t = ((theta >= 0) ? 1. : -1.) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                        double c = 1 / std::sqrt(t * t + 1);
+                        double s = t * c;
+
+                        for (size_t k = 0; k < n; ++k)
+                        {
+                            double akp = a[k * n + p], akq = a[k * n + q];
+                            a[k * n + p] = c * akp - s * akq;
+                            a[k * n + q] = s * akp + c * akq;
+                        }
+                        for (size_t k = 0; k < n; ++k)
+                        {
+                            double apk = a[p * n + k], aqk = a[q * n + k];
+                            a[p * n + k] = c * apk - s * aqk;
+                            a[q * n + k] = s * apk + c * aqk;
+                        }
+                        for (size_t k = 0; k < n; ++k)
+                        {
+                            double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                            vectors[k * n + p] = c * vkp - s * vkq;
+                            vectors[k * n + q] = s * vkp + c * vkq;
+                        }
+                    }
+                }
+            }
+
+            values.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                values[i] = a[i * n + i];
+        }
+    } // namespace search
+
+    // (mu/mu_w, lambda)-CMA-ES with rank-one and rank-mu covariance updates and
+    // cumulative step-size adaptation (Hansen, "The CMA Evolution Strategy: A
+    // Tutorial", 2016), maximizing the fitness. Candidates are clamped to the bounds
+    // for evaluation and their fitness is lowered by penalty times the squared
+    // distance that was clamped, so the mean stays inside.
+    class CmaEs {
+    public:
+        CmaEs() : _dim(0), _lambda(0), _mu(0), _sigma(0), _penalty(0), _generation(0), _evaluations(0), _best_fitness(0) {}
+
+        // starts at the centre of [0, 1]^dim; lambda = 0 uses 4 + 3 ln(dim)
+        CmaEs(size_t dim, double sigma = 0.3, unsigned seed = 0, size_t lambda = 0)
+        {
+            init(std::vector<double>(dim, 0.5), sigma, seed, lambda);
+        }
+
+        CmaEs(const std::vector<double>& mean, double sigma, unsigned seed = 0, size_t lambda = 0)
+        {
+            init(mean, sigma, seed, lambda);
+        }
+
+        void set_bounds(const std::vector<double>& lower, const std::vector<double>& upper)
+        {
+            assert(lower.size() == _dim && upper.size() == _dim);
+            _lower = lower;
+            _upper = upper;
+        }
+
+        void set_penalty(double penalty)
+        {
+            _penalty = penalty;
+        }
+
+        size_t dim() const
+        {
+            return _dim;
+        }
+
+        size_t lambda() const
+        {
+            return _lambda;
+        }
+
+        size_t generation() const
+        {
+            return _generation;
+        }
+
+        size_t evaluations() const
+        {
+            return _evaluations;
+        }
+
+        double sigma() const
+        {
+            return _sigma;
+        }
+
+        const std::vector<double>& mean() const
+        {
+            return _mean;
+        }
+
+        // best valid genome evaluated so far (empty if none), clamped to the bounds
+        const std::vector<double>& best() const
+        {
+            return _best;
+        }
+
+        double best_fitness() const
+        {
+            return _best_fitness;
+        }
+
+        // lambda genomes to evaluate, clamped to the bounds
+        const std::vector<std::vector<double> >& ask()
+        {
+            std::normal_distribution<double> normal;
+            std::vector<double> z(_dim);
+
+            _y.assign(_lambda, std::vector<double>(_dim, 0));
+            _candidates.assign(_lambda, std::vector<double>(_dim));
+            _out_of_bounds.assign(_lambda, 0);
+
+            for (size_t k = 0; k < _lambda; ++k)
+            {
+                for (size_t i = 0; i < _dim; ++i)
+                    z[i] = _D[i] * normal(_rng);
+
+                // y = B D z, x = m + sigma y
+                for (size_t i = 0; i < _dim; ++i)
+                {
+                    double y = 0;
+                    for (size_t j = 0; j < _dim; ++j)
+                        y += _B[i * _dim + j] * z[j];
+                    _y[k][i] = y;
+
+                    double x = _mean[i] + _sigma * y;
+                    double clamped = std::min(std::max(x, _lower[i]), _upper[i]);
+                    _out_of_bounds[k] += (x - clamped) * (x - clamped);
+                    _candidates[k][i] = clamped;
+                }
+            }
+
+            return _candidates;
+        }
+
+        // the evaluations of the genomes of the last ask(), in the same order
+        void tell(const std::vector<Evaluation>& evaluations)
+        {
+            assert(evaluations.size() == _lambda && _y.size() == _lambda);
+
+            // invalid and non-finite evaluations rank last: a NaN in the comparison of
+            // the sort would break its ordering
+            std::vector<double> fitness(_lambda);
+            for (size_t k = 0; k < _lambda; ++k)
+            {
+                bool finite = evaluations[k].valid && std::isfinite(evaluations[k].fitness);
+                fitness[k] = finite ? evaluations[k].fitness - _penalty * _out_of_bounds[k] : -std::numeric_limits<double>::infinity();
+                if (!std::isfinite(fitness[k]))
+                    fitness[k] = -std::numeric_limits<double>::infinity();
+                if (finite && (_best.empty() || evaluations[k].fitness > _best_fitness))
+                {
+                    _best = _candidates[k];
+                    _best_fitness = evaluations[k].fitness;
+                }
+            }
+            _evaluations += _lambda;
+
+            std::vector<size_t> order(_lambda);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return fitness[a] > fitness[b]; });
+
+            // recombination
+            std::vector<double> y_w(_dim, 0);
+            for (size_t r = 0; r < _mu; ++r)
+                for (size_t i = 0; i < _dim; ++i)
+                    y_w[i] += _weights[r] * _y[order[r]][i];
+            for (size_t i = 0; i < _dim; ++i)
+                _mean[i] += _sigma * y_w[i];
+
+            // step-size path, with C^-1/2 y_w = B D^-1 B^T y_w
+            std::vector<double> t(_dim, 0);
+            for (size_t j = 0; j < _dim; ++j)
+            {
+                for (size_t i = 0; i < _dim; ++i)
+                    t[j] += _B[i * _dim + j] * y_w[i];
+                t[j] /= _D[j];
+            }
+            double ps_norm = 0;
+            for (size_t i = 0; i < _dim; ++i)
+            {
+                double c_y = 0;
+                for (size_t j = 0; j < _dim; ++j)
+                    c_y += _B[i * _dim + j] * t[j];
+                _ps[i] = (1 - _cs) * _ps[i] + std::sqrt(_cs * (2 - _cs) * _mu_eff) * c_y;
+                ps_norm += _ps[i] * _ps[i];
+            }
+            ps_norm = std::sqrt(ps_norm);
+
+            double n = _dim;
+            double chi_n = std::sqrt(n) * (1 - 1 / (4 * n) + 1 / (21 * n * n));
+            bool h_sigma = ps_norm / std::sqrt(1 - std::pow(1 - _cs, 2. * (_generation + 1))) < (1.4 + 2 / (n + 1)) * chi_n;
+
+            for (size_t i = 0; i < _dim; ++i)
+                _pc[i] = (1 - _cc) * _pc[i] + (h_sigma ? std::sqrt(_cc * (2 - _cc) * _mu_eff) : 0.) * y_w[i];
+
+            // covariance
+            double decay = 1 - _c1 - _cmu + (h_sigma ? 0. : _c1 * _cc * (2 - _cc));
+            for (size_t i = 0; i < _dim; ++i)
+            {
+                for (size_t j = 0; j <= i; ++j)
+                {
+                    double rank_mu = 0;
+                    for (size_t r = 0; r < _mu; ++r)
+                        rank_mu += _weights[r] * _y[order[r]][i] * _y[order[r]][j];
+
+                    double c = decay * _C[i * _dim + j] + _c1 * _pc[i] * _pc[j] + _cmu * rank_mu;
+                    _C[i * _dim + j] = c;
+                    _C[j * _dim + i] = c;
+                }
+            }
+
+            _sigma *= std::exp((_cs / _ds) * (ps_norm / chi_n - 1));
+            ++_generation;
+
+            _y.clear();
+            decompose();
+        }
+
+        // one generation: ask, evaluate, tell
+        template <typename Evaluator>
+        void step(Evaluator& evaluator)
+        {
+            const std::vector<std::vector<double> >& genomes = ask();
+            tell(evaluator(genomes));
+        }
+
+        // Runs until generation() reaches generations or sigma falls below
+        // min_sigma, saving the state to checkpoint (if not empty) after each generation.
+        template <typename Evaluator>
+        void run(Evaluator& evaluator, size_t generations, const std::string& checkpoint = std::string(), double min_sigma = 1e-8)
+        {
+            while (_generation < generations && _sigma > min_sigma)
+            {
+                step(evaluator);
+                if (!checkpoint.empty())
+                    save(checkpoint);
+            }
+        }
+
+        // throws std::runtime_error if the file cannot be written
+        void save(const std::string& path) const
+        {
+            search::save(path, [this](std::ostream& out) {
+                out << "rhex_controller_cmaes 1\n";
+                search::write_value(out, "lambda", _lambda);
+                search::write_value(out, "generation", _generation);
+                search::write_value(out, "evaluations", _evaluations);
+                search::write_value(out, "sigma", _sigma);
+                search::write_value(out, "penalty", _penalty);
+                search::write_values(out, "mean", _mean);
+                search::write_values(out, "lower", _lower);
+                search::write_values(out, "upper", _upper);
+                search::write_values(out, "pc", _pc);
+                search::write_values(out, "ps", _ps);
+                search::write_values(out, "C", _C);
+                search::write_value(out, "best_fitness", _best_fitness);
+                search::write_values(out, "best", _best);
+                search::write_value(out, "rng", _rng);
+            });
+        }
+
+        // replaces the state by the one saved in path, throws std::runtime_error if
+        // it cannot be read
+        void load(const std::string& path)
+        {
+            std::ifstream in;
+            search::open(in, path, "rhex_controller_cmaes");
+
+            size_t lambda = search::read_value<size_t>(in, "lambda");
+            size_t generation = search::read_value<size_t>(in, "generation");
+            size_t evaluations = search::read_value<size_t>(in, "evaluations");
+            double sigma = search::read_value<double>(in, "sigma");
+            double penalty = search::read_value<double>(in, "penalty");
+            std::vector<double> mean = search::read_values(in, "mean");
+            std::vector<double> lower = search::read_values(in, "lower");
+            std::vector<double> upper = search::read_values(in, "upper");
+            std::vector<double> pc = search::read_values(in, "pc");
+            std::vector<double> ps = search::read_values(in, "ps");
+            std::vector<double> C = search::read_values(in, "C");
+            double best_fitness = search::read_value<double>(in, "best_fitness");
+            std::vector<double> best = search::read_values(in, "best");
+            std::mt19937_64 rng = search::read_value<std::mt19937_64>(in, "rng");
+
+            size_t n = mean.size();
+            if (lower.size() != n || upper.size() != n || pc.size() != n || ps.size() != n || C.size() != n * n || (!best.empty() && best.size() != n))
+                throw std::runtime_error("search checkpoint: inconsistent sizes in " + path);
+
+            init(mean, sigma, 0, lambda);
+            _generation = generation;
+            _evaluations = evaluations;
+            _penalty = penalty;
+            _lower = lower;
+            _upper = upper;
+            _pc = pc;
+            _ps = ps;
+            _C = C;
+            _best_fitness = best_fitness;
+            _best = best;
+            _rng = rng;
+            decompose();
+        }
+
+    protected:
+        void init(const std::vector<double>& mean, double sigma, unsigned seed, size_t lambda)
+        {
+            _dim = mean.size();
+            double n = _dim;
+
+            _lambda = (lambda > 0) ? lambda : 4 + size_t(3 * std::log(n));
+            _mu = _lambda / 2;
+            _weights.resize(_mu);
+            for (size_t r = 0; r < _mu; ++r)
+                _weights[r] = std::log(_mu + 0.5) - std::log(r + 1.);
+            double sum = std::accumulate(_weights.begin(), _weights.end(), 0.);
+            double sum_squares = 0;
+            for (size_t r = 0; r < _mu; ++r)
+            {
+                _weights[r] /= sum;
+                sum_squares += _weights[r] * _weights[r];
+            }
+            _mu_eff = 1 / sum_squares;
+
+            _cs = (_mu_eff + 2) / (n + _mu_eff + 5);
+            _ds = 1 + 2 * std::max(0., std::sqrt((_mu_eff - 1) / (n + 1)) - 1) + _cs;
+            _cc = (4 + _mu_eff / n) / (n + 4 + 2 * _mu_eff / n);
+            _c1 = 2 / ((n + 1.3) * (n + 1.3) + _mu_eff);
+            _cmu = std::min(1 - _c1, 2 * (_mu_eff - 2 + 1 / _mu_eff) / ((n + 2) * (n + 2) + _mu_eff));
+
+            _mean = mean;
+            _sigma = sigma;
+            _penalty = 1;
+            _lower.assign(_dim, 0);
+            _upper.assign(_dim, 1);
+            _pc.assign(_dim, 0);
+            _ps.assign(_dim, 0);
+            _C.assign(_dim * _dim, 0);
+            for (size_t i = 0; i < _dim; ++i)
+                _C[i * _dim + i] = 1;
+
+            _generation = 0;
+            _evaluations = 0;
+            _best.clear();
+            _best_fitness = 0;
+            _rng.seed(seed);
+            decompose();
+        }
+
+        // C = B D^2 B^T
+        void decompose()
+        {
+            std::vector<double> a = _C;
+            search::symmetric_eigen(a, _dim, _D, _B);
+            for (size_t i = 0; i < _dim; ++i)
+                _D[i] = std::sqrt(std::max(_D[i], 1e-20));
+        }
+
+        size_t _dim;
+        size_t _lambda;
+        size_t _mu;
+        std::vector<double> _weights;
+        double _mu_eff;
+        // learning rates and damping
+        double _cs, _ds, _cc, _c1, _cmu;
+
+        std::vector<double> _mean;
+        double _sigma;
+        std::vector<double> _lower, _upper;
+        double _penalty;
+        // evolution paths
+        std::vector<double> _pc, _ps;
+        // covariance (row major) and its eigen decomposition
+        std::vector<double> _C, _B, _D;
+
+        size_t _generation;
+        size_t _evaluations;
+        std::vector<double> _best;
+        double _best_fitness;
+        std::mt19937_64 _rng;
+
+        // last ask()
+        std::vector<std::vector<double> > _y;
+        std::vector<std::vector<double> > _candidates;
+        std::vector<double> _out_of_bounds;
+    };
+
+    // MAP-Elites (Mouret and Clune, 2015): an archive keeps the best genome found in
+    // each cell of a grid over the behaviour descriptors. The first genomes are drawn
+    // uniformly in the bounds, the next ones are variations of two random elites with
+    // the Iso+LineDD operator (Vassiliades and Mouret, 2018): Gaussian noise of
+    // sigma_iso plus a Gaussian step of sigma_line along their difference, both
+    // relative to the width of the bounds.
+    class MapElites {
+    public:
+        struct Cell {
+            Cell() : filled(false), fitness(0) {}
+
+            bool filled;
+            double fitness;
+            std::vector<double> genome;
+            std::vector<double> descriptor;
+        };
+
+        MapElites() : _dim(0), _cells(0), _initial(0), _sigma_iso(0), _sigma_line(0), _evaluations(0), _filled(0) {}
+
+        // bins[d] cells along descriptor dimension d; initial random genomes
+        MapElites(size_t dim, const std::vector<size_t>& bins, unsigned seed = 0, size_t initial = 256)
+        {
+            init(dim, bins, initial);
+            _rng.seed(seed);
+        }
+
+        void set_bounds(const std::vector<double>& lower, const std::vector<double>& upper)
+        {
+            assert(lower.size() == _dim && upper.size() == _dim);
+            _lower = lower;
+            _upper = upper;
+        }
+
+        void set_variation(double sigma_iso, double sigma_line)
+        {
+            _sigma_iso = sigma_iso;
+            _sigma_line = sigma_line;
+        }
+
+        size_t dim() const
+        {
+            return _dim;
+        }
+
+        const std::vector<size_t>& bins() const
+        {
+            return _bins;
+        }
+
+        size_t evaluations() const
+        {
+            return _evaluations;
+        }
+
+        const std::vector<Cell>& archive() const
+        {
+            return _archive;
+        }
+
+        // cell of a descriptor, values outside [0, 1] go to the border cells
+        size_t cell(const std::vector<double>& descriptor) const
+        {
+            assert(descriptor.size() == _bins.size());
+
+            size_t index = 0;
+            for (size_t d = 0; d < _bins.size(); ++d)
+            {
+                double x = std::min(std::max(descriptor[d], 0.), 1.);
+                size_t bin = std::min(size_t(x * _bins[d]), _bins[d] - 1);
+                index = index * _bins[d] + bin;
+            }
+            return index;
+        }
+
+        size_t filled() const
+        {
+            return _filled;
+        }
+
+        double coverage() const
+        {
+            return double(_filled) / _cells;
+        }
+
+        // sum of the fitness of the elites
+        double qd_score() const
+        {
+            double score = 0;
+            for (size_t c = 0; c < _cells; ++c)
+                if (_archive[c].filled)
+                    score += _archive[c].fitness;
+            return score;
+        }
+
+        // elite with the highest fitness, nullptr while the archive is empty
+        const Cell* best() const
+        {
+            const Cell* best = nullptr;
+            for (size_t c = 0; c < _cells; ++c)
+                if (_archive[c].filled && (!best || _archive[c].fitness > best->fitness))
+                    best = &_archive[c];
+            return best;
+        }
+
+        // batch genomes to evaluate
+        const std::vector<std::vector<double> >& ask(size_t batch)
+        {
+            std::uniform_real_distribution<double> uniform;
+            std::normal_distribution<double> normal;
+
+            _candidates.assign(batch, std::vector<double>(_dim));
+            std::vector<size_t> elites;
+            if (_evaluations >= _initial)
+            {
+                for (size_t c = 0; c < _cells; ++c)
+                    if (_archive[c].filled)
+                        elites.push_back(c);
+            }
+
+            for (size_t k = 0; k < batch; ++k)
+            {
+                std::vector<double>& x = _candidates[k];
+                if (elites.empty())
+                {
+                    for (size_t i = 0; i < _dim; ++i)
+                        x[i] = _lower[i] + uniform(_rng) * (_upper[i] - _lower[i]);
+                    continue;
+                }
+
+                std::uniform_int_distribution<size_t> pick(0, elites.size() - 1);
+                const std::vector<double>& a = _archive[elites[pick(_rng)]].genome;
+                const std::vector<double>& b = _archive[elites[pick(_rng)]].genome;
+                double line = _sigma_line * normal(_rng);
+                for (size_t i = 0; i < _dim; ++i)
+                    x[i] = a[i] + _sigma_iso * (_upper[i] - _lower[i]) * normal(_rng) + line * (b[i] - a[i]);
+                x = search::clamp(x, _lower, _upper);
+            }
+
+            return _candidates;
+        }
+
+        // the evaluations of the genomes of the last ask(), in the same order;
+        // returns the number of genomes that entered the archive
+        size_t tell(const std::vector<Evaluation>& evaluations)
+        {
+            assert(evaluations.size() == _candidates.size());
+
+            size_t added = 0;
+            for (size_t k = 0; k < evaluations.size(); ++k)
+            {
+                if (!evaluations[k].valid || !std::isfinite(evaluations[k].fitness))
+                    continue;
+                if (evaluations[k].descriptor.size() != _bins.size())
+                    throw std::runtime_error("MapElites: the evaluator gave no descriptor of " + std::to_string(_bins.size()) + " values");
+
+                Cell& cell = _archive[this->cell(evaluations[k].descriptor)];
+                if (cell.filled && cell.fitness >= evaluations[k].fitness)
+                    continue;
+
+                if (!cell.filled)
+                    ++_filled;
+                cell.filled = true;
+                cell.fitness = evaluations[k].fitness;
+                cell.genome = _candidates[k];
+                cell.descriptor = evaluations[k].descriptor;
+                ++added;
+            }
+            _evaluations += evaluations.size();
+
+            return added;
+        }
+
+        template <typename Evaluator>
+        size_t step(Evaluator& evaluator, size_t batch)
+        {
+            const std::vector<std::vector<double> >& genomes = ask(batch);
+            return tell(evaluator(genomes));
+        }
+
+        // Runs batches until evaluations() reaches evaluations, saving the state to
+        // checkpoint (if not empty) after each batch.
+        template <typename Evaluator>
+        void run(Evaluator& evaluator, size_t evaluations, size_t batch = 64, const std::string& checkpoint = std::string())
+        {
+            while (_evaluations < evaluations)
+            {
+                step(evaluator, std::min(batch, evaluations - _evaluations));
+                if (!checkpoint.empty())
+                    save(checkpoint);
+            }
+        }
+
+        // throws std::runtime_error if the file cannot be written
+        void save(const std::string& path) const
+        {
+            search::save(path, [this](std::ostream& out) {
+                out << "rhex_controller_map_elites 1\n";
+                search::write_value(out, "dim", _dim);
+                search::write_values(out, "bins", std::vector<double>(_bins.begin(), _bins.end()));
+                search::write_value(out, "initial", _initial);
+                search::write_value(out, "sigma_iso", _sigma_iso);
+                search::write_value(out, "sigma_line", _sigma_line);
+                search::write_value(out, "evaluations", _evaluations);
+                search::write_values(out, "lower", _lower);
+                search::write_values(out, "upper", _upper);
+                search::write_value(out, "rng", _rng);
+                search::write_value(out, "filled", _filled);
+                for (size_t c = 0; c < _cells; ++c)
+                {
+                    if (!_archive[c].filled)
+                        continue;
+                    search::write_value(out, "cell", c);
+                    search::write_value(out, "fitness", _archive[c].fitness);
+                    search::write_values(out, "descriptor", _archive[c].descriptor);
+                    search::write_values(out, "genome", _archive[c].genome);
+                }
+            });
+        }
+
+        // replaces the state by the one saved in path, throws std::runtime_error if
+        // it cannot be read
+        void load(const std::string& path)
+        {
+            std::ifstream in;
+            search::open(in, path, "rhex_controller_map_elites");
+
+            size_t dim = search::read_value<size_t>(in, "dim");
+            std::vector<double> bins = search::read_values(in, "bins");
+            size_t initial = search::read_value<size_t>(in, "initial");
+            double sigma_iso = search::read_value<double>(in, "sigma_iso");
+            double sigma_line = search::read_value<double>(in, "sigma_line");
+            size_t evaluations = search::read_value<size_t>(in, "evaluations");
+            std::vector<double> lower = search::read_values(in, "lower");
+            std::vector<double> upper = search::read_values(in, "upper");
+            std::mt19937_64 rng = search::read_value<std::mt19937_64>(in, "rng");
+            size_t filled = search::read_value<size_t>(in, "filled");
+
+            if (bins.empty() || lower.size() != dim || upper.size() != dim)
+                throw std::runtime_error("search checkpoint: inconsistent sizes in " + path);
+
+            init(dim, std::vector<size_t>(bins.begin(), bins.end()), initial);
+            _sigma_iso = sigma_iso;
+            _sigma_line = sigma_line;
+            _evaluations = evaluations;
+            _lower = lower;
+            _upper = upper;
+            _rng = rng;
+
+            for (size_t k = 0; k < filled; ++k)
+            {
+                size_t c = search::read_value<size_t>(in, "cell");
+                if (c >= _cells || _archive[c].filled)
+                    throw std::runtime_error("search checkpoint: bad cell in " + path);
+
+                Cell& cell = _archive[c];
+                cell.filled = true;
+                cell.fitness = search::read_value<double>(in, "fitness");
+                cell.descriptor = search::read_values(in, "descriptor");
+                cell.genome = search::read_values(in, "genome");
+                if (cell.descriptor.size() != _bins.size() || cell.genome.size() != _dim)
+                    throw std::runtime_error("search checkpoint: inconsistent sizes in " + path);
+            }
+            _filled = filled;
+        }
+
+    protected:
+        void init(size_t dim, const std::vector<size_t>& bins, size_t initial)
+        {
+            assert(!bins.empty());
+
+            _dim = dim;
+            _bins = bins;
+            _cells = 1;
+            for (size_t d = 0; d < _bins.size(); ++d)
+                _cells *= _bins[d];
+            _archive.assign(_cells, Cell());
+            _filled = 0;
+
+            _initial = initial;
+            _sigma_iso = 0.01;
+            _sigma_line = 0.2;
+            _evaluations = 0;
+            _lower.assign(_dim, 0);
+            _upper.assign(_dim, 1);
+        }
+
+        size_t _dim;
+        std::vector<size_t> _bins;
+        size_t _cells;
+        size_t _initial;
+        double _sigma_iso, _sigma_line;
+        std::vector<double> _lower, _upper;
+
+        size_t _evaluations;
+        std::vector<Cell> _archive;
+        size_t _filled;
+        std::mt19937_64 _rng;
+
+        // last ask()
+        std::vector<std::vector<double> > _candidates;
+    };
+} // namespace rhex_controller
+
+#endif
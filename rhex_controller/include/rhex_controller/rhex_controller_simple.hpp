@@ -3,48 +3,84 @@
 
 // For M_PI constant
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
 #include <vector>
-#define PI 3.14159265
-#define ARRAY_DIM 100
+
+#include <rhex_controller/rhex_controller_command.hpp>
+#include <rhex_controller/rhex_controller_common.hpp>
+#include <rhex_controller/rhex_controller_leg_mask.hpp>
+#include <rhex_controller/rhex_controller_math.hpp>
+#include <rhex_controller/rhex_controller_trace.hpp>
 
 // @author: Roman Buckle MEng
 
 namespace rhex_controller {
 
-    class RhexControllerSimple {
+    // Legs is the number of legs, the even ones forming one tripod (or tetrapod, for
+    // 8 legs) and the odd ones the other. Scalar is the type the gait is computed in
+    // (float, or Q16_16 of rhex_controller_fixed.hpp, for small boards), Math gives the
+    // remainder of the cycle (see rhex_controller_math.hpp), computed in double.
+    template <size_t Legs = default_legs, typename Scalar = double, typename Math = StdMath>
+    class BasicRhexControllerSimple {
     public:
-        typedef std::array<double, ARRAY_DIM> array_t;
+        static_assert(Legs % 2 == 0, "the simple gait needs an even number of legs");
+
+        typedef Scalar scalar_t;
+        typedef Math math_t;
+        typedef std::array<double, 100> array_t;
+        typedef std::array<Scalar, Legs> output_t;
+        typedef ControlCommand<Legs, Scalar> command_t;
+        typedef GainSchedule<Legs, Scalar> gain_schedule_t;
+
+        static constexpr size_t legs = Legs;
+        static constexpr size_t ctrl_size = 48;
+        // degrees of freedom of the robot: the 6 of the floating base, then the
+        // actuated hip of each leg and the 7 passive joints of its segments.
+        // TODO could vary with leg removal
+        static constexpr size_t dofs = 6 + 8 * Legs;
 
-        RhexControllerSimple() {}
+        static constexpr Scalar pi = Scalar(rhex_controller::pi);
 
-        RhexControllerSimple(const std::vector<double>& ctrl, std::vector<int> broken_legs)
-            : _broken_legs(broken_legs)
+        typedef std::array<Scalar, dofs> gains_t;
+
+        // Everything pos(t) changes (the targets are a function of t, only the time
+        // and the gains are kept), copied by snapshot() and restore() without touching the heap (see
+        // rhex_controller_snapshot.hpp), and the shift of set_gait_phase
+        struct snapshot_t {
+            double last_time;
+            double time_shift;
+            gains_t Kp;
+            gains_t Kd;
+        };
+
+        BasicRhexControllerSimple() : _last_time(0), _time_shift(0)
         {
-            set_parameters(ctrl);
+            set_pd(5., 0.1);
+        }
 
-            if (_Kp.size() == 0)
-                set_pd(5., 0.1);
+        BasicRhexControllerSimple(const std::vector<double>& ctrl, std::vector<int> broken_legs = std::vector<int>())
+            : _last_time(0), _time_shift(0), _broken_legs(broken_legs), _mask(broken_legs)
+        {
+            set_parameters(ctrl);
+            set_pd(5., 0.1);
         }
 
         void set_parameters(const std::vector<double>& ctrl)
         {
 
-            assert(ctrl.size() == 48);
+            assert(ctrl.size() == ctrl_size);
             _controller = ctrl;
+            _last_time = 0;
+            _time_shift = 0;
         }
 
         void set_pd(double Kp, double Kd)
-        {	
-        	_Kp.clear();
-        	_Kd.clear();
-			// TODO 54, dof, could vary with leg removal
-            for(size_t i=0; i < 54 ;i++){
-            	_Kp.push_back(Kp);
-            	_Kd.push_back(Kd);
-            }
+        {
+            _Kp.fill(Kp);
+            _Kd.fill(Kd);
         }
 
         const std::vector<double>& parameters() const
@@ -52,9 +88,34 @@ namespace rhex_controller {
             return _controller;
         }
 
+        void snapshot(snapshot_t& snapshot) const
+        {
+            snapshot.last_time = _last_time;
+            snapshot.time_shift = _time_shift;
+            snapshot.Kp = _Kp;
+            snapshot.Kd = _Kd;
+        }
+
+        snapshot_t snapshot() const
+        {
+            snapshot_t s;
+            snapshot(s);
+            return s;
+        }
+
+        void restore(const snapshot_t& snapshot)
+        {
+            _last_time = snapshot.last_time;
+            _time_shift = snapshot.time_shift;
+            _Kp = snapshot.Kp;
+            _Kd = snapshot.Kd;
+        }
+
+        // broken legs get a target of 0 and no gains
         void set_broken(const std::vector<int> broken_legs)
         {
             _broken_legs = broken_legs;
+            _mask.set_broken(broken_legs);
         }
 
         const std::vector<int>& broken_legs() const
@@ -62,77 +123,227 @@ namespace rhex_controller {
             return _broken_legs;
         }
 
-        std::vector<double>  pos(double t) 
+        const LegMask<Legs>& leg_mask() const
         {
-            assert(_controller.size() == 48);
-            // a bit messy but creates 2 numbers ratio and other which are between 0 and 1 all the parameters about offset phase and other information is controlled by the control signal
-            double ratio = 0;
-            double help = 0;
-            double temp = 0;
-            double other = 0;
+            return _mask;
+        }
 
-            help = remainder(double(t), double(0.75)) / (0.75);
-            help = help + 0.5;
-            
-            ratio = (help < _controller[0]) ? help * _controller[1] * 2 : _controller[1] + (help - _controller[0]) * (1 - _controller[1]) * 2;
-            ratio = ratio + ((1 - _controller[1]) / 2);
+        // the gait cycle is fixed to 0.75s
+        Scalar period() const
+        {
+            return 0.75;
+        }
 
-            if(ratio > 1){
-                ratio = ratio-1;
-            }
+        // position of the last tick in the gait cycle, in [0, 1) (cycle_position)
+        double gait_phase() const
+        {
+            double phase = double(cycle_position(_last_time + _time_shift));
+            return phase - std::floor(phase);
+        }
 
-            temp = ((help + _controller[4]) > 1) ? help - _controller[4] : help + _controller[4];
-            other = (temp < _controller[2]) ? temp * _controller[3] * 2 : _controller[3] + (temp - _controller[2]) * (1 - _controller[3]) * 2;
-            other += ((1 - _controller[3]) / 2);
+        // moves the gait to cycle position phase at the last tick, by shifting the time
+        // the targets are computed at (until set_parameters), e.g. to carry on the phase
+        // of another gait (rhex_controller_hot_swap.hpp)
+        void set_gait_phase(double phase)
+        {
+            _time_shift = (phase - 0.5) * 0.75 - _last_time;
+        }
 
-            if (other > 1){
-                other = other-1;
-            }
+        std::vector<double> pos(double t)
+        {
+            output_t out;
+            pos(t, out);
 
             std::vector<double> tau(48, 0);
-            
-            // tau is the single target position vector and is updated here
-            for(size_t i = 0; i < 6; i++){
+            std::copy(out.begin(), out.end(), tau.begin());
+            return tau;
+        }
+
+        // same as pos(t) but writes the leg targets into out without touching the heap
+        void pos(double t, output_t& out)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, SIMPLE_POS);
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, std::numeric_limits<double>::quiet_NaN());
+            _last_time = t;
+            pos_at(t, out, _Kp);
+            _Kd.fill(_controller[6]);
+            for (size_t i = 0; i < Legs; ++i)
+                if (!_mask.live(i))
+                    _Kd[i+6] = 0;
+        }
+
+        // closed form of pos(t) that leaves the controller untouched, so it can be
+        // evaluated out of order or from several threads sharing one controller
+        void pos_at(double t, output_t& out) const
+        {
+            gains_t Kp;
+            pos_at(t, out, Kp);
+        }
+
+        // as above, also giving the proportional gains get_Kp() would return after pos(t)
+        void pos_at(double t, output_t& out, gains_t& Kp) const
+        {
+            assert(_controller.size() == ctrl_size);
+            // a bit messy but creates 2 numbers ratio and other which are between 0 and 1 all the parameters about offset phase and other information is controlled by the control signal
+            Scalar help = cycle_position(t + _time_shift);
+            Scalar ratio = rotation_ratio(help, _controller[0], _controller[1]);
+            Scalar temp = shifted_position(help, _controller[4]);
+            Scalar other = rotation_ratio(temp, _controller[2], _controller[3]);
+
+            // out is the single target position vector and is updated here
+            for(size_t i = 0; i < Legs; i++){
                 if((i % 2) == 0){
-                    tau[i]= ratio * 2 * PI;
+                    out[i]= ratio * 2 * pi;
                 } else {
-                    tau[i]= other * 2 * PI;
+                    out[i]= other * 2 * pi;
                 }
             }
             
-            // the proportional controller and integral controller are updated here
-            set_pd(_controller[5], _controller[6]);
+            // the proportional controller is updated here
+            Kp.fill(_controller[5]);
 
-            // they are then changed during their slow part or fast part of rotation
+            // it is then changed during their slow part or fast part of rotation
             if (help > _controller[0]){
-                _Kp[0+6] = _controller[7];
-                _Kp[2+6] = _controller[7];
-                _Kp[4+6] = _controller[7];
+                for (size_t i = 0; i < Legs; i += 2)
+                    Kp[i+6] = _controller[7];
             }
 
             if (temp > _controller[2]){
-                _Kp[1+6] = _controller[7];
-                _Kp[3+6] = _controller[7];
-                _Kp[5+6] = _controller[7];
+                for (size_t i = 1; i < Legs; i += 2)
+                    Kp[i+6] = _controller[7];
             }
 
-            return tau;
+            if (!_mask.all_live())
+            {
+                for (size_t i = 0; i < Legs; ++i)
+                {
+                    if (!_mask.live(i))
+                    {
+                        out[i] = 0;
+                        Kp[i+6] = 0;
+                    }
+                }
+            }
         }
 
-        std::vector<double> get_Kp(void){
-        	return _Kp;
+        // gains of command(), from the genome as those of pos(t): Kp is ctrl[5] in the
+        // slow part of the rotation and ctrl[7] in the fast one, Kd is ctrl[6]
+        gain_schedule_t gain_schedule() const
+        {
+            assert(_controller.size() == ctrl_size);
+            return gain_schedule_t(_controller[5], _controller[6], _controller[7], _controller[6]);
         }
 
-        std::vector<double> get_Kd(void){
-        	return _Kd;
+        // pos(t, command.angle) with the velocities and gains (see rhex_controller_command.hpp)
+        void command(double t, command_t& command)
+        {
+            RHEX_CONTROLLER_TRACE_SCOPE(timer, SIMPLE_POS);
+            RHEX_CONTROLLER_TRACE_TICK(timer, t, std::numeric_limits<double>::quiet_NaN());
+            _last_time = t;
+            command_at(t, command);
+        }
+
+        // the gait is a function of t alone, command(t) only records t for stance()
+        void command_at(double t, command_t& command) const
+        {
+            assert(_controller.size() == ctrl_size);
+            Scalar help = cycle_position(t + _time_shift);
+            Scalar temp = shifted_position(help, _controller[4]);
+
+            // per tripod: target, d(target)/dt (the cycle position moves by 1 / 0.75 per
+            // second) and whether it is in the slow part of its rotation, for the gains
+            Scalar speed = 2 * pi / Scalar(0.75);
+            Scalar angle[2] = {rotation_ratio(help, _controller[0], _controller[1]) * 2 * pi,
+                rotation_ratio(temp, _controller[2], _controller[3]) * 2 * pi};
+            Scalar velocity[2] = {rotation_speed(help, _controller[0], _controller[1]) * speed,
+                rotation_speed(temp, _controller[2], _controller[3]) * speed};
+            bool slow[2] = {!(help > _controller[0]), !(temp > _controller[2])};
+
+            Scalar Kp[2] = {Scalar(slow[0] ? _controller[5] : _controller[7]), Scalar(slow[1] ? _controller[5] : _controller[7])};
+            Scalar Kd = _controller[6];
+
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                Scalar live = _mask.live(i) ? 1 : 0;
+                command.angle[i] = angle[i % 2] * live;
+                command.velocity[i] = velocity[i % 2] * live;
+                command.Kp[i] = Kp[i % 2] * live;
+                command.Kd[i] = Kd * live;
+            }
+        }
+
+        // stance flags of the last tick, the slow part of the rotation of each tripod
+        // (see rhex_controller_descriptor.hpp)
+        void stance(std::array<bool, Legs>& stance) const
+        {
+            Scalar help = cycle_position(_last_time + _time_shift);
+            Scalar temp = shifted_position(help, _controller[4]);
+            bool slow[2] = {!(help > _controller[0]), !(temp > _controller[2])};
+
+            for (size_t i = 0; i < Legs; ++i)
+                stance[i] = _mask.live(i) && slow[i % 2];
+        }
+
+        // position within the 0.75s cycle, between 0 and 1
+        static Scalar cycle_position(double t)
+        {
+            return Math::remainder(double(t), double(0.75)) / (0.75) + 0.5;
+        }
+
+        // position of the second tripod, shifted by its phase offset
+        static Scalar shifted_position(Scalar help, Scalar shift)
+        {
+            return ((help + shift) > 1) ? help - shift : help + shift;
+        }
+
+        // ratio of the full rotation done at cycle position x, where split is the
+        // point at which the leg switches between its fast and slow part of rotation
+        static Scalar rotation_ratio(Scalar x, Scalar split, Scalar speed)
+        {
+            Scalar ratio = (x < split) ? x * speed * 2 : speed + (x - split) * (1 - speed) * 2;
+            ratio = ratio + ((1 - speed) / 2);
+
+            return (ratio > 1) ? ratio - 1 : ratio;
+        }
+
+        // derivative of rotation_ratio with respect to x
+        static Scalar rotation_speed(Scalar x, Scalar split, Scalar speed)
+        {
+            return (x < split) ? speed * 2 : (1 - speed) * 2;
+        }
+
+        const gains_t& get_Kp(void) const {
+            return _Kp;
+        }
+
+        const gains_t& get_Kd(void) const {
+            return _Kd;
         }
 
     protected:
+        double _last_time;
+        // added to t by set_gait_phase
+        double _time_shift;
         std::vector<double> _controller;
         std::vector<int> _broken_legs;
-        std::vector<double> _Kp;
-        std::vector<double> _Kd;
+        LegMask<Legs> _mask;
+        gains_t _Kp;
+        gains_t _Kd;
     };
+
+    template <size_t Legs, typename Scalar, typename Math>
+    constexpr size_t BasicRhexControllerSimple<Legs, Scalar, Math>::legs;
+
+    template <size_t Legs, typename Scalar, typename Math>
+    constexpr size_t BasicRhexControllerSimple<Legs, Scalar, Math>::ctrl_size;
+
+    template <size_t Legs, typename Scalar, typename Math>
+    constexpr size_t BasicRhexControllerSimple<Legs, Scalar, Math>::dofs;
+
+    template <size_t Legs, typename Scalar, typename Math>
+    constexpr Scalar BasicRhexControllerSimple<Legs, Scalar, Math>::pi;
+
+    typedef BasicRhexControllerSimple<> RhexControllerSimple;
 } // namespace rhex_controller
 
 #endif
@@ -0,0 +1,114 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_SNAPSHOT_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_SNAPSHOT_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Forking rollouts: every controller has a snapshot_t, the part of its state that
+// pos(t) changes (phases, oscillators, motor inputs, time), as a trivially copyable
+// struct of fixed-size arrays. snapshot() and restore() copy it, at the cost of a
+// memcpy, where copying the whole controller would also copy its parameters and
+// coupling graph, which live on the heap. A snapshot belongs to the parameters
+// (set_parameters, set_broken, set_integrator) it was taken with.
+//
+// SnapshotPool keeps a fixed number of them, allocated once, for searches that
+// branch a rollout many times:
+//
+//     rhex_controller::SnapshotPool<rhex_controller::RhexControllerHopf> pool(1024);
+//     size_t root = pool.save(hopf);
+//     for (...)
+//     {
+//         pool.restore(root, hopf);
+//         // roll out one branch from the root
+//     }
+//     pool.release(root);
+//
+// A pool is not thread safe; give each worker its own.
+
+namespace rhex_controller {
+
+    template <typename Controller>
+    class SnapshotPool {
+    public:
+        typedef typename Controller::snapshot_t snapshot_t;
+
+        static_assert(std::is_trivially_copyable<snapshot_t>::value, "snapshot_t must be trivially copyable");
+
+        // returned by save() when every snapshot is in use
+        static constexpr size_t none = size_t(-1);
+
+        SnapshotPool(size_t capacity = 0)
+        {
+            reserve(capacity);
+        }
+
+        // allocates capacity snapshots, all free (the saved ones are dropped)
+        void reserve(size_t capacity)
+        {
+            _snapshots.assign(capacity, snapshot_t());
+            _free.clear();
+            _free.reserve(capacity);
+            for (size_t k = capacity; k > 0; --k)
+                _free.push_back(k - 1);
+        }
+
+        // snapshot of controller in a free slot, whose index it returns (none if the
+        // pool is full). Never allocates.
+        size_t save(const Controller& controller)
+        {
+            if (_free.empty())
+                return none;
+            size_t slot = _free.back();
+            _free.pop_back();
+            controller.snapshot(_snapshots[slot]);
+            return slot;
+        }
+
+        // overwrites the snapshot of a slot in use
+        void save(size_t slot, const Controller& controller)
+        {
+            assert(slot < _snapshots.size());
+            controller.snapshot(_snapshots[slot]);
+        }
+
+        void restore(size_t slot, Controller& controller) const
+        {
+            assert(slot < _snapshots.size());
+            controller.restore(_snapshots[slot]);
+        }
+
+        // gives the slot back to the pool
+        void release(size_t slot)
+        {
+            assert(slot < _snapshots.size() && _free.size() < _snapshots.size());
+            _free.push_back(slot);
+        }
+
+        const snapshot_t& operator[](size_t slot) const
+        {
+            return _snapshots[slot];
+        }
+
+        size_t capacity() const
+        {
+            return _snapshots.size();
+        }
+
+        // free slots
+        size_t available() const
+        {
+            return _free.size();
+        }
+
+    protected:
+        std::vector<snapshot_t> _snapshots;
+        std::vector<size_t> _free;
+    };
+
+    template <typename Controller>
+    constexpr size_t SnapshotPool<Controller>::none;
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_THREAD_POOL_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool for the population loops (rollouts, evolution).
+// parallel_for(n, task) splits [0, n) in one contiguous block per worker. Each
+// worker takes its own items from the back of its queue and, once it runs dry,
+// steals from the front of the others', so a few long rollouts do not leave the
+// other cores idle. task(worker, i) knows which worker runs it, so per worker
+// resources (a simulated world, scratch buffers) need no locking.
+// Link with -pthread.
+
+namespace rhex_controller {
+
+    class ThreadPool {
+    public:
+        // threads = 0 uses one worker per hardware thread
+        explicit ThreadPool(size_t threads = 0)
+            : _remaining(0), _generation(0), _stop(false)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+
+            for (size_t w = 0; w < threads; ++w)
+                _queues.emplace_back(new Queue());
+            for (size_t w = 0; w < threads; ++w)
+                _workers.emplace_back(&ThreadPool::work, this, w);
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+
+            for (size_t w = 0; w < _workers.size(); ++w)
+                _workers[w].join();
+        }
+
+        size_t size() const
+        {
+            return _workers.size();
+        }
+
+        // Runs task(worker, i) for every i in [0, n) and returns once all are done,
+        // worker being in [0, size()). The first exception thrown by a task is
+        // rethrown here, after the other items ran. Not reentrant: call it from
+        // one thread at a time, and not from inside a task.
+        template <typename Task>
+        void parallel_for(size_t n, Task task)
+        {
+            if (n == 0)
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _task = task;
+                _error = nullptr;
+                _remaining = n;
+
+                size_t threads = _workers.size();
+                for (size_t w = 0; w < threads; ++w)
+                {
+                    std::lock_guard<std::mutex> queue_lock(_queues[w]->mutex);
+                    for (size_t i = w * n / threads; i < (w + 1) * n / threads; ++i)
+                        _queues[w]->items.push_back(i);
+                }
+
+                ++_generation;
+            }
+            _wake.notify_all();
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this] { return _remaining == 0; });
+
+            if (_error)
+                std::rethrow_exception(_error);
+        }
+
+    protected:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<size_t> items;
+        };
+
+        void work(size_t worker)
+        {
+            size_t seen = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [&] { return _stop || _generation != seen; });
+                    if (_stop)
+                        return;
+                    seen = _generation;
+                }
+
+                size_t i;
+                while (pop(worker, i) || steal(worker, i))
+                {
+                    try {
+                        _task(worker, i);
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        if (!_error)
+                            _error = std::current_exception();
+                    }
+
+                    if (--_remaining == 0)
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        _done.notify_all();
+                    }
+                }
+            }
+        }
+
+        bool pop(size_t worker, size_t& i)
+        {
+            Queue& queue = *_queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.items.empty())
+                return false;
+
+            i = queue.items.back();
+            queue.items.pop_back();
+            return true;
+        }
+
+        bool steal(size_t worker, size_t& i)
+        {
+            for (size_t k = 1; k < _queues.size(); ++k)
+            {
+                Queue& queue = *_queues[(worker + k) % _queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.items.empty())
+                    continue;
+
+                i = queue.items.front();
+                queue.items.pop_front();
+                return true;
+            }
+
+            return false;
+        }
+
+        std::vector<std::thread> _workers;
+        std::vector<std::unique_ptr<Queue> > _queues;
+
+        std::function<void(size_t, size_t)> _task;
+        std::exception_ptr _error;
+        std::atomic<size_t> _remaining;
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        size_t _generation;
+        bool _stop;
+    };
+} // namespace rhex_controller
+
+#endif
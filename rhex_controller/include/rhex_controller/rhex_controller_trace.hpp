@@ -0,0 +1,373 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_TRACE_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_TRACE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Optional instrumentation of the controller ticks. Compiled in only when
+// RHEX_CONTROLLER_TRACE is defined (e.g. CXXFLAGS=-DRHEX_CONTROLLER_TRACE), the
+// RHEX_CONTROLLER_TRACE_* macros expand to nothing otherwise.
+//
+// Every instrumented scope feeds, from any thread and without locks:
+//   - a log2 histogram of its latency (bucket b counts calls of 2^b to 2^(b+1) ns)
+//   - statistics of the dt between the ticks it is given (mean, deviation, extremes)
+//   - the number of 2 pi wrap corrections it made (Hopf motor input)
+//   - one record per call in a ring buffer that keeps the last
+//     RHEX_CONTROLLER_TRACE_CAPACITY calls, overwriting the oldest
+//
+// Trace::instance().dump(path) writes all of it as text, reset() clears it.
+
+#ifndef RHEX_CONTROLLER_TRACE_CAPACITY
+#define RHEX_CONTROLLER_TRACE_CAPACITY 65536
+#endif
+
+namespace rhex_controller {
+    namespace trace {
+
+        enum Scope : uint32_t {
+            BUEHLER_POS,
+            SIMPLE_POS,
+            CPG_POS,
+            HOPF_POS,
+            HOPF_AMP_COUPLE_UPDATE,
+            HOPF_MOTOR_INPUT, // land_couple and the 2 pi wrap corrections
+            SCOPES
+        };
+
+        inline const char* scope_name(uint32_t scope)
+        {
+            static const char* names[SCOPES] = {
+                "buehler_pos", "simple_pos", "cpg_pos", "hopf_pos", "hopf_amp_couple_update", "hopf_motor_input"};
+            return scope < SCOPES ? names[scope] : "unknown";
+        }
+
+        struct Record {
+            uint64_t sequence;
+            uint32_t scope;
+            uint32_t wraps;
+            uint64_t latency_ns;
+            // NaN when the scope was not given them
+            double time;
+            double dt;
+        };
+
+        // Multi-producer ring: a writer claims a slot with one fetch_add and guards it
+        // with a sequence number (odd while written), so a reader can tell complete
+        // records from ones being overwritten.
+        template <size_t Capacity>
+        class Ring {
+        public:
+            static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of 2");
+
+            Ring() : _head(0)
+            {
+                for (Slot& slot : _slots)
+                    slot.sequence.store(0, std::memory_order_relaxed);
+            }
+
+            void push(uint32_t scope, uint32_t wraps, uint64_t latency_ns, double time, double dt)
+            {
+                uint64_t n = _head.fetch_add(1, std::memory_order_relaxed);
+                Slot& slot = _slots[n & (Capacity - 1)];
+
+                slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                slot.scope.store(scope, std::memory_order_relaxed);
+                slot.wraps.store(wraps, std::memory_order_relaxed);
+                slot.latency_ns.store(latency_ns, std::memory_order_relaxed);
+                slot.time.store(time, std::memory_order_relaxed);
+                slot.dt.store(dt, std::memory_order_relaxed);
+                slot.sequence.store(2 * n + 2, std::memory_order_release);
+            }
+
+            // total number of records pushed, including the overwritten ones
+            uint64_t pushed() const
+            {
+                return _head.load(std::memory_order_acquire);
+            }
+
+            // the complete records still in the ring, oldest first
+            std::vector<Record> snapshot() const
+            {
+                uint64_t head = pushed();
+                uint64_t first = head > Capacity ? head - Capacity : 0;
+
+                std::vector<Record> records;
+                records.reserve(head - first);
+                for (uint64_t n = first; n < head; ++n)
+                {
+                    const Slot& slot = _slots[n & (Capacity - 1)];
+                    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+
+                    Record r;
+                    r.sequence = n;
+                    r.scope = slot.scope.load(std::memory_order_relaxed);
+                    r.wraps = slot.wraps.load(std::memory_order_relaxed);
+                    r.latency_ns = slot.latency_ns.load(std::memory_order_relaxed);
+                    r.time = slot.time.load(std::memory_order_relaxed);
+                    r.dt = slot.dt.load(std::memory_order_relaxed);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (before == 2 * n + 2 && slot.sequence.load(std::memory_order_relaxed) == before)
+                        records.push_back(r);
+                }
+                return records;
+            }
+
+            void clear()
+            {
+                for (Slot& slot : _slots)
+                    slot.sequence.store(0, std::memory_order_relaxed);
+                _head.store(0, std::memory_order_release);
+            }
+
+        protected:
+            struct Slot {
+                std::atomic<uint64_t> sequence;
+                std::atomic<uint32_t> scope;
+                std::atomic<uint32_t> wraps;
+                std::atomic<uint64_t> latency_ns;
+                std::atomic<double> time;
+                std::atomic<double> dt;
+            };
+
+            std::atomic<uint64_t> _head;
+            std::array<Slot, Capacity> _slots;
+        };
+
+        template <typename T>
+        void atomic_max(std::atomic<T>& target, T value)
+        {
+            T current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+
+        template <typename T>
+        void atomic_min(std::atomic<T>& target, T value)
+        {
+            T current = target.load(std::memory_order_relaxed);
+            while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+
+        inline void atomic_add(std::atomic<double>& target, double value)
+        {
+            double current = target.load(std::memory_order_relaxed);
+            while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+            }
+        }
+
+        struct ScopeStats {
+            static constexpr size_t buckets = 40;
+
+            std::atomic<uint64_t> calls;
+            std::atomic<uint64_t> total_ns;
+            std::atomic<uint64_t> max_ns;
+            std::array<std::atomic<uint64_t>, buckets> histogram;
+
+            std::atomic<uint64_t> wraps;
+            std::atomic<uint32_t> max_wraps;
+
+            std::atomic<uint64_t> dt_count;
+            std::atomic<double> dt_sum;
+            std::atomic<double> dt_squares;
+            std::atomic<double> dt_min;
+            std::atomic<double> dt_max;
+
+            void clear()
+            {
+                calls.store(0);
+                total_ns.store(0);
+                max_ns.store(0);
+                for (std::atomic<uint64_t>& count : histogram)
+                    count.store(0);
+                wraps.store(0);
+                max_wraps.store(0);
+                dt_count.store(0);
+                dt_sum.store(0);
+                dt_squares.store(0);
+                dt_min.store(std::numeric_limits<double>::infinity());
+                dt_max.store(-std::numeric_limits<double>::infinity());
+            }
+
+            static size_t bucket(uint64_t ns)
+            {
+                size_t b = 0;
+                while (ns > 1 && b + 1 < buckets)
+                {
+                    ns >>= 1;
+                    ++b;
+                }
+                return b;
+            }
+
+            void add(uint64_t ns, uint32_t wrap_count, double dt)
+            {
+                calls.fetch_add(1, std::memory_order_relaxed);
+                total_ns.fetch_add(ns, std::memory_order_relaxed);
+                atomic_max(max_ns, ns);
+                histogram[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+                if (wrap_count)
+                {
+                    wraps.fetch_add(wrap_count, std::memory_order_relaxed);
+                    atomic_max(max_wraps, wrap_count);
+                }
+
+                if (!std::isnan(dt))
+                {
+                    dt_count.fetch_add(1, std::memory_order_relaxed);
+                    atomic_add(dt_sum, dt);
+                    atomic_add(dt_squares, dt * dt);
+                    atomic_min(dt_min, dt);
+                    atomic_max(dt_max, dt);
+                }
+            }
+        };
+
+        class Trace {
+        public:
+            typedef Ring<RHEX_CONTROLLER_TRACE_CAPACITY> ring_t;
+
+            static Trace& instance()
+            {
+                static Trace trace;
+                return trace;
+            }
+
+            void record(uint32_t scope, uint64_t latency_ns, uint32_t wraps, double time, double dt)
+            {
+                _stats[scope].add(latency_ns, wraps, dt);
+                _ring.push(scope, wraps, latency_ns, time, dt);
+            }
+
+            const ScopeStats& stats(uint32_t scope) const
+            {
+                return _stats[scope];
+            }
+
+            const ring_t& ring() const
+            {
+                return _ring;
+            }
+
+            // not to be called while controllers are running
+            void reset()
+            {
+                for (ScopeStats& stats : _stats)
+                    stats.clear();
+                _ring.clear();
+            }
+
+            // summary per scope, the latency histograms, then the records of the ring
+            bool dump(const std::string& path) const
+            {
+                std::ofstream out(path.c_str());
+                if (!out)
+                    return false;
+
+                out.precision(9);
+                out << "# scope calls mean_ns max_ns wraps max_wraps dt_mean dt_stddev dt_min dt_max\n";
+                for (uint32_t s = 0; s < SCOPES; ++s)
+                {
+                    const ScopeStats& st = _stats[s];
+                    uint64_t calls = st.calls.load();
+                    if (!calls)
+                        continue;
+
+                    uint64_t n = st.dt_count.load();
+                    double mean = n ? st.dt_sum.load() / n : 0;
+                    double variance = n ? std::max(0., st.dt_squares.load() / n - mean * mean) : 0;
+
+                    out << scope_name(s) << ' ' << calls << ' ' << double(st.total_ns.load()) / calls << ' ' << st.max_ns.load()
+                        << ' ' << st.wraps.load() << ' ' << st.max_wraps.load() << ' ' << mean << ' ' << std::sqrt(variance)
+                        << ' ' << (n ? st.dt_min.load() : 0) << ' ' << (n ? st.dt_max.load() : 0) << '\n';
+                }
+
+                out << "# histogram: scope, then the counts of calls of [2^b, 2^(b+1)) ns for b = 0..." << ScopeStats::buckets - 1 << "\n";
+                for (uint32_t s = 0; s < SCOPES; ++s)
+                {
+                    if (!_stats[s].calls.load())
+                        continue;
+                    out << scope_name(s);
+                    for (const std::atomic<uint64_t>& count : _stats[s].histogram)
+                        out << ' ' << count.load();
+                    out << '\n';
+                }
+
+                out << "# records (" << _ring.pushed() << " pushed): sequence scope time dt latency_ns wraps\n";
+                for (const Record& r : _ring.snapshot())
+                    out << r.sequence << ' ' << scope_name(r.scope) << ' ' << r.time << ' ' << r.dt << ' ' << r.latency_ns << ' ' << r.wraps << '\n';
+
+                return bool(out);
+            }
+
+        protected:
+            Trace()
+            {
+                for (ScopeStats& stats : _stats)
+                    stats.clear();
+            }
+
+            std::array<ScopeStats, SCOPES> _stats;
+            ring_t _ring;
+        };
+
+        // times its own lifetime and records it in Trace on destruction
+        class ScopeTimer {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            explicit ScopeTimer(Scope scope)
+                : wraps(0), _scope(scope), _time(std::numeric_limits<double>::quiet_NaN()),
+                  _dt(std::numeric_limits<double>::quiet_NaN()), _start(clock::now()) {}
+
+            ScopeTimer(const ScopeTimer&) = delete;
+            ScopeTimer& operator=(const ScopeTimer&) = delete;
+
+            ~ScopeTimer()
+            {
+                uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _start).count();
+                Trace::instance().record(_scope, ns, wraps, _time, _dt);
+            }
+
+            void tick(double time, double dt)
+            {
+                _time = time;
+                _dt = dt;
+            }
+
+            uint32_t wraps;
+
+        protected:
+            Scope _scope;
+            double _time;
+            double _dt;
+            clock::time_point _start;
+        };
+    } // namespace trace
+} // namespace rhex_controller
+
+#ifdef RHEX_CONTROLLER_TRACE
+// times the rest of the enclosing block as the given trace::Scope
+#define RHEX_CONTROLLER_TRACE_SCOPE(timer, scope) rhex_controller::trace::ScopeTimer timer(rhex_controller::trace::scope)
+// time of the tick and dt since the previous one (NaN if unknown)
+#define RHEX_CONTROLLER_TRACE_TICK(timer, t, dt) timer.tick(t, dt)
+// one 2 pi wrap correction
+#define RHEX_CONTROLLER_TRACE_WRAP(timer) ++timer.wraps
+#else
+#define RHEX_CONTROLLER_TRACE_SCOPE(timer, scope) ((void)0)
+#define RHEX_CONTROLLER_TRACE_TICK(timer, t, dt) ((void)0)
+#define RHEX_CONTROLLER_TRACE_WRAP(timer) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,593 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_TRAJECTORY_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_TRAJECTORY_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rhex_controller/rhex_controller_common.hpp>
+
+// Binary trajectories of controller outputs, for offline analysis and replay.
+//
+// A trajectory file is a 32 bytes header followed by fixed-size records, one per
+// tick: the time, the target of each leg, the leg gains, and the oscillator state.
+// TrajectoryWriter copies the records into preallocated blocks on the control
+// thread and a writer thread writes the full blocks to the file, so a tick costs
+// a copy. TrajectoryReader memory-maps a file and uses its records in place, with
+// random access by index or by time. ReplayController plays a trajectory back
+// through the pos(t) interface of the controllers.
+// Little-endian hosts only, as the records are read without conversion.
+// Link with -pthread.
+
+namespace rhex_controller {
+
+    namespace trajectory {
+        // fields of the records that hold recorded values (the others are 0)
+        enum Fields : uint32_t {
+            TARGETS = 1,
+            GAINS = 2, // Kp and Kd, from controllers with get_Kp() and get_Kd()
+            OSCILLATOR = 4, // Hopf u and v, or CPG phases
+            ALL_FIELDS = 7
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t header_size;
+            uint32_t legs;
+            uint32_t record_size;
+            uint32_t fields;
+            uint32_t padding;
+        };
+
+        static_assert(sizeof(Header) == 32, "the records must stay 8 bytes aligned");
+
+        template <size_t Legs>
+        struct Record {
+            double time;
+            std::array<double, Legs> target;
+            std::array<double, Legs> Kp;
+            std::array<double, Legs> Kd;
+            // u of each leg then v of each leg for RhexControllerHopf, the phase of
+            // each leg then 0s for RhexControllerCPG
+            std::array<double, 2 * Legs> oscillator;
+        };
+
+        // controllers with leg gains (RhexControllerSimple, see leg_gains)
+        template <size_t Legs, typename Controller>
+        uint32_t record_gains(const Controller& controller, Record<Legs>& record)
+        {
+            if (leg_gains(controller, record.Kp, record.Kd))
+                return GAINS;
+            record.Kp.fill(0);
+            record.Kd.fill(0);
+            return 0;
+        }
+
+        // RhexControllerHopf: u and v, packed in lanes (RhexControllerCPG has a state()
+        // too, its phases, but no lanes)
+        template <size_t Legs, typename Controller>
+        auto record_oscillator(const Controller& controller, Record<Legs>& record, int, int) -> decltype(controller.state(), Controller::lanes, uint32_t())
+        {
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                record.oscillator[i] = controller.state()[i];
+                record.oscillator[Legs + i] = controller.state()[Controller::lanes + i];
+            }
+            return OSCILLATOR;
+        }
+
+        // RhexControllerCPG: phases
+        template <size_t Legs, typename Controller>
+        auto record_oscillator(const Controller& controller, Record<Legs>& record, int, long) -> decltype(controller.get_phase(), uint32_t())
+        {
+            for (size_t i = 0; i < Legs; ++i)
+            {
+                record.oscillator[i] = controller.get_phase()[i];
+                record.oscillator[Legs + i] = 0;
+            }
+            return OSCILLATOR;
+        }
+
+        template <size_t Legs, typename Controller>
+        uint32_t record_oscillator(const Controller&, Record<Legs>& record, long, long)
+        {
+            record.oscillator.fill(0);
+            return 0;
+        }
+
+        // fills record with the state of controller after the tick at time t that gave targets,
+        // and returns the fields that were recorded
+        template <size_t Legs, typename Controller, typename Targets>
+        uint32_t fill(double t, const Controller& controller, const Targets& targets, Record<Legs>& record)
+        {
+            record.time = t;
+            for (size_t i = 0; i < Legs; ++i)
+                record.target[i] = targets[i];
+            return TARGETS | record_gains(controller, record) | record_oscillator(controller, record, 0, 0);
+        }
+
+        // fields a controller records, to give to the writer
+        template <typename Controller>
+        uint32_t fields(const Controller& controller)
+        {
+            Record<Controller::legs> record;
+            typename Controller::output_t targets = typename Controller::output_t();
+            return fill(0, controller, targets, record);
+        }
+    } // namespace trajectory
+
+    template <size_t Legs = default_legs>
+    class BasicTrajectoryWriter {
+    public:
+        typedef trajectory::Record<Legs> record_t;
+
+        static const uint32_t version = 1;
+        static constexpr size_t legs = Legs;
+
+        // Creates (or truncates) the file. fields tells readers which fields hold values,
+        // trajectory::fields(controller) gives the ones record() fills for a controller.
+        // Records are written by blocks of block_records; when the writer thread is
+        // blocks behind, the control thread waits for it (see stalls()).
+        // Throws std::runtime_error if the file cannot be created.
+        BasicTrajectoryWriter(const std::string& path, uint32_t fields = trajectory::ALL_FIELDS,
+            size_t block_records = 1024, size_t blocks = 8)
+            : _fd(-1), _current(nullptr), _count(0), _written(0), _stalls(0), _busy(false), _stop(false), _failed(false)
+        {
+            _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (_fd < 0)
+                throw std::runtime_error("TrajectoryWriter: cannot create " + path);
+
+            trajectory::Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, "RHEXTRAJ", 8);
+            header.version = version;
+            header.header_size = sizeof(trajectory::Header);
+            header.legs = Legs;
+            header.record_size = sizeof(record_t);
+            header.fields = fields;
+            if (!write_all(&header, sizeof(header)))
+            {
+                ::close(_fd);
+                throw std::runtime_error("TrajectoryWriter: cannot write to " + path);
+            }
+
+            _blocks.resize(std::max<size_t>(blocks, 2));
+            for (size_t b = 0; b < _blocks.size(); ++b)
+            {
+                _blocks[b].records.resize(std::max<size_t>(block_records, 1));
+                _free.push_back(&_blocks[b]);
+            }
+            _current = take_free();
+
+            _thread = std::thread(&BasicTrajectoryWriter::work, this);
+        }
+
+        BasicTrajectoryWriter(const BasicTrajectoryWriter&) = delete;
+        BasicTrajectoryWriter& operator=(const BasicTrajectoryWriter&) = delete;
+
+        // writes what is left, errors are dropped (call close() to see them)
+        ~BasicTrajectoryWriter()
+        {
+            try {
+                close();
+            }
+            catch (...) {
+            }
+        }
+
+        // control thread side: appends a record
+        void write(const record_t& record)
+        {
+            _current->records[_count] = record;
+            if (++_count == _current->records.size())
+                hand_over();
+        }
+
+        // control thread side: appends the record of the tick at time t of controller,
+        // which gave targets
+        template <typename Controller, typename Targets>
+        void record(double t, const Controller& controller, const Targets& targets)
+        {
+            trajectory::fill(t, controller, targets, _current->records[_count]);
+            if (++_count == _current->records.size())
+                hand_over();
+        }
+
+        // hands the records appended so far to the writer thread and waits until they
+        // are in the file. Throws std::runtime_error if a write failed.
+        void flush()
+        {
+            if (_fd < 0)
+                return;
+
+            if (_count > 0)
+                hand_over();
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this] { return _full.empty() && !_busy; });
+            if (_failed)
+                throw std::runtime_error("TrajectoryWriter: a write failed, the trajectory is incomplete");
+        }
+
+        // flushes, stops the writer thread and closes the file
+        void close()
+        {
+            if (_fd < 0)
+                return;
+
+            bool failed = false;
+            try {
+                flush();
+            }
+            catch (const std::runtime_error&) {
+                failed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_one();
+            _thread.join();
+
+            failed = (::close(_fd) != 0) || failed;
+            _fd = -1;
+            if (failed)
+                throw std::runtime_error("TrajectoryWriter: a write failed, the trajectory is incomplete");
+        }
+
+        // records in the file so far
+        size_t written() const
+        {
+            return _written.load(std::memory_order_relaxed);
+        }
+
+        // number of times the control thread waited for a free block
+        size_t stalls() const
+        {
+            return _stalls;
+        }
+
+    protected:
+        struct Block {
+            std::vector<record_t> records;
+            size_t count;
+        };
+
+        void hand_over()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _current->count = _count;
+                _full.push_back(_current);
+            }
+            _wake.notify_one();
+
+            _count = 0;
+            _current = take_free();
+        }
+
+        Block* take_free()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_free.empty())
+            {
+                ++_stalls;
+                _done.wait(lock, [this] { return !_free.empty(); });
+            }
+
+            Block* block = _free.back();
+            _free.pop_back();
+            return block;
+        }
+
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (;;)
+            {
+                _wake.wait(lock, [this] { return _stop || !_full.empty(); });
+                if (_full.empty())
+                    return;
+
+                Block* block = _full.front();
+                _full.pop_front();
+                _busy = true;
+                lock.unlock();
+
+                // after a failure the records are dropped, the file stays a whole number of records
+                if (!_failed && write_all(block->records.data(), block->count * sizeof(record_t)))
+                    _written.fetch_add(block->count, std::memory_order_relaxed);
+                else
+                    _failed = true;
+
+                lock.lock();
+                _busy = false;
+                _free.push_back(block);
+                _done.notify_all();
+            }
+        }
+
+        bool write_all(const void* data, size_t size)
+        {
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                ssize_t n = ::write(_fd, bytes, size);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                bytes += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        int _fd;
+        std::vector<Block> _blocks;
+        // block being filled by the control thread, and its record count
+        Block* _current;
+        size_t _count;
+        std::atomic<size_t> _written;
+        size_t _stalls;
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::vector<Block*> _free;
+        std::deque<Block*> _full;
+        bool _busy;
+        bool _stop;
+        std::atomic<bool> _failed;
+        std::thread _thread;
+    };
+
+    template <size_t Legs = default_legs>
+    class BasicTrajectoryReader {
+    public:
+        typedef trajectory::Record<Legs> record_t;
+
+        static const uint32_t version = 1;
+        static constexpr size_t legs = Legs;
+
+        BasicTrajectoryReader() : _data(nullptr), _size(0) {}
+
+        explicit BasicTrajectoryReader(const std::string& path) : _data(nullptr), _size(0)
+        {
+            open(path);
+        }
+
+        BasicTrajectoryReader(const BasicTrajectoryReader&) = delete;
+        BasicTrajectoryReader& operator=(const BasicTrajectoryReader&) = delete;
+
+        BasicTrajectoryReader(BasicTrajectoryReader&& other) : _data(other._data), _size(other._size)
+        {
+            other._data = nullptr;
+            other._size = 0;
+        }
+
+        ~BasicTrajectoryReader()
+        {
+            close();
+        }
+
+        // maps the file and checks its layout, throws std::runtime_error if it is not a
+        // trajectory of this version and leg count. A record cut short (the writer did
+        // not close the file) is left out.
+        void open(const std::string& path)
+        {
+            close();
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("TrajectoryReader: cannot open " + path);
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(trajectory::Header)))
+            {
+                ::close(fd);
+                throw std::runtime_error("TrajectoryReader: " + path + " is too short");
+            }
+
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("TrajectoryReader: cannot map " + path);
+
+            _data = static_cast<const char*>(data);
+            _size = st.st_size;
+
+            const trajectory::Header& h = header();
+            if (std::memcmp(h.magic, "RHEXTRAJ", 8) != 0 || h.version != version
+                || h.header_size != sizeof(trajectory::Header) || h.legs != Legs || h.record_size != sizeof(record_t))
+            {
+                close();
+                throw std::runtime_error("TrajectoryReader: " + path + " is not a version 1 trajectory of this leg count");
+            }
+        }
+
+        void close()
+        {
+            if (_data)
+                munmap(const_cast<char*>(_data), _size);
+            _data = nullptr;
+            _size = 0;
+        }
+
+        bool is_open() const
+        {
+            return _data != nullptr;
+        }
+
+        const trajectory::Header& header() const
+        {
+            return *reinterpret_cast<const trajectory::Header*>(_data);
+        }
+
+        uint32_t fields() const
+        {
+            return header().fields;
+        }
+
+        size_t size() const
+        {
+            return _data ? (_size - sizeof(trajectory::Header)) / sizeof(record_t) : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        const record_t* records() const
+        {
+            return reinterpret_cast<const record_t*>(_data + sizeof(trajectory::Header));
+        }
+
+        const record_t& operator[](size_t k) const
+        {
+            return records()[k];
+        }
+
+        // index of the last record at or before time t (0 if t is before the first one),
+        // the records being in increasing time
+        size_t find(double t) const
+        {
+            const record_t* first = records();
+            const record_t* last = first + size();
+            const record_t* after = std::upper_bound(first, last, t,
+                [](double time, const record_t& r) { return time < r.time; });
+            return (after == first) ? 0 : (after - first) - 1;
+        }
+
+    protected:
+        const char* _data;
+        size_t _size;
+    };
+
+    // Plays a trajectory back: pos(t) gives the targets of the last record at or before
+    // t (the ones that were sent at that time), the first record before it starts and
+    // the last one after it ends. Ticks with increasing times move a cursor, other
+    // times are searched. Copies share the mapping.
+    template <size_t Legs = default_legs>
+    class BasicReplayController {
+    public:
+        typedef double scalar_t;
+        typedef std::array<double, Legs> output_t;
+        typedef BasicTrajectoryReader<Legs> reader_t;
+        typedef trajectory::Record<Legs> record_t;
+
+        static constexpr size_t legs = Legs;
+        static constexpr double pi = rhex_controller::pi;
+
+        BasicReplayController() : _cursor(0) {}
+
+        explicit BasicReplayController(const std::string& path)
+            : _reader(std::make_shared<reader_t>(path)), _cursor(0)
+        {
+            check();
+        }
+
+        explicit BasicReplayController(std::shared_ptr<const reader_t> reader)
+            : _reader(reader), _cursor(0)
+        {
+            check();
+        }
+
+        std::vector<double> pos(double t)
+        {
+            output_t output;
+            pos(t, output);
+            return std::vector<double>(output.begin(), output.end());
+        }
+
+        void pos(double t, output_t& output)
+        {
+            const record_t* records = _reader->records();
+            size_t size = _reader->size();
+
+            if (records[_cursor].time > t)
+                _cursor = _reader->find(t);
+            else
+            {
+                // a few steps forward for ticks at the recorded rate, a search for jumps
+                size_t steps = 0;
+                while (_cursor + 1 < size && records[_cursor + 1].time <= t && ++steps < 8)
+                    ++_cursor;
+                if (steps == 8)
+                    _cursor = _reader->find(t);
+            }
+
+            output = records[_cursor].target;
+        }
+
+        // record the last pos() played
+        const record_t& record() const
+        {
+            return (*_reader)[_cursor];
+        }
+
+        const reader_t& reader() const
+        {
+            return *_reader;
+        }
+
+        // time of the first and last records
+        double start() const
+        {
+            return (*_reader)[0].time;
+        }
+
+        double end() const
+        {
+            return (*_reader)[_reader->size() - 1].time;
+        }
+
+    protected:
+        void check() const
+        {
+            if (!_reader || _reader->empty() || !(_reader->fields() & trajectory::TARGETS))
+                throw std::runtime_error("ReplayController: the trajectory holds no targets");
+        }
+
+        std::shared_ptr<const reader_t> _reader;
+        size_t _cursor;
+    };
+
+    template <size_t Legs>
+    constexpr size_t BasicTrajectoryWriter<Legs>::legs;
+
+    template <size_t Legs>
+    constexpr size_t BasicTrajectoryReader<Legs>::legs;
+
+    template <size_t Legs>
+    constexpr size_t BasicReplayController<Legs>::legs;
+
+    template <size_t Legs>
+    constexpr double BasicReplayController<Legs>::pi;
+
+    typedef trajectory::Record<default_legs> TrajectoryRecord;
+    typedef BasicTrajectoryWriter<> TrajectoryWriter;
+    typedef BasicTrajectoryReader<> TrajectoryReader;
+    typedef BasicReplayController<> ReplayController;
+} // namespace rhex_controller
+
+#endif
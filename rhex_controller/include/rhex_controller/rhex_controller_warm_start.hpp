@@ -0,0 +1,151 @@
+#ifndef RHEX_CONTROLLER_RHEX_CONTROLLER_WARM_START_HPP
+#define RHEX_CONTROLLER_RHEX_CONTROLLER_WARM_START_HPP
+
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Warm starts of the oscillator controllers (RhexControllerHopf, RhexControllerCPG).
+//
+// From the state set_parameters() gives them, the oscillators need seconds of
+// integration before the gait locks into the phases of its coupling network, time
+// a rollout spends on a transient. warm_start() of the controllers puts them on the
+// limit cycle computed from the phase biases (locked_state()). WarmStartCache
+// goes further: once per parameter set it integrates a copy of the controller from
+// its locked state until it settles, and keeps the converged state under the
+// genome rounded to a grid, the integrator and the broken legs. Genomes within half
+// a grid step of a cached one then start from its converged state.
+
+namespace rhex_controller {
+
+    template <typename Controller>
+    class WarmStartCache {
+    public:
+        typedef typename Controller::state_t state_t;
+
+        // quantum: grid step of the genome values; settle: seconds integrated at dt
+        // steps on a miss; capacity: states kept, the oldest ones dropped first
+        WarmStartCache(double quantum = 1e-3, double settle = 10, double dt = 1e-3, size_t capacity = 4096)
+            : _quantum(quantum), _settle(settle), _dt(dt), _capacity(capacity), _hits(0), _misses(0) {}
+
+        // Sets the oscillators of controller, freshly set up with ctrl, on their limit
+        // cycle. Safe to call from several threads.
+        void warm_start(Controller& controller, const std::vector<double>& ctrl)
+        {
+            controller.set_state(converged_state(controller, ctrl));
+        }
+
+        // converged oscillator state of the controller's network with ctrl (its integrator
+        // and broken legs are kept)
+        state_t converged_state(const Controller& controller, const std::vector<double>& ctrl)
+        {
+            key_t key = make_key(controller, ctrl);
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                typename map_t::const_iterator found = _states.find(key);
+                if (found != _states.end())
+                {
+                    ++_hits;
+                    return found->second;
+                }
+            }
+
+            // computed outside the lock, two threads missing the same key both compute it
+            Controller copy(controller);
+            copy.set_parameters(ctrl);
+            copy.warm_start();
+            typename Controller::output_t output;
+            size_t steps = std::ceil(_settle / _dt);
+            for (size_t k = 1; k <= steps; ++k)
+                copy.pos(k * _dt, output);
+            state_t state = copy.state();
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_misses;
+            if (_states.insert(std::make_pair(key, state)).second)
+            {
+                _order.push_back(key);
+                while (_order.size() > _capacity)
+                {
+                    _states.erase(_order.front());
+                    _order.pop_front();
+                }
+            }
+            return state;
+        }
+
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _states.size();
+        }
+
+        size_t hits() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _hits;
+        }
+
+        size_t misses() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _misses;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _states.clear();
+            _order.clear();
+            _hits = _misses = 0;
+        }
+
+    protected:
+        typedef std::vector<long long> key_t;
+
+        struct KeyHash {
+            size_t operator()(const key_t& key) const
+            {
+                size_t h = key.size();
+                for (long long v : key)
+                    h ^= std::hash<long long>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+
+        typedef std::unordered_map<key_t, state_t, KeyHash> map_t;
+
+        key_t make_key(const Controller& controller, const std::vector<double>& ctrl) const
+        {
+            key_t key;
+            key.reserve(ctrl.size() + Controller::legs + 2);
+            for (double value : ctrl)
+                key.push_back(std::llround(value / _quantum));
+            // the integrator (states converged by different schemes differ) and the
+            // broken legs, after a marker no rounded value takes
+            key.push_back(std::numeric_limits<long long>::min());
+            key.push_back(static_cast<long long>(controller.integrator()));
+            for (int leg : controller.broken_legs())
+                key.push_back(leg);
+            return key;
+        }
+
+        double _quantum;
+        double _settle;
+        double _dt;
+        size_t _capacity;
+
+        mutable std::mutex _mutex;
+        map_t _states;
+        std::deque<key_t> _order;
+        size_t _hits;
+        size_t _misses;
+    };
+} // namespace rhex_controller
+
+#endif
@@ -0,0 +1,1542 @@
+// Micro-benchmarks of the controllers, built and run by `./waf bench`.
+//
+// For each controller:
+//   tick        one pos(t, output) call per 1 kHz tick, each call timed on its own
+//               (mean, median, 99th percentile and worst case)
+//   legacy      the same through the allocating pos(t) that returns a vector
+//   horizon     a long run of ticks timed as a whole (throughput)
+//   command     the horizon through command(t, command), which adds the velocities
+//               and PD gains (see rhex_controller_command.hpp)
+//   population  a population of genomes stepped together, with the batched
+//               controllers where they exist (cost per genome and tick); the batched
+//               Buehler and Simple targets must be those of the single controllers,
+//               also after a simulated hour
+//   log         the horizon ticks, each recorded by a TrajectoryWriter (the time
+//               includes writing the whole trajectory to the file); the file is then
+//               read back, and replayed through a ReplayController at the recorded
+//               times, between them, out of order and past both ends
+//   steer       the command horizon with a new set_command(speed, turn_rate) every
+//               10 ticks (100 Hz), for Buehler and Hopf; Buehler's targets must not
+//               move more per tick than their velocities allow
+//   descriptor  the horizon with a GaitDescriptorAccumulator updated on each tick
+//               (see rhex_controller_descriptor.hpp); for Buehler, the duty factors,
+//               stride frequency and phase lags it finds are checked against the
+//               genome
+//   swap        the horizon through a HotSwapController, with a new genome every
+//               400 ticks blended in over 0.1 s; republishing the same genome must
+//               keep the gait phase and the targets
+//   fork        a snapshot saved to a SnapshotPool and restored, per fork (see
+//               rhex_controller_snapshot.hpp); the ticks replayed from a restored
+//               snapshot must give the targets of the first run
+//   pipeline    the horizon through a simulated GaitPipeline (Buehler), per control
+//               tick, followed by the latency and control jitter of one second of
+//               the threaded pipeline (their median and p99 are histogram bounds)
+//   rollout     a population of Hopf genomes through a RolloutEngine of 4 workers
+//               on a mock simulation (cost per genome and step); the results must
+//               be those of the rollouts run one by one, in order, from one clone
+//               per worker, and a NaN gene must give an invalid rollout
+//   fastmath    the horizon of the controller built with FastMath, for the ones
+//               that call libm (see rhex_controller_math.hpp)
+//   float, q16  the horizon of Buehler and Simple computed in float and in Q16_16
+//               fixed point (see rhex_controller_fixed.hpp); Buehler's targets are
+//               also checked on one second every minute over 4 simulated hours
+//   network     an 8 legged ring of each oscillator of rhex_controller_network.hpp,
+//               stepped with RK4 (cost per tick); a system that blows up and a Hopf
+//               gait with a NaN gene must get through 2 s of RK45 ticks
+//
+// The accuracy of these variants is checked too: the FastMath kernels against libm,
+// and the joint targets of each variant against the double, StdMath controller over
+// the horizon (10 simulated minutes by default), and the relative phases
+// the Kuramoto and Hopf rings lock into against the antiphase of their biases.
+// The Hopf oscillators of a TripodCoupling genome must start from warm_start() at the
+// relative phases a cold start settles at. Buehler is also sampled into a GaitTable for
+// 200 genomes, whose playback must give the targets of the controller at the sample
+// times over 20 cycles. The benchmark fails if an error is above its tolerance.
+//
+// Allocations are counted by replacing the global operator new, hardware
+// counters are read with perf_event_open when the kernel allows it.
+//
+// usage: rhex_controller_bench [--ticks N] [--population N] [--only NAME] [--json FILE]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <rhex_controller/rhex_controller_batched.hpp>
+#include <rhex_controller/rhex_controller_buehler.hpp>
+#include <rhex_controller/rhex_controller_cpg.hpp>
+#include <rhex_controller/rhex_controller_descriptor.hpp>
+#include <rhex_controller/rhex_controller_fixed.hpp>
+#include <rhex_controller/rhex_controller_gait_table.hpp>
+#include <rhex_controller/rhex_controller_hopf.hpp>
+#include <rhex_controller/rhex_controller_hopf_batched.hpp>
+#include <rhex_controller/rhex_controller_hot_swap.hpp>
+#include <rhex_controller/rhex_controller_math.hpp>
+#include <rhex_controller/rhex_controller_network.hpp>
+#include <rhex_controller/rhex_controller_pipeline.hpp>
+#include <rhex_controller/rhex_controller_rollout.hpp>
+#include <rhex_controller/rhex_controller_simple.hpp>
+#include <rhex_controller/rhex_controller_snapshot.hpp>
+#include <rhex_controller/rhex_controller_trajectory.hpp>
+
+#ifndef RHEX_CONTROLLER_VERSION
+#define RHEX_CONTROLLER_VERSION "unknown"
+#endif
+
+using namespace rhex_controller;
+
+namespace {
+    std::atomic<size_t> allocations(0);
+}
+
+// the replacements below pair malloc and free themselves
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+    typedef std::chrono::steady_clock bench_clock;
+
+    const double dt = 0.001;
+
+    // hardware counters of the calling thread, user space only
+    class PerfCounters {
+    public:
+        static const size_t count = 5;
+
+        PerfCounters()
+        {
+            static const unsigned long long events[count] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                _fd[i] = -1;
+#ifdef __linux__
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = events[i];
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                _fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+                (void)events;
+#endif
+            }
+        }
+
+        ~PerfCounters()
+        {
+#ifdef __linux__
+            for (size_t i = 0; i < count; ++i)
+                if (_fd[i] >= 0)
+                    close(_fd[i]);
+#endif
+        }
+
+        static const char* name(size_t i)
+        {
+            static const char* names[count] = {"cycles", "instructions", "cache_references", "cache_misses", "branch_misses"};
+            return names[i];
+        }
+
+        bool available(size_t i) const
+        {
+            return _fd[i] >= 0;
+        }
+
+        void start()
+        {
+#ifdef __linux__
+            for (size_t i = 0; i < count; ++i)
+                if (_fd[i] >= 0)
+                {
+                    ioctl(_fd[i], PERF_EVENT_IOC_RESET, 0);
+                    ioctl(_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+                }
+#endif
+        }
+
+        // counts since start(), scaled up when the kernel multiplexed the counters
+        void stop(double* values)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                values[i] = -1;
+#ifdef __linux__
+                if (_fd[i] < 0)
+                    continue;
+                ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+                unsigned long long data[3];
+                if (read(_fd[i], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+                    values[i] = double(data[0]) * data[1] / data[2];
+#endif
+            }
+        }
+
+    protected:
+        int _fd[count];
+    };
+
+    struct Result {
+        std::string controller;
+        std::string scenario;
+        size_t ticks;
+        size_t population;
+        double ns_per_tick;
+        // per call latencies, tick scenario only (negative otherwise)
+        double median_ns;
+        double p99_ns;
+        double max_ns;
+        double allocations_per_tick;
+        // per tick, negative when unavailable
+        double counters[PerfCounters::count];
+        // sum of the outputs, keeps the work observable
+        double checksum;
+    };
+
+    struct Accuracy {
+        std::string name;
+        double error;
+        double tolerance;
+
+        bool passed() const
+        {
+            return error <= tolerance;
+        }
+    };
+
+    // joint targets in radians, of FastMath against libm
+    const double trajectory_tolerance = 1e-9;
+    // of the targets read back from a trajectory file, copied bit for bit
+    const double replay_tolerance = 0;
+    // and of float and Q16_16 against double, from the same genome. The Buehler phases
+    // are the time within the cycle, reduced in double and rounded to 6e-8 s in float
+    // and to 1.5e-5 s in Q16_16 (with the period), errors multiplied by leg speeds of up
+    // to a few hundred rad/s in swing, however long the gait runs; Simple takes its
+    // remainder in double and only rounds the targets.
+    const double buehler_float_tolerance = 1e-5;
+    const double buehler_fixed_tolerance = 5e-3;
+    const double simple_float_tolerance = 1e-5;
+    const double simple_fixed_tolerance = 1e-3;
+    // relative error of the period, rounded once to the Scalar: a rate error within
+    // the cycle, the cycles themselves are counted in double
+    const double float_period_tolerance = 1e-7;
+    const double fixed_period_tolerance = 5e-5;
+    // relative phases of the network rings after 30 s, in radians
+    const double locking_tolerance = 1e-6;
+    // of a rollout replayed from a snapshot against the first run: the same
+    // arithmetic, but the two loops are compiled apart and may not fuse the same
+    // multiply-adds (-march=native), which the wound-up Hopf angles show at 1e-13
+    const double fork_tolerance = 1e-9;
+    // of the Buehler gait descriptors against its genome: stances and touchdowns are
+    // known to one tick, 2e-3 of the slowest period (absolute for the duty factors and
+    // phase lags, relative for the frequency)
+    const double descriptor_tolerance = 5e-3;
+    // step of a Buehler target over one tick beyond its velocity, under set_command:
+    // a new stance angle comes in on the first tick after mid-stance rather than at it
+    const double steering_tolerance = 1e-3;
+    // of the gait phase (in turns) and the targets of a HotSwapController republishing
+    // its genome, against the controller running alone: the running gait is kept, and
+    // a fresh Buehler controller carries on from its phase to rounding
+    const double swap_phase_tolerance = 1e-9;
+    // extra step of a Buehler target over one tick while blending two gaits over
+    // 0.1 s: at most 1.5 dt / 0.1 of their difference, under a turn once the whole
+    // turns are shifted away
+    const double swap_step_tolerance = 0.1;
+
+    // of the batched controllers against the single ones, whose stance offsets are
+    // added one leg at a time rather than multiplied, on angles wound up over an hour
+    const double batched_tolerance = 1e-10;
+    // of the relative oscillator angles of a warm-started Hopf gait, against those it
+    // settles at after 30 s from a cold start
+    const double warm_start_tolerance = 1e-6;
+    // of a GaitTable at its sample times against the controller it sampled: the same
+    // targets, the table winding up the cycles itself
+    const double gait_table_tolerance = 1e-9;
+    // derivative evaluations of the worst tick of a diverging system on RK45: the step
+    // is cut by 5 from dt down to the floor of 1e-9 dt, then the tick stops at the
+    // first state that is not finite (it would never get over dt at the floor)
+    const double divergence_tolerance = 2000;
+    // of the RolloutEngine results against the same rollouts run one after the other,
+    // of the clones against one per worker, and of a diverging rollout against an
+    // invalid one of fitness 0: the threads must not change anything
+    const double rollout_tolerance = 0;
+
+    // x' = x^2 from x = 1, which reaches infinity at t = 1
+    struct Blowup {
+        void derivative(const std::array<double, 1>& x, std::array<double, 1>& dx) const
+        {
+            dx[0] = x[0] * x[0];
+        }
+    };
+
+    // Simulation of RolloutEngine without a physics engine: each leg moves half way to
+    // its target per step and the body along x by the mean sine of the leg angles. It
+    // counts its clones, and the steps that found another thread stepping the same world.
+    class MockSimulation {
+    public:
+        struct Counters {
+            Counters() : clones(0), shared(0) {}
+
+            std::atomic<size_t> clones;
+            std::atomic<size_t> shared;
+        };
+
+        explicit MockSimulation(Counters& counters)
+            : _counters(&counters), _busy(std::make_shared<std::atomic<int> >(0))
+        {
+            reset();
+        }
+
+        MockSimulation clone() const
+        {
+            ++_counters->clones;
+            return MockSimulation(*_counters);
+        }
+
+        void reset()
+        {
+            _angles.fill(0);
+            _position.fill(0);
+            _error = 0;
+        }
+
+        double time_step() const
+        {
+            return dt;
+        }
+
+        void step(const double* targets, const double*)
+        {
+            if (_busy->fetch_add(1) != 0)
+                ++_counters->shared;
+
+            double speed = 0;
+            _error = 0;
+            for (size_t i = 0; i < default_legs; ++i)
+            {
+                _angles[i] += 0.5 * (targets[i] - _angles[i]);
+                _error += std::abs(targets[i] - _angles[i]) / default_legs;
+                speed += std::sin(_angles[i]) / default_legs;
+            }
+            _position[0] += speed * dt;
+
+            --*_busy;
+        }
+
+        std::array<double, 3> body_position() const
+        {
+            return _position;
+        }
+
+        double tracking_error() const
+        {
+            return _error;
+        }
+
+    protected:
+        Counters* _counters;
+        std::shared_ptr<std::atomic<int> > _busy;
+        std::array<double, default_legs> _angles;
+        std::array<double, 3> _position;
+        double _error;
+    };
+
+    // the oscillators start spread over a quarter turn, away from the locked gait
+    template <typename Network>
+    void ring_start(typename Network::state_t& x)
+    {
+        x.fill(0);
+        for (size_t i = 0; i < Network::size; ++i)
+        {
+            double angle = 0.2 * i;
+            x[i] = (Network::dimension == 1) ? angle : std::cos(angle);
+            if (Network::dimension > 1)
+                x[Network::size + i] = 0.5 * std::sin(angle);
+        }
+    }
+
+    // target of leg i in double, with the whole cycles the float and fixed point
+    // Buehler gaits leave out of their targets
+    template <typename Controller>
+    double wound_target(const Controller&, const typename Controller::output_t& output, size_t i)
+    {
+        return double(output[i]);
+    }
+
+    template <size_t Legs, typename Scalar>
+    double wound_target(const BasicRhexControllerBuehler<Legs, Scalar>& controller,
+        const typename BasicRhexControllerBuehler<Legs, Scalar>::output_t& output, size_t i)
+    {
+        double cycles = BasicRhexControllerBuehler<Legs, Scalar>::winds ? 0 : double(controller.cycles());
+        return double(output[i]) + cycles * 2 * pi;
+    }
+
+    // phase of node i: the state of a Kuramoto oscillator, the angle of (u, v) for Hopf
+    template <typename Network>
+    double ring_phase(const typename Network::state_t& x, size_t i)
+    {
+        if (Network::dimension == 1)
+            return x[i];
+        return std::atan2(x[Network::size + i], x[i]);
+    }
+
+    template <typename Math, typename Scalar>
+    void sin_loop(const std::vector<Scalar>& x, std::vector<Scalar>& y)
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = Math::sin(x[i]);
+    }
+
+    class Bench {
+    public:
+        Bench(size_t ticks, size_t population) : _ticks(ticks), _population(population) {}
+
+        size_t population_size() const
+        {
+            return _population;
+        }
+
+        const std::vector<Result>& results() const
+        {
+            return _results;
+        }
+
+        const std::vector<Accuracy>& accuracy() const
+        {
+            return _accuracy;
+        }
+
+        // every leg goes into the checksums, so that none of them is optimized away
+        template <typename Values>
+        static double sum(const Values& values)
+        {
+            double total = 0;
+            for (auto v : values)
+                total += double(v);
+            return total;
+        }
+
+        template <typename Controller>
+        void tick(const std::string& name, const std::vector<double>& ctrl)
+        {
+            Controller controller(ctrl);
+            typename Controller::output_t output;
+            std::vector<double> latencies(_ticks);
+            double checksum = 0;
+
+            for (size_t k = 0; k < 1000; ++k)
+                controller.pos((k + 1) * dt, output);
+
+            Result r = start(name, "tick", _ticks, 1);
+            for (size_t k = 0; k < _ticks; ++k)
+            {
+                bench_clock::time_point before = bench_clock::now();
+                controller.pos((k + 1001) * dt, output);
+                latencies[k] = std::chrono::duration<double, std::nano>(bench_clock::now() - before).count();
+                checksum += sum(output);
+            }
+            stop(r, checksum);
+
+            std::sort(latencies.begin(), latencies.end());
+            r.median_ns = latencies[_ticks / 2];
+            r.p99_ns = latencies[std::min(_ticks - 1, _ticks * 99 / 100)];
+            r.max_ns = latencies.back();
+            _results.push_back(r);
+        }
+
+        template <typename Controller>
+        void legacy(const std::string& name, const std::vector<double>& ctrl)
+        {
+            Controller controller(ctrl);
+            double checksum = 0;
+
+            Result r = start(name, "legacy", _ticks, 1);
+            for (size_t k = 0; k < _ticks; ++k)
+                checksum += sum(controller.pos((k + 1) * dt));
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        template <typename Controller>
+        void horizon(const std::string& name, const std::vector<double>& ctrl)
+        {
+            size_t ticks = 6 * _ticks;
+            Controller controller(ctrl);
+            typename Controller::output_t output;
+            double checksum = 0;
+
+            Result r = start(name, "horizon", ticks, 1);
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                controller.pos((k + 1) * dt, output);
+                checksum += sum(output);
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // the horizon through command(t, command), targets with velocities and gains
+        template <typename Controller>
+        void command(const std::string& name, const std::vector<double>& ctrl)
+        {
+            size_t ticks = 6 * _ticks;
+            Controller controller(ctrl);
+            typename Controller::command_t command;
+            double checksum = 0;
+
+            Result r = start(name, "command", ticks, 1);
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                controller.command((k + 1) * dt, command);
+                checksum += sum(command.angle) + sum(command.velocity) + sum(command.Kp);
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // speed between 0.5 and 1.5 and turn rate between -1 and 1, changing with t
+        template <typename Controller>
+        void steer(const std::string& name, const std::vector<double>& ctrl, bool continuous)
+        {
+            size_t ticks = 6 * _ticks;
+            Controller controller(ctrl);
+            typename Controller::command_t command, previous;
+            double checksum = 0, excess = 0;
+
+            controller.command(dt, previous);
+            Result r = start(name, "steer", ticks, 1);
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                double t = (k + 2) * dt;
+                if (k % 10 == 0)
+                    controller.set_command(1 + 0.5 * std::sin(t), std::sin(0.3 * t));
+                controller.command(t, command);
+                checksum += sum(command.angle) + sum(command.velocity);
+
+                for (size_t i = 0; i < Controller::legs; ++i)
+                {
+                    double bound = std::max(std::abs(double(command.velocity[i])), std::abs(double(previous.velocity[i]))) * dt;
+                    excess = std::max(excess, std::abs(double(command.angle[i] - previous.angle[i])) - bound);
+                }
+                previous = command;
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+
+            if (continuous)
+                _accuracy.push_back(Accuracy{name + " steering continuity", excess, steering_tolerance});
+        }
+
+        template <typename Controller>
+        void descriptor(const std::string& name, const std::vector<double>& ctrl)
+        {
+            size_t ticks = 6 * _ticks;
+            Controller controller(ctrl);
+            typename Controller::output_t output;
+            GaitDescriptorAccumulator<Controller::legs> accumulator;
+            double checksum = 0;
+
+            Result r = start(name, "descriptor", ticks, 1);
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                controller.pos((k + 1) * dt, output);
+                accumulator.update((k + 1) * dt, controller);
+                checksum += sum(output);
+            }
+            GaitDescriptor<Controller::legs> d = accumulator.descriptor();
+            checksum += d.frequency + sum(d.duty_factor);
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // Buehler's legs are in stance for their duty factor of each period, leg i
+        // touching down phase_offset_i = ctrl[3 legs + i] period / 2 before leg 0
+        void buehler_descriptor(const std::vector<double>& ctrl)
+        {
+            const size_t legs = RhexControllerBuehler::legs;
+            RhexControllerBuehler controller(ctrl);
+            RhexControllerBuehler::output_t output;
+            GaitDescriptorAccumulator<legs> accumulator;
+            for (size_t k = 0; k < 60000; ++k)
+            {
+                controller.pos((k + 1) * dt, output);
+                accumulator.update((k + 1) * dt, controller);
+            }
+            GaitDescriptor<legs> d = accumulator.descriptor();
+
+            double period = controller.period();
+            double duty = 0, lag = 0;
+            for (size_t i = 0; i < legs; ++i)
+            {
+                duty = std::max(duty, std::abs(d.duty_factor[i] - ctrl[1 + i]));
+                double offset = (i == 0) ? 0 : ctrl[3 * legs + i] / 2;
+                double expected = -offset - std::floor(-offset);
+                lag = std::max(lag, std::abs(std::remainder(d.phase_lag[i] - expected, 1.)));
+            }
+            _accuracy.push_back(Accuracy{"buehler duty factor", duty, descriptor_tolerance});
+            _accuracy.push_back(Accuracy{"buehler stride frequency", std::abs(d.frequency * period - 1), descriptor_tolerance});
+            _accuracy.push_back(Accuracy{"buehler phase lag", lag, descriptor_tolerance});
+        }
+
+        template <typename Controller>
+        void fork(const std::string& name, const std::vector<double>& ctrl)
+        {
+            Controller controller(ctrl);
+            typename Controller::output_t output;
+            for (size_t k = 0; k < 1000; ++k)
+                controller.pos((k + 1) * dt, output);
+
+            SnapshotPool<Controller> pool(16);
+            size_t root = pool.save(controller);
+
+            // one second from the snapshot, twice
+            std::vector<double> first(1000 * Controller::legs);
+            for (size_t k = 0; k < 1000; ++k)
+            {
+                controller.pos((k + 1001) * dt, output);
+                std::copy(output.begin(), output.end(), first.begin() + k * Controller::legs);
+            }
+            pool.restore(root, controller);
+            double error = 0;
+            for (size_t k = 0; k < 1000; ++k)
+            {
+                controller.pos((k + 1001) * dt, output);
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    error = std::max(error, std::abs(double(output[i]) - first[k * Controller::legs + i]));
+            }
+            _accuracy.push_back(Accuracy{name + " fork", error, fork_tolerance});
+
+            double checksum = 0;
+            Result r = start(name, "fork", _ticks, 1);
+            for (size_t k = 0; k < _ticks; ++k)
+            {
+                size_t branch = pool.save(controller);
+                pool.restore(root, controller);
+                pool.release(branch);
+                checksum += branch;
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // the horizon through a HotSwapController, a genome published every 400 ticks
+        // and blended in over 0.1 s, alternately ctrls[1] and ctrls[0]. Republishing
+        // ctrls[0] every 400 ticks with no blend, after a 2 s warm-up, must keep the gait
+        // phase and the targets of a controller running ctrls[0] alone. For Buehler, so
+        // must publishing a fresh controller with ctrls[0], which is swapped in at the
+        // phase of the running one, and the targets must not step further in a tick
+        // while swapping than the gaits do.
+        template <typename Controller>
+        void swap(const std::string& name, const std::vector<std::vector<double> >& ctrls)
+        {
+            size_t ticks = 6 * _ticks;
+            typename Controller::output_t output, previous;
+
+            for (int fresh = 0; fresh < (name == "buehler" ? 2 : 1); ++fresh)
+            {
+                Controller plain(ctrls[0]);
+                HotSwapController<Controller> controller(ctrls[0]);
+                typename Controller::output_t expected;
+                double error = 0, phase = 0;
+                for (size_t k = 0; k < ticks; ++k)
+                {
+                    if (k >= 2000 && k % 400 == 0)
+                    {
+                        if (fresh)
+                            controller.publish(Controller(ctrls[0]));
+                        else
+                            controller.publish(ctrls[0]);
+                    }
+                    plain.pos((k + 1) * dt, expected);
+                    controller.pos((k + 1) * dt, output);
+                    if (k < 2000)
+                        continue;
+                    for (size_t i = 0; i < Controller::legs; ++i)
+                        error = std::max(error, std::abs(double(output[i]) - double(expected[i])));
+                    phase = std::max(phase, std::abs(std::remainder(controller.current().gait_phase() - plain.gait_phase(), 1.)));
+                }
+                std::string check = name + (fresh ? " hot swap fresh" : " hot swap");
+                _accuracy.push_back(Accuracy{check + " phase", phase, swap_phase_tolerance});
+                _accuracy.push_back(Accuracy{check, error, swap_phase_tolerance});
+            }
+
+            // worst step of a target over one tick, of the two gaits and while swapping
+            double gait_step = 0, swap_step = 0;
+            for (size_t g = 0; g < 2; ++g)
+            {
+                Controller plain(ctrls[g]);
+                plain.pos(dt, previous);
+                for (size_t k = 1; k < ticks; ++k)
+                {
+                    plain.pos((k + 1) * dt, output);
+                    for (size_t i = 0; i < Controller::legs; ++i)
+                        gait_step = std::max(gait_step, std::abs(double(output[i]) - double(previous[i])));
+                    previous = output;
+                }
+            }
+
+            Controller initial(ctrls[0]);
+            HotSwapController<Controller> controller(initial, 0.1);
+            double checksum = 0;
+            controller.pos(dt, previous);
+            Result r = start(name, "swap", ticks - 1, 1);
+            for (size_t k = 1; k < ticks; ++k)
+            {
+                if (k % 400 == 0)
+                    controller.publish(ctrls[(k / 400) % ctrls.size() % 2]);
+                controller.pos((k + 1) * dt, output);
+                checksum += sum(output);
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    swap_step = std::max(swap_step, std::abs(double(output[i]) - double(previous[i])));
+                previous = output;
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+
+            if (name == "buehler")
+                _accuracy.push_back(Accuracy{name + " hot swap step", std::max(0., swap_step - gait_step), swap_step_tolerance});
+        }
+
+        template <typename Controller>
+        void log(const std::string& name, const std::vector<double>& ctrl)
+        {
+            const char* path = "rhex_controller_bench.traj";
+            Controller controller(ctrl);
+            typename Controller::output_t output;
+            double checksum = 0;
+
+            {
+                TrajectoryWriter writer(path, trajectory::fields(controller));
+                Result r = start(name, "log", _ticks, 1);
+                for (size_t k = 0; k < _ticks; ++k)
+                {
+                    controller.pos((k + 1) * dt, output);
+                    writer.record((k + 1) * dt, controller, output);
+                    checksum += sum(output);
+                }
+                writer.close();
+                stop(r, checksum);
+                _results.push_back(r);
+            }
+
+            _accuracy.push_back(Accuracy{name + " log replay", replay_error<Controller>(path, ctrl), replay_tolerance});
+            std::remove(path);
+        }
+
+        // the trajectory of log() read back: every record must hold the time and targets
+        // of its tick, and a ReplayController must give the targets of the last record
+        // at or before any time (the first one before the start), whether the times come
+        // in order or not. The largest difference, infinite if records are missing or
+        // hold the wrong time.
+        template <typename Controller>
+        double replay_error(const char* path, const std::vector<double>& ctrl)
+        {
+            Controller controller(ctrl);
+            std::vector<typename Controller::output_t> expected(_ticks);
+            for (size_t k = 0; k < _ticks; ++k)
+                controller.pos((k + 1) * dt, expected[k]);
+
+            TrajectoryReader reader(path);
+            if (reader.size() != _ticks || reader.fields() != trajectory::fields(controller))
+                return std::numeric_limits<double>::infinity();
+
+            // compared for equality: the difference may be fused into the product and
+            // give its rounding error
+            double error = 0;
+            for (size_t k = 0; k < _ticks; ++k)
+            {
+                if (reader[k].time != (k + 1) * dt)
+                    return std::numeric_limits<double>::infinity();
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    error = std::max(error, std::abs(reader[k].target[i] - double(expected[k][i])));
+            }
+
+            ReplayController replay(path);
+            ReplayController::output_t output;
+            auto play = [&](double t, size_t k) {
+                replay.pos(t, output);
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    error = std::max(error, std::abs(output[i] - double(expected[k][i])));
+            };
+
+            // at the recorded times and between them, in order then shuffled
+            std::vector<size_t> order(_ticks);
+            for (size_t k = 0; k < _ticks; ++k)
+                order[k] = k;
+            for (size_t pass = 0; pass < 2; ++pass)
+            {
+                for (size_t k : order)
+                {
+                    play((k + 1) * dt, k);
+                    play((k + 1.5) * dt, k);
+                }
+                std::shuffle(order.begin(), order.end(), std::mt19937(7));
+            }
+
+            // past both ends
+            play(0, 0);
+            play(-1, 0);
+            play(replay.end() + 1, _ticks - 1);
+            play(1e9, _ticks - 1);
+            play(replay.start(), 0);
+
+            return error;
+        }
+
+        // Variant is Controller computed differently (built with FastMath, in float or in
+        // fixed point): its horizon is timed as the given scenario, and its joint targets
+        // are checked against those of Controller built from the same genome
+        template <typename Controller, typename Variant>
+        void variant(const std::string& name, const std::string& scenario, const std::vector<double>& ctrl,
+            double tolerance)
+        {
+            size_t ticks = 6 * _ticks;
+
+            {
+                Variant controller(ctrl);
+                typename Variant::output_t output;
+                double checksum = 0;
+
+                Result r = start(name, scenario, ticks, 1);
+                for (size_t k = 0; k < ticks; ++k)
+                {
+                    controller.pos((k + 1) * dt, output);
+                    checksum += sum(output);
+                }
+                stop(r, checksum);
+                _results.push_back(r);
+            }
+
+            Controller expected_controller(ctrl);
+            Variant controller(ctrl);
+            typename Controller::output_t expected;
+            typename Variant::output_t output;
+            double error = 0;
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                expected_controller.pos((k + 1) * dt, expected);
+                controller.pos((k + 1) * dt, output);
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    error = std::max(error, std::abs(wound_target(controller, output, i) - double(expected[i])));
+            }
+            _accuracy.push_back(Accuracy{name + " " + scenario, error, tolerance});
+        }
+
+        // the targets of Variant against those of Controller from the same genome, on
+        // one second of ticks every simulated minute over hours: a board runs the gait
+        // for as long as its battery lasts, the error must not grow with the time
+        template <typename Controller, typename Variant>
+        void endurance(const std::string& name, const std::string& scenario, const std::vector<double>& ctrl,
+            double tolerance, size_t hours)
+        {
+            Controller expected_controller(ctrl);
+            Variant controller(ctrl);
+            typename Controller::output_t expected;
+            typename Variant::output_t output;
+            double error = 0;
+            for (size_t minute = 0; minute < 60 * hours; ++minute)
+                for (size_t k = 0; k < 1000; ++k)
+                {
+                    double t = minute * 60 + (k + 1) * dt;
+                    expected_controller.pos(t, expected);
+                    controller.pos(t, output);
+                    for (size_t i = 0; i < Controller::legs; ++i)
+                        error = std::max(error, std::abs(wound_target(controller, output, i) - double(expected[i])));
+                }
+            _accuracy.push_back(Accuracy{name + " " + scenario + " " + std::to_string(hours) + " h", error, tolerance});
+        }
+
+        // the period of Variant is rounded when the genome is read: a rate error, measured
+        // here, that the Buehler gait accumulates into a phase error over the cycles
+        template <typename Controller, typename Variant>
+        void period(const std::string& name, const std::string& scenario, const std::vector<double>& ctrl, double tolerance)
+        {
+            double expected = double(Controller(ctrl).period());
+            double error = std::abs(double(Variant(ctrl).period()) - expected) / expected;
+            _accuracy.push_back(Accuracy{name + " " + scenario + " period", error, tolerance});
+        }
+
+        // GaitPipeline: its simulated run timed per control tick, with the interpolated
+        // angles checked where they must be exact (the targets being linear between the
+        // two setpoints around the tick), then one second of the threaded pipeline on
+        // the steady clock, whose rows give the latency and the control stage jitter
+        template <typename Controller>
+        void pipeline(const std::string& name, const std::vector<double>& ctrl)
+        {
+            double duration = 6 * _ticks * dt;
+            PipelineConfig config;
+            double step = 1 / config.gait_rate;
+
+            Controller controller(ctrl), reference(ctrl);
+            GaitPipeline<Controller> pipeline(controller, config);
+            typename Controller::command_t exact, before, after;
+            double checksum = 0, error = 0;
+
+            Result r = start(name, "pipeline", size_t(duration * config.control_rate), 1);
+            pipeline.simulate(duration, [&](double t, const typename Controller::command_t& command) {
+                checksum += sum(command.angle);
+            });
+            stop(r, checksum);
+            _results.push_back(r);
+
+            pipeline.simulate(duration, [&](double t, const typename Controller::command_t& command) {
+                // the setpoints are at multiples of the gait period from lead on, the
+                // first one being held before
+                if (t < pipeline.config().lead)
+                    return;
+                double a = std::floor(t / step) * step;
+                reference.command_at(t, exact);
+                reference.command_at(a, before);
+                reference.command_at(a + step, after);
+                for (size_t i = 0; i < Controller::legs; ++i)
+                    if (before.velocity[i] == exact.velocity[i] && after.velocity[i] == exact.velocity[i])
+                        error = std::max(error, std::abs(double(command.angle[i]) - double(exact.angle[i])));
+            });
+            _accuracy.push_back(Accuracy{name + " pipeline", error, trajectory_tolerance});
+
+            Controller threaded(ctrl);
+            GaitPipeline<Controller> realtime(threaded, config);
+            realtime.start(typename GaitPipeline<Controller>::sink_t());
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            realtime.stop();
+
+            const PipelineStats& stats = realtime.stats();
+            timing_row(name, "latency", stats.latency);
+            timing_row(name, "jitter", stats.control_jitter);
+        }
+
+        // A ring of 8 legs (the RHex8 layout), each pulled by its two neighbours with
+        // weight 2 towards antiphase: RK4 ticks of the whole network, after 30 s in
+        // which the Kuramoto and Hopf rings lock, whose relative phases are checked.
+        template <typename Oscillator>
+        void network(const std::string& name, bool locks)
+        {
+            typedef OscillatorNetwork<Oscillator, 8> Network;
+            const size_t legs = Network::size;
+
+            std::vector<typename Network::graph_t::Edge> edges;
+            for (size_t i = 0; i < legs; ++i)
+            {
+                edges.push_back(typename Network::graph_t::Edge{i, (i + 1) % legs, 2., pi});
+                edges.push_back(typename Network::graph_t::Edge{i, (i + legs - 1) % legs, 2., pi});
+            }
+            Network network;
+            network.set_graph(typename Network::graph_t(legs, edges));
+
+            typename Network::state_t x;
+            ring_start<Network>(x);
+            for (size_t k = 0; k < 30000; ++k)
+                rk4_step(network, x, dt);
+
+            if (locks)
+            {
+                double error = 0;
+                for (size_t i = 1; i < legs; ++i)
+                {
+                    double relative = ring_phase<Network>(x, i) - ring_phase<Network>(x, 0) - (i % 2) * pi;
+                    error = std::max(error, std::abs(std::remainder(relative, 2 * pi)));
+                }
+                _accuracy.push_back(Accuracy{name + " ring locking", error, locking_tolerance});
+            }
+
+            double checksum = 0;
+            Result r = start(name, "network", _ticks, 1);
+            for (size_t k = 0; k < _ticks; ++k)
+            {
+                rk4_step(network, x, dt);
+                checksum += network.output(x, k % legs);
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // the angles of the Hopf oscillators relative to the reference leg, after
+        // warm_start(), against those a cold start settles at after 30 s
+        template <typename Controller>
+        void warm_start(const std::string& name, const std::vector<double>& ctrl)
+        {
+            Controller warm(ctrl), cold(ctrl);
+            warm.warm_start();
+            typename Controller::output_t output;
+            for (size_t k = 0; k < 30000; ++k)
+                cold.pos((k + 1) * dt, output);
+
+            const size_t lanes = Controller::lanes;
+            const typename Controller::state_t& x = warm.state();
+            const typename Controller::state_t& y = cold.state();
+            double error = 0;
+            for (size_t i = 1; i < Controller::legs; ++i)
+            {
+                double expected = std::atan2(y[lanes + i], y[i]) - std::atan2(y[lanes], y[0]);
+                double relative = std::atan2(x[lanes + i], x[i]) - std::atan2(x[lanes], x[0]);
+                error = std::max(error, std::abs(std::remainder(relative - expected, 2 * pi)));
+            }
+            _accuracy.push_back(Accuracy{name + " warm start", error, warm_start_tolerance});
+        }
+
+        // GaitTable playback of each genome (256 samples per cycle) against the controller
+        // it sampled, at the sample times over 20 cycles, where the interpolation is
+        // exact. The legs of some Buehler genomes swing more than pi between two
+        // samples, and must still gain their whole turns.
+        template <typename Controller>
+        void gait_table(const std::string& name, const std::vector<std::vector<double> >& ctrls)
+        {
+            const size_t samples = 256;
+            double error = 0;
+            for (size_t n = 0; n < ctrls.size(); ++n)
+            {
+                Controller controller(ctrls[n]);
+                GaitTable table(controller, samples);
+                typename Controller::output_t expected;
+                GaitTable::output_t output;
+                for (size_t k = 0; k <= 20 * samples; ++k)
+                {
+                    double t = k * table.period() / samples;
+                    controller.pos(t, expected);
+                    table.pos(t, output);
+                    for (size_t i = 0; i < Controller::legs; ++i)
+                        error = std::max(error, std::abs(output[i] - double(expected[i])));
+                }
+            }
+            _accuracy.push_back(Accuracy{name + " gait table", error, gait_table_tolerance});
+        }
+
+        // 2 s of RK45 ticks of a system that blows up and of the Hopf gait of genome with
+        // a NaN gene, which must come back from every tick
+        void divergence(const std::vector<double>& genome)
+        {
+            double worst = 0;
+
+            Blowup blowup;
+            std::array<double, 1> x = {{1}};
+            double h = 0;
+            for (size_t k = 0; k < 2000; ++k)
+                worst = std::max(worst, double(rk45_step(blowup, x, dt, h, 1e-6)));
+
+            std::vector<double> ctrl = genome;
+            ctrl[0] = std::numeric_limits<double>::quiet_NaN();
+            RhexControllerHopf controller(ctrl);
+            controller.set_integrator(Integrator::RK45);
+            RhexControllerHopf::output_t output;
+            for (size_t k = 0; k < 2000; ++k)
+            {
+                size_t evaluations = controller.derivative_evaluations();
+                controller.pos((k + 1) * dt, output);
+                worst = std::max(worst, double(controller.derivative_evaluations() - evaluations));
+            }
+
+            _accuracy.push_back(Accuracy{"rk45 divergence", worst, divergence_tolerance});
+        }
+
+        // a population of 2 s rollouts through a RolloutEngine of 4 workers on
+        // MockSimulation (cost per genome and step), the middle genome with a NaN gene.
+        // The results must be in the order of the genomes, those of the rollouts run one
+        // after the other on one world, from one clone per worker; the NaN genome must
+        // give an invalid result of fitness 0.
+        template <typename Controller>
+        void rollout(const std::string& name, std::vector<std::vector<double> > ctrls)
+        {
+            size_t diverging = ctrls.size() / 2;
+            ctrls[diverging][0] = std::numeric_limits<double>::quiet_NaN();
+
+            MockSimulation::Counters counters;
+            MockSimulation prototype(counters);
+            RolloutEngine<Controller, MockSimulation> engine(prototype, 2., 4);
+            size_t steps = std::ceil(2. / dt - 1e-9);
+
+            Result r = start(name, "rollout", steps * ctrls.size(), ctrls.size());
+            std::vector<RolloutResult> results = engine.run(ctrls);
+            double checksum = 0;
+            for (size_t n = 0; n < results.size(); ++n)
+                checksum += results[n].fitness;
+            stop(r, checksum);
+            _results.push_back(r);
+
+            double clones = std::abs(double(counters.clones) - double(engine.threads())) + double(counters.shared);
+
+            double order = 0;
+            for (size_t n = 0; n < ctrls.size(); ++n)
+            {
+                RolloutResult expected = engine.rollout(prototype, ctrls[n]);
+                if (results[n].valid != expected.valid || results[n].steps != expected.steps)
+                    order = std::numeric_limits<double>::infinity();
+                else
+                    order = std::max(order, std::abs(results[n].fitness - expected.fitness));
+            }
+
+            const RolloutResult& nan = results[diverging];
+            double divergence = nan.valid ? std::numeric_limits<double>::infinity() : std::abs(nan.fitness);
+
+            _accuracy.push_back(Accuracy{name + " rollout order", order, rollout_tolerance});
+            _accuracy.push_back(Accuracy{name + " rollout clones", clones, rollout_tolerance});
+            _accuracy.push_back(Accuracy{name + " rollout divergence", divergence, rollout_tolerance});
+        }
+
+        // error of the FastMath kernels over [-1e3, 1e3] and [-1e5, 1e5], against the
+        // bounds of rhex_controller_math.hpp, and the cost per value of sin over [-100, 100]
+        // in a loop the compiler vectorizes
+        void math_kernels()
+        {
+            std::mt19937 gen(7);
+            std::vector<double> x(1024), y(1024);
+            std::vector<float> xf(1024), yf(1024);
+
+            const double ranges[2] = {1e3, 1e5};
+            const double float_tolerances[2] = {2e-7, 1e-6};
+            for (size_t n = 0; n < 2; ++n)
+            {
+                std::uniform_real_distribution<double> dist(-ranges[n], ranges[n]);
+                double errors[4] = {0, 0, 0, 0};
+                for (size_t k = 0; k < 1000; ++k)
+                {
+                    for (size_t i = 0; i < x.size(); ++i)
+                    {
+                        x[i] = dist(gen);
+                        xf[i] = float(x[i]);
+
+                        errors[0] = std::max(errors[0], std::abs(FastMath::sin(x[i]) - std::sin(x[i])));
+                        errors[1] = std::max(errors[1], std::abs(FastMath::cos(x[i]) - std::cos(x[i])));
+                        errors[2] = std::max(errors[2], std::abs(double(FastMath::sin(xf[i])) - std::sin(double(xf[i]))));
+                        errors[3] = std::max(errors[3], std::abs(double(FastMath::cos(xf[i])) - std::cos(double(xf[i]))));
+                    }
+                }
+                std::string range = (n == 0) ? " 1e3" : " 1e5";
+                _accuracy.push_back(Accuracy{"sin" + range, errors[0], 4e-16});
+                _accuracy.push_back(Accuracy{"cos" + range, errors[1], 4e-16});
+                _accuracy.push_back(Accuracy{"sin float" + range, errors[2], float_tolerances[n]});
+                _accuracy.push_back(Accuracy{"cos float" + range, errors[3], float_tolerances[n]});
+            }
+
+            std::uniform_real_distribution<double> dist(-100, 100);
+            for (size_t i = 0; i < x.size(); ++i)
+            {
+                x[i] = dist(gen);
+                xf[i] = float(x[i]);
+            }
+
+            size_t repeats = std::max<size_t>(_ticks / 100, 10);
+            math_loop<StdMath>("libm sin", x, y, repeats);
+            math_loop<FastMath>("fast sin", x, y, repeats);
+            math_loop<StdMath>("libm sinf", xf, yf, repeats);
+            math_loop<FastMath>("fast sinf", xf, yf, repeats);
+        }
+
+        // one controller object per genome, for the controllers without a batched version
+        template <typename Controller>
+        void population(const std::string& name, const std::vector<std::vector<double> >& ctrls)
+        {
+            size_t ticks = _ticks / 10;
+            std::vector<Controller> controllers;
+            for (size_t n = 0; n < ctrls.size(); ++n)
+                controllers.push_back(Controller(ctrls[n]));
+            typename Controller::output_t output;
+            double checksum = 0;
+
+            Result r = start(name, "population", ticks * ctrls.size(), ctrls.size());
+            for (size_t k = 0; k < ticks; ++k)
+                for (size_t n = 0; n < controllers.size(); ++n)
+                {
+                    controllers[n].pos((k + 1) * dt, output);
+                    checksum += sum(output);
+                }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        template <typename Batched>
+        void batched(const std::string& name, const std::vector<std::vector<double> >& ctrls)
+        {
+            size_t ticks = _ticks / 10;
+            Batched controllers(ctrls);
+            std::vector<double> output(Batched::legs * ctrls.size());
+            double checksum = 0;
+
+            Result r = start(name, "population", ticks * ctrls.size(), ctrls.size());
+            for (size_t k = 0; k < ticks; ++k)
+            {
+                controllers.pos_batch((k + 1) * dt, output.data());
+                checksum += sum(output);
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        // the batched targets against those of one Controller per genome, over a second of
+        // ticks, then those of the first genome over a simulated hour of ticks: both are
+        // functions of t, they must not drift apart
+        template <typename Batched, typename Controller>
+        void batched_accuracy(const std::string& name, const std::vector<std::vector<double> >& ctrls)
+        {
+            double error = 0;
+            for (size_t size : {ctrls.size(), size_t(1)})
+            {
+                std::vector<std::vector<double> > population(ctrls.begin(), ctrls.begin() + size);
+                Batched controllers(population);
+                std::vector<Controller> singles;
+                for (size_t n = 0; n < size; ++n)
+                    singles.push_back(Controller(population[n]));
+                std::vector<double> output(Batched::legs * size);
+                typename Controller::output_t expected;
+
+                size_t ticks = (size == 1) ? 3600000 : 1000;
+                for (size_t k = 0; k < ticks; ++k)
+                {
+                    controllers.pos_batch((k + 1) * dt, output.data());
+                    for (size_t n = 0; n < size; ++n)
+                    {
+                        singles[n].pos((k + 1) * dt, expected);
+                        for (size_t i = 0; i < Batched::legs; ++i)
+                            error = std::max(error, std::abs(output[n * Batched::legs + i] - double(expected[i])));
+                    }
+                }
+            }
+            _accuracy.push_back(Accuracy{name + " batched", error, batched_tolerance});
+        }
+
+    protected:
+        Result start(const std::string& controller, const std::string& scenario, size_t ticks, size_t population)
+        {
+            Result r;
+            r.controller = controller;
+            r.scenario = scenario;
+            r.ticks = ticks;
+            r.population = population;
+            r.median_ns = r.p99_ns = r.max_ns = -1;
+
+            _allocations = allocations.load();
+            _perf.start();
+            _start = bench_clock::now();
+            return r;
+        }
+
+        void stop(Result& r, double checksum)
+        {
+            double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - _start).count();
+            _perf.stop(r.counters);
+            size_t allocated = allocations.load() - _allocations;
+
+            r.ns_per_tick = ns / r.ticks;
+            r.allocations_per_tick = double(allocated) / r.ticks;
+            for (size_t i = 0; i < PerfCounters::count; ++i)
+                if (r.counters[i] >= 0)
+                    r.counters[i] /= r.ticks;
+            r.checksum = checksum;
+        }
+
+        // a row of TimingStats in ns: mean as ns/tick, median, 99th percentile and worst
+        void timing_row(const std::string& name, const std::string& scenario, const TimingStats& stats)
+        {
+            Result r = start(name, scenario, stats.count, 1);
+            stop(r, 0);
+            r.ns_per_tick = stats.mean() * 1e9;
+            r.median_ns = stats.quantile(0.5) * 1e9;
+            r.p99_ns = stats.quantile(0.99) * 1e9;
+            r.max_ns = stats.max * 1e9;
+            r.allocations_per_tick = 0;
+            for (size_t c = 0; c < PerfCounters::count; ++c)
+                r.counters[c] = -1;
+            _results.push_back(r);
+        }
+
+        template <typename Math, typename Scalar>
+        void math_loop(const std::string& scenario, const std::vector<Scalar>& x, std::vector<Scalar>& y, size_t repeats)
+        {
+            double checksum = 0;
+            Result r = start("math", scenario, repeats * x.size(), 1);
+            for (size_t k = 0; k < repeats; ++k)
+            {
+                sin_loop<Math>(x, y);
+                checksum += y[k % y.size()];
+            }
+            stop(r, checksum);
+            _results.push_back(r);
+        }
+
+        size_t _ticks;
+        size_t _population;
+        std::vector<Result> _results;
+        std::vector<Accuracy> _accuracy;
+        PerfCounters _perf;
+        size_t _allocations;
+        bench_clock::time_point _start;
+    };
+
+    std::vector<std::vector<double> > genomes(size_t size, size_t count, unsigned seed)
+    {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> dist(0, 1);
+        std::vector<std::vector<double> > ctrls(count, std::vector<double>(size));
+        for (size_t n = 0; n < count; ++n)
+            for (size_t i = 0; i < size; ++i)
+                ctrls[n][i] = dist(gen);
+        return ctrls;
+    }
+
+    template <typename Controller, typename Run>
+    void run_controller(Bench& bench, const std::string& name, Run population)
+    {
+        std::vector<std::vector<double> > ctrls = genomes(Controller::ctrl_size, bench.population_size(), 42);
+        bench.tick<Controller>(name, ctrls[0]);
+        bench.legacy<Controller>(name, ctrls[0]);
+        bench.horizon<Controller>(name, ctrls[0]);
+        bench.command<Controller>(name, ctrls[0]);
+        population(ctrls);
+        bench.log<Controller>(name, ctrls[0]);
+        bench.descriptor<Controller>(name, ctrls[0]);
+        bench.fork<Controller>(name, ctrls[0]);
+        bench.swap<Controller>(name, ctrls);
+    }
+
+    std::string number(double x)
+    {
+        if (x < 0)
+            return "null";
+        std::ostringstream s;
+        s.precision(6);
+        s << x;
+        return s.str();
+    }
+
+    void write_json(std::ostream& out, const Bench& bench, size_t ticks, size_t population)
+    {
+        out << "{\n"
+            << "  \"version\": \"" << RHEX_CONTROLLER_VERSION << "\",\n"
+            << "  \"compiler\": \"" << __VERSION__ << "\",\n"
+            << "  \"timestamp\": " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() << ",\n"
+            << "  \"ticks\": " << ticks << ",\n"
+            << "  \"population\": " << population << ",\n"
+            << "  \"results\": [\n";
+
+        const std::vector<Result>& results = bench.results();
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            out << "    {\"controller\": \"" << r.controller << "\", \"scenario\": \"" << r.scenario << "\""
+                << ", \"ticks\": " << r.ticks << ", \"population\": " << r.population
+                << ", \"ns_per_tick\": " << number(r.ns_per_tick)
+                << ", \"median_ns\": " << number(r.median_ns)
+                << ", \"p99_ns\": " << number(r.p99_ns)
+                << ", \"max_ns\": " << number(r.max_ns)
+                << ", \"allocations_per_tick\": " << number(r.allocations_per_tick);
+            for (size_t c = 0; c < PerfCounters::count; ++c)
+                out << ", \"" << PerfCounters::name(c) << "_per_tick\": " << number(r.counters[c]);
+            out << ", \"checksum\": " << r.checksum << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ],\n"
+            << "  \"accuracy\": [\n";
+
+        const std::vector<Accuracy>& accuracy = bench.accuracy();
+        for (size_t i = 0; i < accuracy.size(); ++i)
+        {
+            const Accuracy& a = accuracy[i];
+            out << "    {\"name\": \"" << a.name << "\", \"error\": " << a.error << ", \"tolerance\": " << a.tolerance
+                << ", \"passed\": " << (a.passed() ? "true" : "false") << "}" << (i + 1 < accuracy.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    void print_table(const Bench& bench)
+    {
+        std::printf("%-8s %-11s %10s %10s %10s %10s %8s %10s %10s\n", "", "", "ns/tick", "median", "p99", "max", "allocs", "cycles", "LLC miss");
+        for (const Result& r : bench.results())
+        {
+            std::printf("%-8s %-11s %10.1f", r.controller.c_str(), r.scenario.c_str(), r.ns_per_tick);
+            if (r.median_ns >= 0)
+                std::printf(" %10.0f %10.0f %10.0f", r.median_ns, r.p99_ns, r.max_ns);
+            else
+                std::printf(" %10s %10s %10s", "-", "-", "-");
+            std::printf(" %8.3f", r.allocations_per_tick);
+            for (size_t c : {size_t(0), size_t(3)})
+                if (r.counters[c] >= 0)
+                    std::printf(" %10.2f", r.counters[c]);
+                else
+                    std::printf(" %10s", "n/a");
+            std::printf("\n");
+        }
+
+        std::printf("\n%-20s %12s %12s\n", "accuracy", "max error", "tolerance");
+        for (const Accuracy& a : bench.accuracy())
+            std::printf("%-20s %12.3g %12.3g%s\n", a.name.c_str(), a.error, a.tolerance, a.passed() ? "" : "  FAILED");
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t ticks = 100000;
+    size_t population = 256;
+    std::string only;
+    std::string json;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--ticks")
+            ticks = std::max(10, std::atoi(argv[++i]));
+        else if (i + 1 < argc && arg == "--population")
+            population = std::max(1, std::atoi(argv[++i]));
+        else if (i + 1 < argc && arg == "--only")
+            only = argv[++i];
+        else if (i + 1 < argc && arg == "--json")
+            json = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--ticks N] [--population N] [--only buehler|simple|hopf|cpg|pipeline|network|math] [--json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    Bench bench(ticks, population);
+
+    if (only.empty() || only == "buehler")
+        run_controller<RhexControllerBuehler>(bench, "buehler", [&](const std::vector<std::vector<double> >& ctrls) {
+            bench.batched<BatchedBuehlerController>("buehler", ctrls);
+            bench.batched_accuracy<BatchedBuehlerController, RhexControllerBuehler>("buehler", ctrls);
+        });
+    if (only.empty() || only == "buehler")
+    {
+        typedef BasicRhexControllerBuehler<default_legs, float> BuehlerFloat;
+        typedef BasicRhexControllerBuehler<default_legs, Q16_16> BuehlerFixed;
+        std::vector<double> ctrl = genomes(RhexControllerBuehler::ctrl_size, 1, 42)[0];
+        bench.variant<RhexControllerBuehler, BuehlerFloat>("buehler", "float", ctrl, buehler_float_tolerance);
+        bench.period<RhexControllerBuehler, BuehlerFloat>("buehler", "float", ctrl, float_period_tolerance);
+        bench.variant<RhexControllerBuehler, BuehlerFixed>("buehler", "q16", ctrl, buehler_fixed_tolerance);
+        bench.period<RhexControllerBuehler, BuehlerFixed>("buehler", "q16", ctrl, fixed_period_tolerance);
+        bench.endurance<RhexControllerBuehler, BuehlerFloat>("buehler", "float", ctrl, buehler_float_tolerance, 4);
+        bench.endurance<RhexControllerBuehler, BuehlerFixed>("buehler", "q16", ctrl, buehler_fixed_tolerance, 4);
+        bench.buehler_descriptor(ctrl);
+        bench.steer<RhexControllerBuehler>("buehler", ctrl, true);
+        bench.gait_table<RhexControllerBuehler>("buehler", genomes(RhexControllerBuehler::ctrl_size, 200, 7));
+    }
+    if (only.empty() || only == "simple")
+        run_controller<RhexControllerSimple>(bench, "simple", [&](const std::vector<std::vector<double> >& ctrls) {
+            bench.batched<BatchedSimpleController>("simple", ctrls);
+            bench.batched_accuracy<BatchedSimpleController, RhexControllerSimple>("simple", ctrls);
+        });
+    if (only.empty() || only == "simple")
+    {
+        std::vector<double> ctrl = genomes(RhexControllerSimple::ctrl_size, 1, 42)[0];
+        bench.variant<RhexControllerSimple, BasicRhexControllerSimple<default_legs, double, FastMath> >("simple", "fastmath",
+            ctrl, trajectory_tolerance);
+        bench.variant<RhexControllerSimple, BasicRhexControllerSimple<default_legs, float> >("simple", "float",
+            ctrl, simple_float_tolerance);
+        bench.variant<RhexControllerSimple, BasicRhexControllerSimple<default_legs, Q16_16> >("simple", "q16",
+            ctrl, simple_fixed_tolerance);
+    }
+    if (only.empty() || only == "hopf")
+        run_controller<RhexControllerHopf>(bench, "hopf", [&](const std::vector<std::vector<double> >& ctrls) {
+            bench.batched<BatchedHopfController>("hopf", ctrls);
+        });
+    if (only.empty() || only == "hopf")
+    {
+        typedef BasicRhexControllerHopf<default_legs, double, TripodCoupling> HopfTripod;
+        bench.warm_start<HopfTripod>("hopf tripod", genomes(HopfTripod::ctrl_size, 1, 42)[0]);
+    }
+    if (only.empty() || only == "hopf")
+        bench.steer<RhexControllerHopf>("hopf", genomes(RhexControllerHopf::ctrl_size, 1, 42)[0], false);
+    if (only.empty() || only == "hopf")
+        bench.variant<RhexControllerHopf, BasicRhexControllerHopf<default_legs, double, HexapodCoupling, FastMath> >("hopf",
+            "fastmath", genomes(RhexControllerHopf::ctrl_size, 1, 42)[0], trajectory_tolerance);
+    if (only.empty() || only == "cpg")
+        run_controller<RhexControllerCPG>(bench, "cpg", [&](const std::vector<std::vector<double> >& ctrls) {
+            bench.population<RhexControllerCPG>("cpg", ctrls);
+        });
+    if (only.empty() || only == "cpg")
+        bench.variant<RhexControllerCPG, BasicRhexControllerCPG<default_legs, double, TripodCoupling, FastMath> >("cpg",
+            "fastmath", genomes(RhexControllerCPG::ctrl_size, 1, 42)[0], trajectory_tolerance);
+    if (only.empty() || only == "pipeline")
+        bench.pipeline<RhexControllerBuehler>("buehler", genomes(RhexControllerBuehler::ctrl_size, 1, 42)[0]);
+    if (only.empty() || only == "rollout")
+        bench.rollout<RhexControllerHopf>("hopf", genomes(RhexControllerHopf::ctrl_size, bench.population_size(), 42));
+    if (only.empty() || only == "network")
+    {
+        bench.network<KuramotoOscillator>("kuramoto", true);
+        bench.network<HopfOscillator>("hopf", true);
+        bench.network<MatsuokaOscillator>("matsuoka", false);
+        bench.divergence(genomes(RhexControllerHopf::ctrl_size, 1, 42)[0]);
+    }
+    if (only.empty() || only == "math")
+        bench.math_kernels();
+
+    print_table(bench);
+
+    if (!json.empty())
+    {
+        std::ofstream file(json.c_str());
+        if (!file)
+        {
+            std::cerr << "cannot write " << json << std::endl;
+            return 1;
+        }
+        write_json(file, bench, ticks, population);
+    }
+
+    for (const Accuracy& a : bench.accuracy())
+    {
+        if (!a.passed())
+        {
+            std::cerr << "error above tolerance: " << a.name << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <rhex_controller/rhex_controller_buehler.hpp>
+#include <rhex_controller/rhex_controller_gait_fitness.hpp>
+#include <rhex_controller/rhex_controller_search.hpp>
+
+using namespace rhex_controller;
+
+// searches Buehler gaits with the analytic fitness: CMA-ES towards a tripod with a
+// 0.6 duty factor, then MAP-Elites over duty factor and frequency. Given a prefix,
+// the searches are checkpointed to <prefix>.cmaes and <prefix>.map_elites after
+// each generation and resumed from there when run again.
+int main(int argc, char** argv)
+{
+    std::string prefix = (argc > 1) ? argv[1] : "";
+
+    GaitTargets targets;
+    targets.duty_factor = 0.6;
+    GaitFitness<RhexControllerBuehler> fitness(targets);
+    ParallelEvaluator<GaitFitness<RhexControllerBuehler> > evaluator(fitness);
+
+    CmaEs cmaes(RhexControllerBuehler::ctrl_size, 0.3, 1);
+    std::string checkpoint = prefix.empty() ? "" : prefix + ".cmaes";
+    if (!checkpoint.empty() && std::ifstream(checkpoint.c_str()))
+        cmaes.load(checkpoint);
+    cmaes.run(evaluator, 150, checkpoint);
+
+    GaitMetrics<RhexControllerBuehler::legs> metrics = fitness.measure(cmaes.best());
+    std::cout << "cmaes: " << cmaes.evaluations() << " evaluations, fitness " << cmaes.best_fitness()
+              << " (regularity " << metrics.regularity << ", duty " << metrics.duty_error
+              << ", phase " << metrics.phase_error << ")" << std::endl;
+
+    MapElites map_elites(RhexControllerBuehler::ctrl_size, {10, 10}, 1);
+    checkpoint = prefix.empty() ? "" : prefix + ".map_elites";
+    if (!checkpoint.empty() && std::ifstream(checkpoint.c_str()))
+        map_elites.load(checkpoint);
+    map_elites.run(evaluator, 4096, 128, checkpoint);
+
+    std::cout << "map-elites: " << map_elites.evaluations() << " evaluations, coverage " << map_elites.coverage()
+              << ", best fitness " << map_elites.best()->fitness << std::endl;
+    return 0;
+}
@@ -1,11 +1,26 @@
 #include <iostream>
 #include <rhex_controller/rhex_controller_simple.hpp>
+#include <rhex_controller/rhex_controller_trajectory.hpp>
 
 using namespace rhex_controller;
 
-int main()
+// prints the leg angles, or records them as a binary trajectory when given a file
+// name (see rhex_controller_trajectory.hpp)
+int main(int argc, char** argv)
 {
-    RhexControllerSimple controller({1, 0, 0.5, 0.25, 0.25, 0.5, 1, 0.5, 0.5, 0.25, 0.75, 0.5, 1, 0, 0.5, 0.25, 0.25, 0.5, 1, 0, 0.5, 0.25, 0.75, 0.5, 1, 0.5, 0.5, 0.25, 0.25, 0.5, 1, 0, 0.5, 0.25, 0.75, 0.5}, {});
+    RhexControllerSimple controller({1, 0, 0.5, 0.25, 0.25, 0.5, 1, 0.5, 0.5, 0.25, 0.75, 0.5, 1, 0, 0.5, 0.25, 0.25, 0.5, 1, 0, 0.5, 0.25, 0.75, 0.5, 1, 0.5, 0.5, 0.25, 0.25, 0.5, 1, 0, 0.5, 0.25, 0.75, 0.5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, {});
+
+    if (argc > 1) {
+        TrajectoryWriter writer(argv[1], trajectory::fields(controller));
+        RhexControllerSimple::output_t angles;
+        for (int k = 0; k <= 50; k++) {
+            double t = k * 0.1;
+            controller.pos(t, angles);
+            writer.record(t, controller, angles);
+        }
+        writer.close();
+        return 0;
+    }
 
     for (double t = 0.0; t <= 5.0; t += 0.1) {
         auto angles = controller.pos(t);
@@ -0,0 +1,256 @@
+#ifndef RHEX_MODELS_SKEL_BINARY_HPP
+#define RHEX_MODELS_SKEL_BINARY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Loader of the binary SKEL models written by tools/skel_compile.py (installed
+// next to the XML as <model>.skelb). The file is memory-mapped and its records
+// are used in place, so loading costs an open and an mmap whatever the model.
+// Little-endian hosts only, as the records are read without conversion.
+
+namespace rhex_models {
+
+    // 64-bit FNV-1a, the checksum of the format
+    inline uint64_t fnv1a(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= bytes[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    namespace skel {
+        enum ShapeRole : uint32_t { COLLISION = 0, VISUALIZATION = 1 };
+        enum ShapeType : uint32_t { BOX = 0, ELLIPSOID = 1, CYLINDER = 2, CAPSULE = 3 };
+        enum JointType : uint32_t { FREE = 0, WELD = 1, REVOLUTE = 2, PRISMATIC = 3, BALL = 4, UNIVERSAL = 5 };
+        enum JointFlags : uint32_t { HAS_LIMITS = 1, HAS_SPRING = 2 };
+
+        // transformations are x y z roll pitch yaw, as in the SKEL files
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t header_size;
+            uint64_t xml_size;
+            uint64_t xml_checksum;
+            uint64_t records_checksum;
+            uint32_t body_count;
+            uint32_t shape_count;
+            uint32_t joint_count;
+            uint32_t immobile;
+            double transformation[6];
+            char name[32];
+        };
+
+        struct Body {
+            char name[32];
+            double transformation[6];
+            double mass;
+            double inertia[6]; // ixx ixy ixz iyy iyz izz
+            uint32_t first_shape;
+            uint32_t shape_count;
+        };
+
+        struct Shape {
+            uint32_t body;
+            uint32_t role;
+            uint32_t type;
+            uint32_t padding;
+            double transformation[6];
+            double size[3]; // box and ellipsoid sizes, or radius and height
+            double color[4]; // alpha 0 when the model gives no color
+        };
+
+        struct Joint {
+            char name[32];
+            uint32_t type;
+            int32_t parent; // body index, -1 for the world
+            int32_t child;
+            uint32_t flags;
+            double transformation[6];
+            double axis[3];
+            double lower;
+            double upper;
+            double damping;
+            double spring_stiffness;
+            double rest_position;
+        };
+
+        static_assert(sizeof(Header) == 136, "Header must match tools/skel_compile.py");
+        static_assert(sizeof(Body) == 144, "Body must match tools/skel_compile.py");
+        static_assert(sizeof(Shape) == 120, "Shape must match tools/skel_compile.py");
+        static_assert(sizeof(Joint) == 160, "Joint must match tools/skel_compile.py");
+    } // namespace skel
+
+    class SkelBinary {
+    public:
+        static const uint32_t version = 1;
+
+        SkelBinary() : _data(nullptr), _size(0) {}
+
+        explicit SkelBinary(const std::string& path) : _data(nullptr), _size(0)
+        {
+            open(path);
+        }
+
+        SkelBinary(const SkelBinary&) = delete;
+        SkelBinary& operator=(const SkelBinary&) = delete;
+
+        SkelBinary(SkelBinary&& other) : _data(other._data), _size(other._size)
+        {
+            other._data = nullptr;
+            other._size = 0;
+        }
+
+        ~SkelBinary()
+        {
+            close();
+        }
+
+        // maps the file and checks its layout, throws std::runtime_error if it is not
+        // a binary model of this version
+        void open(const std::string& path)
+        {
+            close();
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("SkelBinary: cannot open " + path);
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(skel::Header)))
+            {
+                ::close(fd);
+                throw std::runtime_error("SkelBinary: " + path + " is too short");
+            }
+
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("SkelBinary: cannot map " + path);
+
+            _data = static_cast<const char*>(data);
+            _size = st.st_size;
+
+            const skel::Header& h = header();
+            size_t expected = sizeof(skel::Header) + h.body_count * sizeof(skel::Body)
+                + h.shape_count * sizeof(skel::Shape) + h.joint_count * sizeof(skel::Joint);
+
+            if (std::memcmp(h.magic, "RHEXSKEL", 8) != 0 || h.version != version
+                || h.header_size != sizeof(skel::Header) || expected != _size)
+            {
+                close();
+                throw std::runtime_error("SkelBinary: " + path + " is not a version 1 binary model");
+            }
+        }
+
+        void close()
+        {
+            if (_data)
+                munmap(const_cast<char*>(_data), _size);
+            _data = nullptr;
+            _size = 0;
+        }
+
+        bool is_open() const
+        {
+            return _data != nullptr;
+        }
+
+        // checks the records against the checksum of the header (reads the whole file)
+        bool verify() const
+        {
+            return fnv1a(_data + sizeof(skel::Header), _size - sizeof(skel::Header)) == header().records_checksum;
+        }
+
+        // whether the binary was compiled from exactly this XML text
+        bool matches(const std::string& xml) const
+        {
+            return xml.size() == header().xml_size && fnv1a(xml.data(), xml.size()) == header().xml_checksum;
+        }
+
+        // whether the binary was compiled from the current content of the SKEL file
+        bool matches_file(const std::string& skel_path) const
+        {
+            std::ifstream file(skel_path.c_str(), std::ios::binary);
+            if (!file)
+                return false;
+
+            std::string xml((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            return matches(xml);
+        }
+
+        const skel::Header& header() const
+        {
+            return *reinterpret_cast<const skel::Header*>(_data);
+        }
+
+        size_t body_count() const
+        {
+            return header().body_count;
+        }
+
+        size_t shape_count() const
+        {
+            return header().shape_count;
+        }
+
+        size_t joint_count() const
+        {
+            return header().joint_count;
+        }
+
+        const skel::Body* bodies() const
+        {
+            return reinterpret_cast<const skel::Body*>(_data + sizeof(skel::Header));
+        }
+
+        const skel::Shape* shapes() const
+        {
+            return reinterpret_cast<const skel::Shape*>(bodies() + body_count());
+        }
+
+        const skel::Joint* joints() const
+        {
+            return reinterpret_cast<const skel::Joint*>(shapes() + shape_count());
+        }
+
+        // nullptr if there is no body of that name
+        const skel::Body* body(const std::string& name) const
+        {
+            for (size_t i = 0; i < body_count(); ++i)
+                if (name == bodies()[i].name)
+                    return &bodies()[i];
+            return nullptr;
+        }
+
+        // nullptr if there is no joint of that name
+        const skel::Joint* joint(const std::string& name) const
+        {
+            for (size_t i = 0; i < joint_count(); ++i)
+                if (name == joints()[i].name)
+                    return &joints()[i];
+            return nullptr;
+        }
+
+    protected:
+        const char* _data;
+        size_t _size;
+    };
+} // namespace rhex_models
+
+#endif
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+# encoding: utf-8
+
+"""
+Compiles a SKEL model into the binary format read by
+include/rhex_models/skel_binary.hpp: fixed-size little-endian records that can
+be memory-mapped and used in place, without any XML parsing.
+
+    header   136 bytes
+    bodies   144 bytes each
+    shapes   120 bytes each, grouped by body
+    joints   160 bytes each
+
+The header keeps the size and FNV-1a checksum of the XML it was compiled from,
+so a loader can tell whether the binary is stale, and the checksum of the
+records that follow it. Works with python 2 and 3 (waf runs this at build time).
+
+usage: skel_compile.py model.skel [model.skelb]
+"""
+
+import struct
+import sys
+import xml.etree.ElementTree as ET
+
+MAGIC = b'RHEXSKEL'
+VERSION = 1
+NAME_SIZE = 32
+
+HEADER = struct.Struct('<8sII QQQ IIII 6d 32s')
+BODY = struct.Struct('<32s 6d d 6d II')
+SHAPE = struct.Struct('<IIII 6d 3d 4d')
+JOINT = struct.Struct('<32s IiiI 6d 3d 5d')
+
+SHAPE_ROLES = {'collision_shape': 0, 'visualization_shape': 1}
+SHAPE_TYPES = {'box': 0, 'ellipsoid': 1, 'cylinder': 2, 'capsule': 3}
+JOINT_TYPES = {'free': 0, 'weld': 1, 'revolute': 2, 'prismatic': 3, 'ball': 4, 'universal': 5}
+
+JOINT_HAS_LIMITS = 1
+JOINT_HAS_SPRING = 2
+
+
+def fnv1a(data):
+    h = 0xcbf29ce484222325
+    for byte in bytearray(data):
+        h ^= byte
+        h = (h * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def name(text):
+    encoded = text.encode('utf-8')
+    if len(encoded) >= NAME_SIZE:
+        raise ValueError('name too long for the binary format: ' + text)
+    return encoded
+
+
+def floats(element, tag, count, default=0.):
+    node = element.find(tag)
+    if node is None or node.text is None:
+        return [default] * count
+    values = [float(v) for v in node.text.split()]
+    if len(values) != count:
+        raise ValueError('expected %d values in <%s>' % (count, tag))
+    return values
+
+
+def number(element, tag, default=0.):
+    return floats(element, tag, 1, default)[0]
+
+
+def shape_size(geometry):
+    for kind in geometry:
+        if kind.tag not in SHAPE_TYPES:
+            raise ValueError('unsupported shape: ' + kind.tag)
+        if kind.tag in ('box', 'ellipsoid'):
+            return SHAPE_TYPES[kind.tag], floats(kind, 'size', 3)
+        return SHAPE_TYPES[kind.tag], [number(kind, 'radius'), number(kind, 'height'), 0.]
+    raise ValueError('empty <geometry>')
+
+
+def compile_skel(xml):
+    root = ET.fromstring(xml)
+    skeleton = root.find('skeleton')
+    if skeleton is None:
+        raise ValueError('no <skeleton> in the file')
+
+    bodies = []
+    shapes = []
+    body_index = {}
+    for body in skeleton.findall('body'):
+        body_index[body.get('name')] = len(bodies)
+        first_shape = len(shapes)
+
+        for shape in body:
+            if shape.tag not in SHAPE_ROLES:
+                continue
+            kind, size = shape_size(shape.find('geometry'))
+            color = floats(shape, 'color', 3, None)
+            rgba = color + [1.] if color[0] is not None else [0., 0., 0., 0.]
+            shapes.append(SHAPE.pack(len(bodies), SHAPE_ROLES[shape.tag], kind, 0,
+                                     *(floats(shape, 'transformation', 6) + size + rgba)))
+
+        inertia = body.find('inertia')
+        moment = inertia.find('moment_of_inertia') if inertia is not None else None
+        tensor = [number(moment, tag) if moment is not None else 0.
+                  for tag in ('ixx', 'ixy', 'ixz', 'iyy', 'iyz', 'izz')]
+        mass = number(inertia, 'mass') if inertia is not None else 0.
+
+        bodies.append(BODY.pack(name(body.get('name')),
+                                *(floats(body, 'transformation', 6) + [mass] + tensor
+                                  + [first_shape, len(shapes) - first_shape])))
+
+    joints = []
+    for joint in skeleton.findall('joint'):
+        kind = joint.get('type')
+        if kind not in JOINT_TYPES:
+            raise ValueError('unsupported joint type: %s' % kind)
+
+        parent = joint.findtext('parent', 'world').strip()
+        child = joint.findtext('child').strip()
+
+        flags = 0
+        axis = [0., 0., 0.]
+        lower, upper, damping, stiffness, rest = 0., 0., 0., 0., 0.
+        element = joint.find('axis')
+        if element is not None:
+            axis = floats(element, 'xyz', 3)
+            dynamics = element.find('dynamics')
+            if dynamics is not None:
+                damping = number(dynamics, 'damping')
+                # the models spell it sprint_rest_position
+                rest = number(dynamics, 'spring_rest_position', number(dynamics, 'sprint_rest_position'))
+                if dynamics.find('spring_stiffness') is not None:
+                    stiffness = number(dynamics, 'spring_stiffness')
+                    flags |= JOINT_HAS_SPRING
+            limit = element.find('limit')
+            if limit is not None:
+                lower = number(limit, 'lower')
+                upper = number(limit, 'upper')
+                flags |= JOINT_HAS_LIMITS
+
+        joints.append(JOINT.pack(name(joint.get('name')), JOINT_TYPES[kind],
+                                 body_index[parent] if parent != 'world' else -1,
+                                 body_index[child], flags,
+                                 *(floats(joint, 'transformation', 6) + axis
+                                   + [lower, upper, damping, stiffness, rest])))
+
+    payload = b''.join(bodies) + b''.join(shapes) + b''.join(joints)
+    immobile = skeleton.findtext('imobile', 'false').strip() == 'true'
+
+    header = HEADER.pack(MAGIC, VERSION, HEADER.size, len(xml), fnv1a(xml), fnv1a(payload),
+                         len(bodies), len(shapes), len(joints), 1 if immobile else 0,
+                         *(floats(skeleton, 'transformation', 6) + [name(skeleton.get('name'))]))
+
+    return header + payload
+
+
+def main(argv):
+    if len(argv) not in (2, 3):
+        sys.stderr.write(__doc__)
+        return 1
+
+    source = argv[1]
+    target = argv[2] if len(argv) == 3 else source.rsplit('.', 1)[0] + '.skelb'
+
+    with open(source, 'rb') as f:
+        xml = f.read()
+    data = compile_skel(xml)
+
+    with open(target, 'wb') as f:
+        f.write(data)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
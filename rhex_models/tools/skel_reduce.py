@@ -0,0 +1,340 @@
+#!/usr/bin/env python
+# encoding: utf-8
+
+"""
+Generates lower-fidelity variants of a SKEL model: each compliant leg, a chain
+of 8 segments joined by 7 spring-loaded revolute joints, becomes fewer segments.
+
+    --segments N   N rigid segments per leg (1 to 8): consecutive segments are
+                   merged and the 7 passive joints are split in N - 1 groups,
+                   each replaced by one joint with the series-equivalent
+                   stiffness and damping and the summed range
+    --prismatic    a single segment sliding on a spring along the hip to tip
+                   direction, with the stiffness of all the joints seen at the tip
+
+Merged segments keep the total mass, centre of mass and inertia of the
+segments they replace (parallel axis theorem); their boxes are kept as shapes
+of the merged body. Bodies are renamed leg_<leg>_<1..N> and passive joints
+<name>_<1..N-1>, as in the full models.
+
+usage: skel_reduce.py (--segments N | --prismatic) model.skel reduced.skel
+"""
+
+import argparse
+import copy
+import math
+import sys
+import xml.etree.ElementTree as ET
+
+from skel_compile import floats, number
+
+
+# 3x3 matrices as lists of rows, SKEL transformations are x y z roll pitch yaw
+# with the rotation Rx(roll) Ry(pitch) Rz(yaw), as DART reads them
+
+def matmul(a, b):
+    return [[sum(a[i][k] * b[k][j] for k in range(3)) for j in range(3)] for i in range(3)]
+
+
+def transpose(a):
+    return [[a[j][i] for j in range(3)] for i in range(3)]
+
+
+def apply(a, v):
+    return [sum(a[i][k] * v[k] for k in range(3)) for i in range(3)]
+
+
+def euler_to_matrix(roll, pitch, yaw):
+    cr, sr = math.cos(roll), math.sin(roll)
+    cp, sp = math.cos(pitch), math.sin(pitch)
+    cy, sy = math.cos(yaw), math.sin(yaw)
+    rx = [[1, 0, 0], [0, cr, -sr], [0, sr, cr]]
+    ry = [[cp, 0, sp], [0, 1, 0], [-sp, 0, cp]]
+    rz = [[cy, -sy, 0], [sy, cy, 0], [0, 0, 1]]
+    return matmul(matmul(rx, ry), rz)
+
+
+def matrix_to_euler(r):
+    pitch = math.asin(max(-1., min(1., r[0][2])))
+    if abs(r[0][2]) < 1 - 1e-12:
+        roll = math.atan2(-r[1][2], r[2][2])
+        yaw = math.atan2(-r[0][1], r[0][0])
+    else:  # gimbal lock, put everything in roll
+        roll = math.atan2(r[2][1], r[1][1])
+        yaw = 0.
+    return roll, pitch, yaw
+
+
+class Frame(object):
+    def __init__(self, rotation, position):
+        self.rotation = rotation
+        self.position = position
+
+    @staticmethod
+    def parse(element):
+        v = floats(element, 'transformation', 6)
+        return Frame(euler_to_matrix(*v[3:]), v[:3])
+
+    def compose(self, other):
+        return Frame(matmul(self.rotation, other.rotation),
+                     [p + q for p, q in zip(self.position, apply(self.rotation, other.position))])
+
+    def inverse(self):
+        rt = transpose(self.rotation)
+        return Frame(rt, [-x for x in apply(rt, self.position)])
+
+    def text(self):
+        values = self.position + list(matrix_to_euler(self.rotation))
+        return ' '.join('%.10g' % (0. if abs(x) < 1e-14 else x) for x in values)
+
+
+INERTIA_TAGS = ('ixx', 'ixy', 'ixz', 'iyy', 'iyz', 'izz')
+
+
+def inertia_matrix(body):
+    moment = body.find('inertia/moment_of_inertia')
+    xx, xy, xz, yy, yz, zz = [number(moment, tag) for tag in INERTIA_TAGS]
+    return [[xx, xy, xz], [xy, yy, yz], [xz, yz, zz]]
+
+
+def merge(bodies, name):
+    """One body with the mass properties and shapes of the given (rigidly
+    attached) bodies, its frame at their centre of mass with the orientation
+    of the first one."""
+    base = Frame.parse(bodies[0])
+    to_base = base.inverse()
+
+    total = 0.
+    com = [0., 0., 0.]
+    parts = []
+    for body in bodies:
+        mass = number(body.find('inertia'), 'mass')
+        frame = to_base.compose(Frame.parse(body))
+        parts.append((body, mass, frame))
+        total += mass
+        com = [c + mass * p for c, p in zip(com, frame.position)]
+    com = [c / total for c in com]
+
+    # inertia about the merged centre of mass, in the base orientation
+    inertia = [[0.] * 3 for _ in range(3)]
+    for body, mass, frame in parts:
+        rotated = matmul(matmul(frame.rotation, inertia_matrix(body)), transpose(frame.rotation))
+        r = [p - c for p, c in zip(frame.position, com)]
+        r2 = sum(x * x for x in r)
+        for i in range(3):
+            for j in range(3):
+                inertia[i][j] += rotated[i][j] + mass * ((r2 if i == j else 0.) - r[i] * r[j])
+
+    merged_frame = base.compose(Frame([[1, 0, 0], [0, 1, 0], [0, 0, 1]], com))
+
+    merged = ET.Element('body', {'name': name})
+    ET.SubElement(merged, 'transformation').text = merged_frame.text()
+    element = ET.SubElement(merged, 'inertia')
+    ET.SubElement(element, 'mass').text = '%.10g' % total
+    moment = ET.SubElement(element, 'moment_of_inertia')
+    for tag, (i, j) in zip(INERTIA_TAGS, [(0, 0), (0, 1), (0, 2), (1, 1), (1, 2), (2, 2)]):
+        ET.SubElement(moment, tag).text = '%.10g' % inertia[i][j]
+
+    # the shapes stay where they were, expressed in the merged frame
+    to_merged = merged_frame.inverse()
+    count = {}
+    for body in bodies:
+        frame = to_merged.compose(Frame.parse(body))
+        for shape in body:
+            if shape.tag not in ('collision_shape', 'visualization_shape'):
+                continue
+            shape = copy.deepcopy(shape)
+            local = frame.compose(Frame.parse(shape))
+            for old in shape.findall('transformation'):
+                shape.remove(old)
+            ET.SubElement(shape, 'transformation').text = local.text()
+            count[shape.tag] = count.get(shape.tag, 0) + 1
+            shape.set('name', '%s_%d' % (shape.tag, count[shape.tag]))
+            merged.append(shape)
+
+    return merged, merged_frame
+
+
+def joint_frame(joint, child_frame):
+    """world frame of a joint, SKEL joint transformations being relative to the child"""
+    return child_frame.compose(Frame.parse(joint))
+
+
+def set_transformation(element, frame):
+    for old in element.findall('transformation'):
+        element.remove(old)
+    node = ET.Element('transformation')
+    node.text = frame.text()
+    # keep the transformation after parent and child
+    element.insert(2, node)
+
+
+def dynamics_of(joint):
+    dynamics = joint.find('axis/dynamics')
+    limit = joint.find('axis/limit')
+    return {
+        'stiffness': number(dynamics, 'spring_stiffness', float('inf')) if dynamics is not None else float('inf'),
+        'damping': number(dynamics, 'damping', float('inf')) if dynamics is not None else float('inf'),
+        'lower': number(limit, 'lower') if limit is not None else None,
+        'upper': number(limit, 'upper') if limit is not None else None,
+    }
+
+
+def series(values):
+    inverse = sum(1. / v for v in values if v != float('inf') and v > 0)
+    return 1. / inverse if inverse > 0 else float('inf')
+
+
+def set_dynamics(joint, axis, stiffness, damping, lower, upper):
+    for old in joint.findall('axis'):
+        joint.remove(old)
+    element = ET.SubElement(joint, 'axis')
+    ET.SubElement(element, 'xyz').text = ' '.join('%.10g' % x for x in axis)
+    dynamics = ET.SubElement(element, 'dynamics')
+    ET.SubElement(dynamics, 'spring_rest_position').text = '0'
+    if stiffness != float('inf'):
+        ET.SubElement(dynamics, 'spring_stiffness').text = '%.10g' % stiffness
+    if damping != float('inf'):
+        ET.SubElement(dynamics, 'damping').text = '%.10g' % damping
+    if lower is not None:
+        limit = ET.SubElement(element, 'limit')
+        ET.SubElement(limit, 'lower').text = '%.10g' % lower
+        ET.SubElement(limit, 'upper').text = '%.10g' % upper
+
+
+def split(count, parts):
+    """count items in parts contiguous, nearly equal groups, as index lists"""
+    bounds = [int(round(float(count) * k / parts)) for k in range(parts + 1)]
+    return [list(range(bounds[k], bounds[k + 1])) for k in range(parts)]
+
+
+def legs_of(skeleton):
+    bodies = dict((b.get('name'), b) for b in skeleton.findall('body'))
+    by_parent = {}
+    for joint in skeleton.findall('joint'):
+        by_parent.setdefault(joint.findtext('parent').strip(), []).append(joint)
+
+    legs = []
+    for hip in skeleton.findall('joint'):
+        if not hip.get('name').startswith('body_joint_'):
+            continue
+        chain = [bodies[hip.findtext('child').strip()]]
+        joints = []
+        while True:
+            nexts = [j for j in by_parent.get(chain[-1].get('name'), []) if j.get('type') == 'revolute']
+            if len(nexts) != 1:
+                break
+            joints.append(nexts[0])
+            chain.append(bodies[nexts[0].findtext('child').strip()])
+        legs.append((hip, chain, joints))
+    return legs
+
+
+def reduce_leg(skeleton, hip, chain, joints, segments, prismatic):
+    leg = hip.get('name')[len('body_joint_'):]
+    prefix = joints[0].get('name').rsplit('_', 1)[0] if joints else 'leg_%s_joint' % leg
+    frames = [Frame.parse(b) for b in chain]
+    hip_frame = joint_frame(hip, frames[0])
+
+    if prismatic:
+        segments = 2
+    if not 1 <= segments <= len(chain):
+        raise ValueError('--segments must be between 1 and %d' % len(chain))
+
+    # joints are grouped first, each group keeps its middle joint as the cut
+    # between two merged segments
+    groups = split(len(joints), segments - 1) if segments > 1 else []
+    cuts = [g[len(g) // 2] for g in groups]
+    bounds = [0] + [c + 1 for c in cuts] + [len(chain)]
+
+    merged = []
+    for s in range(segments):
+        body, frame = merge(chain[bounds[s]:bounds[s + 1]], 'leg_%s_%d' % (leg, s + 1))
+        merged.append((body, frame))
+
+    position = list(skeleton).index(chain[0])
+    for body in chain:
+        skeleton.remove(body)
+    for s, (body, _) in enumerate(merged):
+        skeleton.insert(position + s, body)
+
+    hip.find('child').text = merged[0][0].get('name')
+    set_transformation(hip, merged[0][1].inverse().compose(hip_frame))
+
+    new_joints = []
+    for s, group in enumerate(groups):
+        cut = joints[cuts[s]]
+        world = joint_frame(cut, frames[cuts[s] + 1])
+        dynamics = [dynamics_of(joints[j]) for j in group]
+        child_frame = merged[s + 1][1]
+
+        joint = ET.Element('joint', {'type': 'revolute', 'name': '%s_%d' % (prefix, s + 1)})
+        ET.SubElement(joint, 'parent').text = merged[s][0].get('name')
+        ET.SubElement(joint, 'child').text = merged[s + 1][0].get('name')
+        set_transformation(joint, child_frame.inverse().compose(world))
+
+        stiffness = series([d['stiffness'] for d in dynamics])
+        damping = series([d['damping'] for d in dynamics])
+        lowers = [d['lower'] for d in dynamics if d['lower'] is not None]
+        uppers = [d['upper'] for d in dynamics if d['upper'] is not None]
+        lower = sum(lowers) if len(lowers) == len(dynamics) else None
+        upper = sum(uppers) if lower is not None else None
+        axis = floats(cut.find('axis'), 'xyz', 3)
+
+        if prismatic:
+            # slide along the hip to tip direction, in the joint frame; a rotation
+            # theta of the chain moves the tip by about theta * reach
+            tip = chain[-1]
+            tip_world = Frame.parse(tip).position
+            hip_world = hip_frame.position
+            direction = [t - h for t, h in zip(tip_world, hip_world)]
+            reach = math.sqrt(sum(x * x for x in direction))
+            axis = apply(transpose(world.rotation), [x / reach for x in direction])
+
+            # the single group holds all the joints, their range becomes a compression
+            stiffness /= reach ** 2
+            damping /= reach ** 2
+            if lower is not None:
+                lower, upper = -upper * reach, -lower * reach
+            joint.set('type', 'prismatic')
+
+        set_dynamics(joint, axis, stiffness, damping, lower, upper)
+        new_joints.append(joint)
+
+    position = list(skeleton).index(joints[0]) if joints else len(list(skeleton))
+    for joint in joints:
+        skeleton.remove(joint)
+    for s, joint in enumerate(new_joints):
+        skeleton.insert(position + s, joint)
+
+
+def reduce_skel(xml, segments, prismatic):
+    root = ET.fromstring(xml)
+    skeleton = root.find('skeleton')
+    for hip, chain, joints in legs_of(skeleton):
+        reduce_leg(skeleton, hip, chain, joints, segments, prismatic)
+    return ET.tostring(root)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Reduced-order leg variants of a SKEL model')
+    mode = parser.add_mutually_exclusive_group(required=True)
+    mode.add_argument('--segments', type=int, help='rigid segments per leg')
+    mode.add_argument('--prismatic', action='store_true', help='single prismatic-spring leg')
+    parser.add_argument('source')
+    parser.add_argument('target')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.source, 'rb') as f:
+        xml = f.read()
+    reduced = reduce_skel(xml, args.segments or 2, args.prismatic)
+
+    with open(args.target, 'wb') as f:
+        f.write(b'<?xml version="1.0"?>\n')
+        f.write(reduced)
+        f.write(b'\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))